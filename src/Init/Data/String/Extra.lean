@@ -22,6 +22,16 @@ def toNat! (s : String) : Nat :=
 @[extern "lean_string_from_utf8_unchecked"]
 constant fromUTF8Unchecked (a : @& ByteArray) : String
 
+/-- Return `true` iff `a` is a well-formed UTF-8 encoded string. -/
+@[extern "lean_string_validate_utf8"]
+constant validateUTF8 (a : @& ByteArray) : Bool
+
+/--
+  Convert a UTF-8 encoded `ByteArray` string to `String`.
+  Return `none` if `a` is not properly UTF-8 encoded. -/
+@[extern "lean_string_from_utf8"]
+constant fromUTF8? (a : @& ByteArray) : Option String
+
 @[extern "lean_string_to_utf8"]
 constant toUTF8 (a : @& String) : ByteArray
 
@@ -73,6 +73,18 @@ set_option compiler.extract_closed false in
    The action `initializing` returns `true` iff it is invoked during initialization. -/
 @[extern "lean_io_initializing"] constant IO.initializing : IO Bool
 
+namespace Runtime
+
+/--
+  Mark `a` and all objects reachable from it as persistent. Persistent objects are neither reference counted
+  nor deallocated, and sharing them with other threads (e.g., by capturing them in a `Task`) is a constant time
+  operation. This is meant for large immutable values that live until the end of the process, such as an
+  imported environment. -/
+@[extern "lean_runtime_mark_persistent"]
+unsafe constant markPersistent (a : α) : IO α
+
+end Runtime
+
 namespace IO
 
 def ofExcept [ToString ε] (e : Except ε α) : IO α :=
@@ -126,6 +138,57 @@ constant bindTask (t : Task α) (f : α → IO (Task (Except IO.Error β))) (pri
 /-- Helper method for implementing "deterministic" timeouts. It is the numbe of "small" memory allocations performed by the current execution thread. -/
 @[extern "lean_io_get_num_heartbeats"] constant getNumHeartbeats : EIO ε Nat
 
+/-- Free the objects whose deletion was deferred by `IO.setDeleteBudget` in the current thread, and
+  return to the operating system the memory of the empty pages of the small object allocator.
+  Long running processes (e.g., the server) may use it when they become idle. -/
+@[extern "lean_io_release_free_memory"] constant releaseFreeMemory : IO Unit
+
+/-- Set the maximum amount of memory (in bytes) in empty pages that the allocator of each thread keeps for reuse.
+  Memory beyond this limit is returned to the operating system. -/
+@[extern "lean_io_set_max_empty_memory"] constant setMaxEmptyMemory (sz : USize) : IO Unit
+
+/-- Set the maximum number of objects freed when a reference counter reaches zero, `0` means unlimited (the default).
+  The remaining objects of the released object graph are freed incrementally by the same thread.
+  It reduces the latency spikes produced by releasing big values (e.g., an old `Environment`).
+  Setting the budget back to `0` frees all pending objects. -/
+@[extern "lean_io_set_delete_budget"] constant setDeleteBudget (n : USize) : IO Unit
+
+/-- Statistics of the small object allocator accumulated over all threads. See `IO.getAllocStats`. -/
+structure AllocStats where
+  /-- `smallAllocs[i]` is the number of allocations of objects of size `8*(i+1)` bytes. -/
+  smallAllocs      : Array Nat
+  smallFrees       : Array Nat
+  /-- Objects bigger than 4096 bytes. -/
+  bigAllocs        : Nat
+  bigFrees         : Nat
+  bigAllocBytes    : Nat
+  bigFreeBytes     : Nat
+  /-- Bytes used by objects that have not been deallocated yet. -/
+  liveBytes        : Nat
+  segments         : Nat
+  /-- Number of pages in all segments, including the empty and decommitted ones. -/
+  pages            : Nat
+  emptyPages       : Nat
+  decommittedPages : Nat
+  /-- Number of objects deallocated by a thread different from the one that allocated them. -/
+  remoteFrees      : Nat
+  /-- Number of batches of remotely deallocated objects sent to their owners, and number of objects received. -/
+  exports          : Nat
+  imported         : Nat
+  /-- Number of big objects allocated from the cache of deallocated ones. -/
+  mediumReuses     : Nat
+  /-- Number of objects bigger than 4 Mb. They are mapped directly. -/
+  hugeAllocs       : Nat
+  /-- Number of objects resized without copying. -/
+  inPlaceResizes   : Nat
+  /-- Memory returned to the operating system. -/
+  decommittedBytes : Nat
+  unmappedBytes    : Nat
+
+/-- Return the current allocator statistics. The counters of other threads are read while they are running,
+  so the result is only approximate if they are allocating. -/
+@[extern "lean_io_get_alloc_stats"] constant getAllocStats : IO AllocStats
+
 inductive FS.Mode where
   | read | write | readWrite | append
 
@@ -6,6 +6,7 @@ Authors: Leonardo de Moura, Sebastian Ullrich
 import Lean.Elab.Import
 import Lean.Elab.Command
 import Lean.Util.Profile
+import Lean.DeclarationRange
 
 namespace Lean.Elab.Frontend
 
@@ -93,15 +94,31 @@ builtin_initialize
 def getPrintMessageEndPos (opts : Options) : Bool :=
   opts.getBool `printMessageEndPos false
 
+/- Position of `declName` for reporting the failure of an asynchronous theorem check. Auxiliary theorems such as
+   `foo._proof_1` have no declaration range of their own, and are reported at the closest enclosing declaration. -/
+private partial def findDeclPos? (env : Environment) : Name → Option Position
+  | Name.anonymous => none
+  | declName       =>
+    match declRangeExt.find? env declName with
+    | some ranges => some ranges.range.pos
+    | none        => findDeclPos? env declName.getPrefix
+
 @[export lean_run_frontend]
 def runFrontend (input : String) (opts : Options) (fileName : String) (mainModuleName : Name) : IO (Environment × Bool) := do
   let inputCtx := Parser.mkInputContext input fileName
   let (header, parserState, messages) ← Parser.parseHeader inputCtx
-  let (env, messages) ← processHeader header opts messages inputCtx
+  -- the imported environment is alive until the end of the process
+  let (env, messages) ← processHeader header opts messages inputCtx (leakEnv := true)
   let env := env.setMainModule mainModuleName
   let s ← IO.processCommands inputCtx parserState (Command.mkState env messages opts)
-  for msg in s.commandState.messages.toList do
+  let mut messages := s.commandState.messages
+  for (declName, ex) in (← waitTheoremChecks) do
+    let pos := (findDeclPos? s.commandState.env declName).getD { line := 1, column := 0 }
+    messages := messages.add {
+      fileName := fileName, pos := pos,
+      data := m!"failed to check theorem '{declName}': {ex.toMessageData opts}" }
+  for msg in messages.toList do
     IO.print (← msg.toString (includeEndPos := getPrintMessageEndPos opts))
-  pure (s.commandState.env, !s.commandState.messages.hasErrors)
+  pure (s.commandState.env, !messages.hasErrors)
 
 end Lean.Elab
@@ -15,9 +15,9 @@ def headerToImports (header : Syntax) : List Import :=
     { module := id, runtimeOnly := runtime }
 
 def processHeader (header : Syntax) (opts : Options) (messages : MessageLog) (inputCtx : Parser.InputContext) (trustLevel : UInt32 := 0)
-    : IO (Environment × MessageLog) := do
+    (leakEnv := false) : IO (Environment × MessageLog) := do
   try
-    let env ← importModules (headerToImports header) opts trustLevel
+    let env ← importModules (headerToImports header) opts trustLevel leakEnv
     pure (env, messages)
   catch e =>
     let env ← mkEmptyEnvironment
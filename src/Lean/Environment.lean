@@ -122,6 +122,12 @@ inductive KernelException where
   | invalidProj      (env : Environment) (lctx : LocalContext) (proj : Expr)
   | other            (msg : String)
 
+/--
+  Wait for the theorem values that are being type checked asynchronously (see the `kernel.async_theorems` option),
+  and return the names of the theorems whose check failed together with the exceptions. -/
+@[extern "lean_wait_theorem_checks"]
+constant waitTheoremChecks : IO (Array (Name × KernelException))
+
 namespace Environment
 
 /- Type check given declaration and add it to the environment -/
@@ -469,6 +475,20 @@ instance : Inhabited ModuleData :=
 constant saveModuleData (fname : @& String) (m : ModuleData) : IO Unit
 @[extern 2 "lean_read_module_data"]
 constant readModuleData (fname : @& String) : IO (ModuleData × CompactedRegion)
+/-- Read the given .olean files in parallel using the task manager. -/
+@[extern 2 "lean_read_module_data_parallel"]
+constant readModuleDataParallel (fnames : @& Array String) : IO (Array (ModuleData × CompactedRegion))
+/--
+  Return the hash of the module data stored in the header of the given .olean file. The hash does not depend on
+  whether the file is compressed (see the `olean.compress` option). -/
+@[extern 2 "lean_read_module_data_hash"]
+constant readModuleDataHash (fname : @& String) : IO UInt64
+
+/--
+  Remove all entries from the kernel cache of results for imported terms (see the `kernel.cache_capacity` option).
+  It must be invoked before the compacted regions of imports are freed. -/
+@[extern "lean_kernel_clear_cache"]
+constant Kernel.clearCache : IO Unit
 
 /--
   Free compacted regions of imports. No live references to imported objects may exist at the time of invocation; in
@@ -542,9 +562,16 @@ structure ImportState where
   moduleData    : Array ModuleData := #[]
   regions       : Array CompactedRegion := #[]
 
+/--
+  Import the given modules and their dependencies.
+
+  If `leakEnv` is `true`, the resulting environment is marked as persistent (see `Runtime.markPersistent`).
+  It is then never deallocated, but capturing it in a `Task` or storing it in an `IO.Ref` is a constant time operation
+  instead of a traversal of all its (non-compacted) objects. Use it when the environment lives until the end of the process. -/
 @[export lean_import_modules]
-partial def importModules (imports : List Import) (opts : Options) (trustLevel : UInt32 := 0) : IO Environment := profileitIO "import" opts do
-  let (_, s) ← importMods imports |>.run {}
+partial def importModules (imports : List Import) (opts : Options) (trustLevel : UInt32 := 0) (leakEnv := false) : IO Environment := profileitIO "import" opts do
+  let loaded ← readMods imports.toArray {}
+  let (_, s) ← importMods loaded imports |>.run {}
   -- (moduleNames, mods, regions)
   let mut modIdx : Nat := 0
   let mut const2ModIdx : HashMap Name ModuleIdx := {}
@@ -569,34 +596,67 @@ partial def importModules (imports : List Import) (opts : Options) (trustLevel :
       moduleNames  := s.moduleNames
     }
   }
-  let env ← setImportedEntries env s.moduleData
-  let env ← finalizePersistentExtensions env opts
+  let mut env ← setImportedEntries env s.moduleData
+  if leakEnv then
+    /- Mark persistent a first time before `finalizePersistentExtensions`, which
+       avoids costly MT markings when e.g. an extension stores the environment in an `IO.Ref`. -/
+    env ← unsafe Runtime.markPersistent env
+  env ← finalizePersistentExtensions env opts
+  if leakEnv then
+    /- Ensure the final environment including environment extension states is
+       marked persistent as documented. -/
+    env ← unsafe Runtime.markPersistent env
   pure env
 where
-  importMods : List Import → StateRefT ImportState IO Unit
+  /- Read the .olean files of all modules reachable from `imports`. The import graph is explored one layer at a time,
+     and the files of each layer are read in parallel. -/
+  readMods (imports : Array Import) (loaded : HashMap Name (ModuleData × CompactedRegion)) : IO (HashMap Name (ModuleData × CompactedRegion)) := do
+    let mut names : Array Name := #[]
+    let mut files : Array String := #[]
+    let mut visited : NameHashSet := {}
+    for i in imports do
+      unless i.runtimeOnly || loaded.contains i.module || visited.contains i.module do
+        let mFile ← findOLean i.module
+        unless (← IO.fileExists mFile) do
+          throw $ IO.userError s!"object file '{mFile}' of module {i.module} does not exist"
+        visited := visited.insert i.module
+        names := names.push i.module
+        files := files.push mFile
+    if names.isEmpty then
+      return loaded
+    let mods ← readModuleDataParallel files
+    let mut loaded := loaded
+    let mut next : Array Import := #[]
+    for (n, mod) in names.zip mods do
+      loaded := loaded.insert n mod
+      next := next ++ mod.1.imports
+    readMods next loaded
+  /- Collect the modules read by `readMods` in the order in which they must be added to the environment. -/
+  importMods (loaded : HashMap Name (ModuleData × CompactedRegion)) : List Import → StateRefT ImportState IO Unit
   | []    => pure ()
   | i::is => do
     if i.runtimeOnly || (← get).moduleNameSet.contains i.module then
-      importMods is
+      importMods loaded is
     else do
       modify fun s => { s with moduleNameSet := s.moduleNameSet.insert i.module }
-      let mFile ← findOLean i.module
-      unless (← IO.fileExists mFile) do
-        throw $ IO.userError s!"object file '{mFile}' of module {i.module} does not exist"
-      let (mod, region) ← readModuleData mFile
-      importMods mod.imports.toList
-      modify fun s => { s with
-        moduleData  := s.moduleData.push mod
-        regions     := s.regions.push region
-        moduleNames := s.moduleNames.push i.module
-      }
-      importMods is
+      match loaded.find? i.module with
+      | none => throw $ IO.userError s!"unknown module '{i.module}'"
+      | some (mod, region) =>
+        importMods loaded mod.imports.toList
+        modify fun s => { s with
+          moduleData  := s.moduleData.push mod
+          regions     := s.regions.push region
+          moduleNames := s.moduleNames.push i.module
+        }
+        importMods loaded is
 /--
   Create environment object from imports and free compacted regions after calling `act`. No live references to the
   environment object or imported objects may exist after `act` finishes. -/
 unsafe def withImportModules {α : Type} (imports : List Import) (opts : Options) (trustLevel : UInt32 := 0) (x : Environment → IO α) : IO α := do
   let env ← importModules imports opts trustLevel
-  try x env finally env.freeRegions
+  try x env finally
+    Kernel.clearCache
+    env.freeRegions
 
 builtin_initialize namespacesExt : SimplePersistentEnvExtension Name NameSet ←
   registerSimplePersistentEnvExtension {
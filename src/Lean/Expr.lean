@@ -644,6 +644,16 @@ constant instantiateRange (e : @& Expr) (beginIdx endIdx : @& Nat) (xs : @& Arra
 @[extern "lean_expr_instantiate_rev_range"]
 constant instantiateRevRange (e : @& Expr) (beginIdx endIdx : @& Nat) (xs : @& Array Expr) : Expr
 
+/--
+  Given `e` of the form `fun (x_1 : A_1) ... (x_n : A_n) => b` (or a telescope of `forallE` binders),
+  where `n := endIdx - beginIdx`, return `b[x_1 := xs[beginIdx], ..., x_n := xs[endIdx-1]]`.
+  It is equivalent to `instantiate1`ing the binders one by one, but `b` is traversed only once.
+  If `e` has fewer than `n` leading `lam`/`forallE` binders, only the existing ones are instantiated.
+  `letE` binders are not skipped.
+  Function panics if `beginIdx <= endIdx <= xs.size` does not hold. -/
+@[extern "lean_expr_instantiate_binders"]
+constant instantiateBinders (e : @& Expr) (beginIdx endIdx : @& Nat) (xs : @& Array Expr) : Expr
+
 /-- Replace free variables `xs` with loose bound variables. -/
 @[extern "lean_expr_abstract"]
 constant abstract (e : @& Expr) (xs : @& Array Expr) : Expr
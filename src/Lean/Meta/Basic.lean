@@ -1030,13 +1030,19 @@ def setInlineAttribute (declName : Name) (kind := Compiler.InlineAttributeKind.i
   | Except.ok env    => setEnv env
   | Except.error msg => throwError msg
 
+/- Return the number of leading `forallE` (`lam` if `lambda := true`) binders in `e`, up to `n`. -/
+private def countHeadBinders (lambda : Bool) : Expr → Nat → Nat → Nat
+  | Expr.forallE _ _ b _, n+1, k => if lambda then k else countHeadBinders lambda b n (k+1)
+  | Expr.lam _ _ b _,     n+1, k => if lambda then countHeadBinders lambda b n (k+1) else k
+  | _,                    _,   k => k
+
 private partial def instantiateForallAux (ps : Array Expr) (i : Nat) (e : Expr) : MetaM Expr := do
-  if h : i < ps.size then
-    let p := ps.get ⟨i, h⟩
+  if i < ps.size then
     let e ← whnf e
-    match e with
-    | Expr.forallE _ _ b _ => instantiateForallAux ps (i+1) (b.instantiate1 p)
-    | _                    => throwError "invalid instantiateForall, too many parameters"
+    let n := countHeadBinders false e (ps.size - i) 0
+    if n == 0 then
+      throwError "invalid instantiateForall, too many parameters"
+    instantiateForallAux ps (i+n) (e.instantiateBinders i (i+n) ps)
   else
     pure e
 
@@ -1045,12 +1051,12 @@ def instantiateForall (e : Expr) (ps : Array Expr) : MetaM Expr :=
   instantiateForallAux ps 0 e
 
 private partial def instantiateLambdaAux (ps : Array Expr) (i : Nat) (e : Expr) : MetaM Expr := do
-  if h : i < ps.size then
-    let p := ps.get ⟨i, h⟩
+  if i < ps.size then
     let e ← whnf e
-    match e with
-    | Expr.lam _ _ b _ => instantiateLambdaAux ps (i+1) (b.instantiate1 p)
-    | _                => throwError "invalid instantiateLambda, too many parameters"
+    let n := countHeadBinders true e (ps.size - i) 0
+    if n == 0 then
+      throwError "invalid instantiateLambda, too many parameters"
+    instantiateLambdaAux ps (i+n) (e.instantiateBinders i (i+n) ps)
   else
     pure e
 
@@ -214,7 +214,8 @@ section Initialization
       if (← fileExists leanpkgPath) then
         let pkgSearchPath ← leanpkgSetupSearchPath leanpkgPath m (Lean.Elab.headerToImports headerStx).toArray hOut
         srcSearchPath := srcSearchPath ++ pkgSearchPath
-      Elab.processHeader headerStx opts msgLog inputCtx
+      -- a file worker is restarted when its header changes, so the imported environment lives until the end of the process
+      Elab.processHeader headerStx opts msgLog inputCtx (leakEnv := true)
     catch e =>  -- should be from `leanpkg print-paths`
       let msgs := MessageLog.empty.add { fileName := "<ignored>", pos := ⟨0, 0⟩, data := e.toString }
       publishMessages m msgs hOut
@@ -12,7 +12,22 @@ namespace lean {
 void init_thread_heap();
 void * alloc(size_t sz);
 void dealloc(void * o, size_t sz);
+/* Resize the object `o` of size `old_sz` allocated with `alloc`. The result contains the first `min(old_sz, new_sz)`
+   bytes of `o`, and `o` must not be used anymore. Big objects are resized without copying when possible. */
+void * reallocate(void * o, size_t old_sz, size_t new_sz);
 uint64_t get_num_heartbeats();
+/* Store in `num_in` the number of objects of the current thread's heap that were deallocated by other threads,
+   and in `num_out` the number of objects of other heaps that were deallocated by the current thread. */
+void get_remote_free_stats(uint64_t & num_in, uint64_t & num_out);
+/* Return to the OS the memory of all empty pages of the current thread's heap and of the heaps of finished threads.
+   Segments containing only empty pages are unmapped. */
+void release_free_memory();
+/* Set the maximum amount of memory (in bytes) in empty pages that each heap keeps for reuse.
+   When this limit is exceeded, the memory of the pages that have been empty for the longest time is returned to the OS. */
+void set_max_empty_memory(size_t sz);
+/* Store in `decommitted` the number of bytes in empty pages returned to the OS, and in `unmapped` the number of bytes
+   in unmapped segments. */
+void get_released_memory_stats(uint64_t & decommitted, uint64_t & unmapped);
 void initialize_alloc();
 void finalize_alloc();
 }
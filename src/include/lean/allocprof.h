@@ -9,10 +9,14 @@ Author: Leonardo de Moura
 #include <lean/object.h>
 namespace lean {
 /* Low tech runtime allocation profiler.
-   We need to compile Lean using RUNTIME_STATS=ON to use it. */
+   We need to compile Lean using RUNTIME_STATS=ON to get the number of allocations per kind of object.
+   Otherwise, only the allocator statistics are reported (see `lean_get_alloc_stats`). */
 class allocprof {
     std::ostream & m_out;
     std::string    m_msg;
+    uint64         m_num_small_alloc;
+    uint64         m_num_big_alloc;
+    uint64         m_live_bytes;
 #ifdef LEAN_RUNTIME_STATS
     uint64 m_num_ctor;
     uint64 m_num_closure;
@@ -7,20 +7,20 @@ Author: Leonardo de Moura
 #pragma once
 #include <functional>
 #include <vector>
-#include <unordered_map>
+#include <memory>
 #include <lean/object.h>
 
 namespace lean {
 typedef lean_object * object_offset;
 
 class object_compactor {
+    struct object_table;
     struct max_sharing_table;
-    friend struct max_sharing_hash;
-    friend struct max_sharing_eq;
-    std::unordered_map<object*, object_offset, std::hash<object*>, std::equal_to<object*>> m_obj_table;
+    std::unique_ptr<object_table> m_obj_table;
     std::unique_ptr<max_sharing_table> m_max_sharing_table;
     std::vector<object*> m_todo;
     std::vector<object_offset> m_tmp;
+    void * m_base_addr;
     void * m_begin;
     void * m_end;
     void * m_capacity;
@@ -40,7 +40,9 @@ class object_compactor {
     bool insert_ref(object * o);
     void insert_mpz(object * o);
 public:
-    object_compactor();
+    /* If `base_addr` is not null, pointers in the compacted data are stored as `base_addr + offset`,
+       i.e., the data can be used without any pointer fix-up if it is loaded at `base_addr`. */
+    explicit object_compactor(void * base_addr = nullptr);
     object_compactor(object_compactor const &) = delete;
     object_compactor(object_compactor &&) = delete;
     ~object_compactor();
@@ -52,10 +54,11 @@ public:
 };
 
 class compacted_region {
+    void *            m_base_addr;
     void *            m_begin;
     void *            m_next;
     void *            m_end;
-    mpz_object *      m_nested_mpzs;
+    std::function<void()> m_free_data;
     void move(size_t d);
     void move(object * o);
     object * fix_object_ptr(object * o);
@@ -69,6 +72,11 @@ public:
     /* Creates a compacted object region using the given region in memory.
        This object takes ownership of the region. */
     compacted_region(size_t sz, void * data);
+    /* Creates a compacted object region using the given region in memory, which was produced by an
+       `object_compactor` with the given base address. If `data == base_addr`, `read` does not need to
+       visit the region at all; in this case, the region must contain a single root object.
+       `free_data` is used to release the region. */
+    compacted_region(size_t sz, void * data, void * base_addr, std::function<void()> free_data);
     /* Creates a compacted object region using the object_compactor current state.
        It creates a copy of the compacted region generated by the object compactor. */
     explicit compacted_region(object_compactor const & c);
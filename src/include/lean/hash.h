@@ -5,6 +5,7 @@ Released under Apache 2.0 license as described in the file LICENSE.
 Author: Leonardo de Moura
 */
 #pragma once
+#include <lean/compiler_hints.h>
 #include <lean/debug.h>
 #include <lean/int64.h>
 
@@ -12,8 +13,13 @@ namespace lean {
 
 void mix(unsigned & a, unsigned & b, unsigned & c);
 
+/* Bob Jenkin's lookup2 hash of the bytes `str[0, len)`. It is used to implement `String.hash`, and
+   `Name` hashes computed with it are stored in .olean files, so it must not be changed. */
 unsigned hash_str(size_t len, char const * str, unsigned init_value);
 
+/* Faster 64-bit hash of the bytes `str[0, len)`. The result is deterministic for a given `init_value`. */
+uint64 hash_str64(size_t len, char const * str, uint64 init_value);
+
 inline unsigned hash(unsigned h1, unsigned h2) {
     h2 -= h1; h2 ^= (h1 << 8);
     h1 -= h2; h2 ^= (h1 << 16);
@@ -87,6 +87,14 @@ LEAN_CASSERT(sizeof(size_t) == sizeof(void*));
 LEAN_CASSERT(sizeof(void*) == 8);
 #endif
 
+#if defined(LEAN_BIASED_RC)
+/* Biased reference counting is only supported in 64-bit machines using big object headers */
+LEAN_CASSERT(sizeof(void*) == 8);
+#if defined(LEAN_COMPRESSED_OBJECT_HEADER) || defined(LEAN_COMPRESSED_OBJECT_HEADER_SMALL_RC)
+#error "LEAN_BIASED_RC cannot be used with compressed object headers"
+#endif
+#endif
+
 /* Lean object header */
 typedef struct {
 #if defined(LEAN_COMPRESSED_OBJECT_HEADER)
@@ -118,6 +126,11 @@ typedef struct {
     uint8_t         m_tag;
     uint8_t         m_mem_kind;
     uint16_t        m_other;  /* num fields for constructors, element size for scalar arrays, etc. */
+#if defined(LEAN_BIASED_RC)
+    /* Biased reference counting state for multi-threaded objects, it uses the header padding. See `lean_brc_inc`. */
+    uint16_t        m_owner;
+    uint16_t        m_biased_rc;
+#endif
 #define LEAN_ST_MEM_KIND 0
 #define LEAN_MT_MEM_KIND 1
 #define LEAN_PERSISTENT_MEM_KIND 2
@@ -206,6 +219,7 @@ typedef struct {
 } lean_thunk_object;
 
 struct lean_task;
+struct lean_task_waiter_node;
 
 /* Data required for executing a Lean task. It is released as soon as
    the task terminates even if the task object itself is still referenced. */
@@ -213,6 +227,8 @@ typedef struct {
     lean_object *        m_closure;
     struct lean_task *   m_head_dep;
     struct lean_task *   m_next_dep;
+    /* Threads blocked in `Task.get` or `IO.waitAny` on this task. */
+    struct lean_task_waiter_node * m_head_waiter;
     unsigned             m_prio;
     uint8_t              m_canceled;
     // If true, task will not be freed until finished
@@ -310,6 +326,45 @@ static inline unsigned lean_get_slot_idx(unsigned sz) {
     return sz / LEAN_OBJECT_SIZE_DELTA - 1;
 }
 
+#define LEAN_NUM_SMALL_OBJECT_SLOTS (LEAN_MAX_SMALL_OBJECT_SIZE / LEAN_OBJECT_SIZE_DELTA)
+
+/* Statistics of the small object allocator accumulated over all threads, see `lean_get_alloc_stats`. */
+typedef struct {
+    /* Number of allocations and deallocations of small objects of size `(i+1)*LEAN_OBJECT_SIZE_DELTA` */
+    uint64_t m_num_small_alloc[LEAN_NUM_SMALL_OBJECT_SLOTS];
+    uint64_t m_num_small_dealloc[LEAN_NUM_SMALL_OBJECT_SLOTS];
+    /* Objects bigger than `LEAN_MAX_SMALL_OBJECT_SIZE` */
+    uint64_t m_num_big_alloc;
+    uint64_t m_num_big_dealloc;
+    uint64_t m_big_alloc_bytes;
+    uint64_t m_big_dealloc_bytes;
+    /* Bytes used by objects that have not been deallocated yet */
+    uint64_t m_live_bytes;
+    uint64_t m_num_segments;
+    /* Number of pages in all segments. It includes the empty and decommitted ones. */
+    uint64_t m_num_pages;
+    uint64_t m_num_empty_pages;
+    uint64_t m_num_decommitted_pages;
+    /* Number of objects deallocated by a thread different from the one that allocated them */
+    uint64_t m_num_remote_frees;
+    /* Number of batches of remotely deallocated objects sent to their heaps, and
+       number of objects received from these batches */
+    uint64_t m_num_exports;
+    uint64_t m_num_imported;
+    /* Number of big objects allocated from the cache of deallocated ones, number of objects bigger than
+       4 Mb (they are mapped directly), and number of objects resized without copying */
+    uint64_t m_num_medium_reuse;
+    uint64_t m_num_huge_alloc;
+    uint64_t m_num_in_place_resize;
+    /* Memory returned to the operating system */
+    uint64_t m_decommitted_bytes;
+    uint64_t m_unmapped_bytes;
+} lean_alloc_stats;
+
+/* Store in `r` the current allocator statistics. The counters of each thread are read without stopping them,
+   so the result is only approximate if other threads are allocating. */
+void lean_get_alloc_stats(lean_alloc_stats * r);
+
 void * lean_alloc_small(unsigned sz, unsigned slot_idx);
 void lean_free_small(void * p);
 unsigned lean_small_mem_size(void * p);
@@ -439,6 +494,75 @@ static inline _Atomic(size_t) * lean_get_rc_mt_addr(lean_object* o) {
 #endif
 }
 
+#if defined(LEAN_BIASED_RC)
+/*
+Biased reference counting (BRC) for multi-threaded objects.
+
+The RC of an MT object is split into two counters:
+- `m_biased_rc`: updated using non-atomic operations by the thread `m_owner`,
+  i.e., the thread that executed `lean_mark_mt` on the object.
+- `m_rc`: the shared counter, updated using atomic operations by all other threads.
+  It is stored with the offset `LEAN_BRC_ZERO`, and it may become "negative" when
+  threads release references that were counted by the owner.
+
+The object RC is the sum of both counters. When the biased counter reaches zero,
+the owner merges it into the shared counter by setting `LEAN_BRC_MERGED`. After that, all
+threads, including the owner, only use the shared counter. When a thread makes the shared counter
+of an unmerged object negative, it sets `LEAN_BRC_QUEUED` and asks the owner to merge the object
+(`lean_brc_queue`). The owner processes its queue when it creates or waits for tasks,
+between tasks, and when it finishes. If the owner has already finished, the requesting thread merges the object.
+
+Threads that never executed `lean_mark_mt` and threads created after all 2^16-1 identifiers
+have been used do not own objects, i.e., their `lean_brc_thread_id` is 0, and
+the objects they mark are created in the merged state.
+*/
+#define LEAN_BRC_ZERO       (1ull << 58)
+#define LEAN_BRC_COUNT_MASK ((1ull << 59) - 1)
+#define LEAN_BRC_QUEUED     (1ull << 59)
+#define LEAN_BRC_MERGED     (1ull << 60)
+#define LEAN_BRC_MAX_BIASED 0xFFFF
+
+#ifdef _MSC_VER
+extern __declspec(thread) uint16_t lean_brc_thread_id;
+#else
+extern __thread uint16_t lean_brc_thread_id;
+#endif
+
+/* Return true if the object must be deleted. */
+bool lean_brc_merge(lean_object * o);
+void lean_brc_queue(lean_object * o);
+
+static inline bool lean_brc_is_owner(lean_object * o) {
+    /* `m_owner` is not modified after the object is marked MT, and only the owner reads `m_biased_rc`.
+       Remark: `m_biased_rc` is always 0 for objects without owner. */
+    return o->m_owner == lean_brc_thread_id && o->m_biased_rc > 0;
+}
+
+static inline void lean_brc_inc(lean_object * o, size_t n) {
+    if (lean_brc_is_owner(o) && n <= (size_t)(LEAN_BRC_MAX_BIASED - o->m_biased_rc)) {
+        o->m_biased_rc += n;
+    } else {
+        LEAN_USING_STD;
+        atomic_fetch_add_explicit(lean_get_rc_mt_addr(o), n, memory_order_relaxed);
+    }
+}
+
+static inline bool lean_brc_dec(lean_object * o) {
+    if (lean_brc_is_owner(o)) {
+        o->m_biased_rc--;
+        return o->m_biased_rc == 0 && lean_brc_merge(o);
+    } else {
+        LEAN_USING_STD;
+        size_t old = atomic_fetch_sub_explicit(lean_get_rc_mt_addr(o), (size_t)1, memory_order_acq_rel);
+        if (LEAN_LIKELY((old & LEAN_BRC_MERGED) != 0))
+            return (old & (LEAN_BRC_COUNT_MASK | LEAN_BRC_QUEUED)) == LEAN_BRC_ZERO + 1;
+        if ((old & LEAN_BRC_COUNT_MASK) == LEAN_BRC_ZERO && (old & LEAN_BRC_QUEUED) == 0)
+            lean_brc_queue(o);
+        return false;
+    }
+}
+#endif
+
 static inline void lean_inc_ref(lean_object * o) {
 #if defined(LEAN_COMPRESSED_OBJECT_HEADER)
     if (LEAN_LIKELY(lean_is_st(o))) {
@@ -471,8 +595,12 @@ static inline void lean_inc_ref(lean_object * o) {
     if (LEAN_LIKELY(lean_is_st(o))) {
         o->m_rc++;
     } else if (lean_is_mt(o)) {
+#if defined(LEAN_BIASED_RC)
+        lean_brc_inc(o, 1);
+#else
         LEAN_USING_STD;
         atomic_fetch_add_explicit(lean_get_rc_mt_addr(o), (size_t)1, memory_order_relaxed);
+#endif
     }
 #endif
 }
@@ -509,8 +637,12 @@ static inline void lean_inc_ref_n(lean_object * o, size_t n) {
     if (LEAN_LIKELY(lean_is_st(o))) {
         o->m_rc += n;
     } else if (lean_is_mt(o)) {
+#if defined(LEAN_BIASED_RC)
+        lean_brc_inc(o, n);
+#else
         LEAN_USING_STD;
         atomic_fetch_add_explicit(lean_get_rc_mt_addr(o), n, memory_order_relaxed);
+#endif
     }
 #endif
 }
@@ -531,8 +663,12 @@ static inline bool lean_dec_ref_core(lean_object * o) {
         o->m_rc--;
         return o->m_rc == 0;
     } else if (lean_is_mt(o)) {
+#if defined(LEAN_BIASED_RC)
+        return lean_brc_dec(o);
+#else
         LEAN_USING_STD;
         return atomic_fetch_sub_explicit(lean_get_rc_mt_addr(o), (size_t)1, memory_order_acq_rel) == 1;
+#endif
     } else {
         return false;
     }
@@ -542,6 +678,15 @@ static inline bool lean_dec_ref_core(lean_object * o) {
 /* Generic Lean object delete operation. */
 void lean_del(lean_object * o);
 
+/* When `budget > 0`, each `lean_del` call frees at most `budget` objects, and the remaining ones are
+   freed incrementally by subsequent calls. This bounds the pause produced by releasing big object graphs.
+   Objects are still freed by the thread that released them, but external object finalizers may run later.
+   The default value is 0, i.e., object graphs are freed immediately. Setting the budget back to 0 frees the
+   objects deferred by the current thread, other threads free theirs at their next allocation. */
+void lean_set_del_budget(size_t budget);
+/* Free all objects whose deletion has been deferred by the current thread. */
+void lean_del_deferred(void);
+
 static inline void lean_dec_ref(lean_object * o) { if (lean_dec_ref_core(o)) lean_del(o); }
 static inline void lean_inc(lean_object * o) { if (!lean_is_scalar(o)) lean_inc_ref(o); }
 static inline void lean_inc_n(lean_object * o, size_t n) { if (!lean_is_scalar(o)) lean_inc_ref_n(o, n); }
@@ -627,8 +772,15 @@ static inline bool lean_nonzero_rc(lean_object * o) {
     if (LEAN_LIKELY(lean_is_st(o))) {
         return o->m_rc > 0;
     } else if (lean_is_mt(o)) {
+#if defined(LEAN_BIASED_RC)
+        /* We cannot read the biased counter of objects owned by other threads. */
+        LEAN_USING_STD;
+        size_t rc = atomic_load_explicit(lean_get_rc_mt_addr(o), memory_order_acquire);
+        return (rc & LEAN_BRC_MERGED) == 0 || (rc & LEAN_BRC_COUNT_MASK) > LEAN_BRC_ZERO;
+#else
         LEAN_USING_STD;
         return atomic_load_explicit(lean_get_rc_mt_addr(o), memory_order_acquire) > 0;
+#endif
     } else {
         return false;
     }
@@ -1141,6 +1293,9 @@ static inline size_t lean_string_byte_size(lean_object * o) { return sizeof(lean
 /* instance : inhabited char := ⟨'A'⟩ */
 static inline uint32_t lean_char_default_value() { return 'A'; }
 lean_obj_res lean_mk_string(char const * s);
+lean_obj_res lean_string_from_utf8_unchecked(b_lean_obj_arg a);
+uint8_t lean_string_validate_utf8(b_lean_obj_arg a);
+lean_obj_res lean_string_from_utf8(b_lean_obj_arg a);
 static inline char const * lean_string_cstr(b_lean_obj_arg o) {
     assert(lean_is_string(o));
     return lean_to_string(o)->m_data;
@@ -1170,6 +1325,7 @@ bool lean_string_lt(b_lean_obj_arg s1, b_lean_obj_arg s2);
 static inline uint8_t lean_string_dec_eq(b_lean_obj_arg s1, b_lean_obj_arg s2) { return lean_string_eq(s1, s2); }
 static inline uint8_t lean_string_dec_lt(b_lean_obj_arg s1, b_lean_obj_arg s2) { return lean_string_lt(s1, s2); }
 size_t lean_string_hash(b_lean_obj_arg);
+uint64_t lean_string_hash64(b_lean_obj_arg, uint64_t);
 
 /* Thunks */
 
@@ -8,6 +8,7 @@ Author: Leonardo de Moura
 #include <iostream>
 #include <chrono>
 #include <functional>
+#include <cstdint>
 
 #ifndef LEAN_STACK_BUFFER_SPACE
 #define LEAN_STACK_BUFFER_SPACE 128*1024  // 128 Kb
@@ -111,6 +112,11 @@ public:
             return false;
         }
     }
+    void store(T const & v, int) { m_value = v; }
+    T load(int) const { return m_value; }
+    T exchange(T desired, int) { return exchange(desired); }
+    T fetch_add(T const & v, int = 0) { T r(m_value); m_value += v; return r; }
+    bool compare_exchange_weak(T & expected, T desired, int = 0, int = 0) { return compare_exchange_strong(expected, desired); }
 };
 typedef atomic<unsigned short> atomic_ushort;
 typedef atomic<unsigned char>  atomic_uchar;
@@ -215,7 +221,59 @@ static T & GETTER_NAME() {                                              \
     return *(GETTER_NAME ## _tlocal);                                   \
 }
 
+#ifndef LEAN_NUM_PARKING_QUEUES
+#define LEAN_NUM_PARKING_QUEUES 256
+#endif
+
+#ifndef LEAN_PARK_SPIN
+#define LEAN_PARK_SPIN 64
+#endif
+
 namespace lean {
+/* Wait queue for threads blocked on the state of some object, e.g., a thunk being evaluated by another thread.
+   Objects do not have their own mutex and condition variable. Instead, they are mapped to a small table of
+   queues using their address, and objects mapped to the same queue share it. */
+struct alignas(64) parking_queue {
+    mutex              m_mutex;
+    condition_variable m_cv;
+    atomic<unsigned>   m_num_waiters{0};
+};
+
+extern parking_queue g_parking_queues[LEAN_NUM_PARKING_QUEUES];
+
+inline parking_queue & get_parking_queue(void const * addr) {
+    uint64_t h = static_cast<uint64_t>(reinterpret_cast<uintptr_t>(addr) >> 4) * 0x9E3779B97F4A7C15ull;
+    return g_parking_queues[(h >> 32) % LEAN_NUM_PARKING_QUEUES];
+}
+
+/* Block until `cond()` holds, where `cond` depends on the state of the object at `addr`. We spin for a short
+   while before blocking.
+   Remark: `cond` must read the state using sequentially consistent atomic operations, and the thread changing it
+   must invoke `unpark_all(addr)`. */
+template<typename F> void park_until(void const * addr, F && cond) {
+    for (unsigned i = 0; i < LEAN_PARK_SPIN; i++) {
+        if (cond())
+            return;
+    }
+    parking_queue & q = get_parking_queue(addr);
+    unique_lock<mutex> lock(q.m_mutex);
+    q.m_num_waiters++;
+    while (!cond())
+        q.m_cv.wait(lock);
+    q.m_num_waiters--;
+}
+
+/* Wake up the threads blocked in `park_until(addr, ...)`. It is cheap when there are none.
+   Remark: the state of the object must have been changed using a sequentially consistent atomic operation.
+   Then, either the waiter sees the new state, or we see the waiter in `m_num_waiters`. */
+inline void unpark_all(void const * addr) {
+    parking_queue & q = get_parking_queue(addr);
+    if (q.m_num_waiters.load(memory_order_seq_cst) > 0) {
+        lock_guard<mutex> lock(q.m_mutex);
+        q.m_cv.notify_all();
+    }
+}
+
 void initialize_thread();
 void finalize_thread();
 
@@ -20,8 +20,12 @@ size_t utf8_strlen(char const * str);
    `str` may contain null characters. */
 size_t utf8_strlen(std::string const & str);
 /* Return the length of the string `str` encoded using UTF8.
-   `str` may contain null characters. */
+   `str` may contain null characters. If `str` is not well-formed, the result is the number of
+   bytes that are not continuation bytes. */
 size_t utf8_strlen(char const * str, size_t sz);
+/* Return the byte offset of the `char_idx`-th unicode scalar value of the UTF-8 encoded string `str`,
+   or `sz` if `str` contains at most `char_idx` unicode scalar values. */
+size_t utf8_seek(char const * str, size_t sz, size_t char_idx);
 optional<size_t> utf8_char_pos(char const * str, size_t char_idx);
 char const * get_utf8_last_char(char const * str);
 std::string utf8_trim(std::string const & s);
@@ -36,6 +40,10 @@ inline unsigned utf8_to_unicode(char const * begin, char const * end) {
    the unicode scalar value. Otherwise, return `none` */
 optional<unsigned> get_utf8_first_byte_opt(unsigned char c);
 
+/* Return true iff `str[0, size)` is a well-formed UTF-8 encoded string, i.e., it does not contain
+   overlong encodings, surrogates, or values greater than 0x10FFFF. */
+bool validate_utf8(char const * str, size_t size);
+
 /* "Read" next unicode character starting at position i in a string using UTF-8 encoding.
    Return the unicode character and update i. */
 unsigned next_utf8(std::string const & str, size_t & i);
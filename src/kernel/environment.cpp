@@ -9,14 +9,21 @@ Author: Leonardo de Moura
 #include <limits>
 #include <lean/sstream.h>
 #include <lean/thread.h>
+#include <lean/io.h>
 #include "util/map_foreach.h"
 #include "util/io.h"
+#include "util/option_declarations.h"
 #include "kernel/environment.h"
 #include "kernel/kernel_exception.h"
 #include "kernel/type_checker.h"
 #include "kernel/quot.h"
 
+#ifndef LEAN_DEFAULT_ASYNC_THEOREMS
+#define LEAN_DEFAULT_ASYNC_THEOREMS false
+#endif
+
 namespace lean {
+static name * g_async_theorems = nullptr;
 extern "C" object* lean_environment_add(object*, object*);
 extern "C" object* lean_mk_empty_environment(uint32, object*);
 extern "C" object* lean_environment_find(object*, object*);
@@ -171,16 +178,91 @@ environment environment::add_definition(declaration const & d, bool check) const
     }
 }
 
+static void check_theorem_value(environment const & env, declaration const & d) {
+    theorem_val const & v = d.to_theorem_val();
+    type_checker checker(env);
+    expr val_type = checker.check(v.get_value(), v.get_lparams());
+    if (!checker.is_def_eq(val_type, v.get_type()))
+        throw definition_type_mismatch_exception(env, d, val_type);
+}
+
+/* When `g_async_theorem_checking` is set, theorem values are type checked by tasks.
+   The tasks produce a `Except KernelException Environment`, and are collected by `wait_for_theorem_checks`.
+   We keep the name of the theorem with each task, so that failures can be reported at the theorem. */
+static bool g_async_theorem_checking = false;
+static mutex * g_theorem_checks_mutex = nullptr;
+static std::vector<std::pair<name, object *>> * g_theorem_checks = nullptr;
+
+void set_async_theorem_checking(bool flag) {
+    g_async_theorem_checking = flag;
+}
+
+bool get_async_theorems(options const & opts) {
+    return opts.get_bool(*g_async_theorems, LEAN_DEFAULT_ASYNC_THEOREMS);
+}
+
+static obj_res check_theorem_value_fn(obj_arg env, obj_arg d, obj_arg) {
+    environment e(env);
+    declaration decl(d);
+    try {
+        return catch_kernel_exceptions<environment>([&]() {
+                check_theorem_value(e, decl);
+                return e;
+            });
+    } catch (throwable & ex) {
+        // 11 | other            (msg : String)
+        return mk_cnstr(0, mk_cnstr(11, string_ref(ex.what()))).steal();
+    }
+}
+
+static void spawn_theorem_check(environment const & env, declaration const & d) {
+    object * c = lean_alloc_closure((void*)check_theorem_value_fn, 3, 2);
+    lean_closure_set(c, 0, env.to_obj_arg());
+    lean_closure_set(c, 1, d.to_obj_arg());
+    object * t = lean_task_spawn_core(c, 0, /* keep_alive */ false);
+    lock_guard<mutex> lock(*g_theorem_checks_mutex);
+    g_theorem_checks->push_back(std::make_pair(d.to_theorem_val().get_name(), t));
+}
+
+buffer<std::pair<name, object_ref>> wait_for_theorem_checks() {
+    std::vector<std::pair<name, object *>> tasks;
+    {
+        lock_guard<mutex> lock(*g_theorem_checks_mutex);
+        tasks.swap(*g_theorem_checks);
+    }
+    buffer<std::pair<name, object_ref>> errors;
+    for (auto const & p : tasks) {
+        object * r = lean_task_get(p.second);
+        if (cnstr_tag(r) == 0)
+            errors.push_back(std::make_pair(p.first, object_ref(cnstr_get(r, 0), true)));
+        dec(p.second);
+    }
+    return errors;
+}
+
+/*
+@[extern "lean_wait_theorem_checks"]
+constant waitTheoremChecks : IO (Array (Name × KernelException)) */
+extern "C" obj_res lean_wait_theorem_checks(obj_arg) {
+    buffer<std::pair<name, object_ref>> errors = wait_for_theorem_checks();
+    object * r = alloc_array(0, errors.size());
+    for (auto const & p : errors)
+        r = lean_array_push(r, mk_cnstr(0, p.first, p.second).steal());
+    return io_result_mk_ok(r);
+}
+
 environment environment::add_theorem(declaration const & d, bool check) const {
     theorem_val const & v = d.to_theorem_val();
     if (check) {
-        // TODO(Leo): we must add support for handling tasks here
-        type_checker checker(*this);
-        check_constant_val(*this, v.to_constant_val(), checker);
+        {
+            type_checker checker(*this);
+            check_constant_val(*this, v.to_constant_val(), checker);
+        }
         check_no_metavar_no_fvar(*this, v.get_name(), v.get_value());
-        expr val_type = checker.check(v.get_value(), v.get_lparams());
-        if (!checker.is_def_eq(val_type, v.get_type()))
-            throw definition_type_mismatch_exception(*this, d, val_type);
+        if (g_async_theorem_checking)
+            spawn_theorem_check(*this, d);
+        else
+            check_theorem_value(*this, d);
     }
     return add(constant_info(d));
 }
@@ -265,8 +347,19 @@ void environment::display_stats() const {
 }
 
 void initialize_environment() {
+    g_theorem_checks_mutex = new mutex();
+    g_theorem_checks       = new std::vector<std::pair<name, object *>>();
+    g_async_theorems       = new name{"kernel", "async_theorems"};
+    mark_persistent(g_async_theorems->raw());
+    register_bool_option(*g_async_theorems, LEAN_DEFAULT_ASYNC_THEOREMS,
+                         "(kernel) type check theorem proofs asynchronously using the task manager");
 }
 
 void finalize_environment() {
+    for (auto const & p : *g_theorem_checks)
+        dec(p.second);
+    delete g_theorem_checks;
+    delete g_theorem_checks_mutex;
+    delete g_async_theorems;
 }
 }
@@ -9,11 +9,13 @@ Author: Leonardo de Moura
 #include <memory>
 #include <vector>
 #include <lean/optional.h>
+#include "util/buffer.h"
 #include "util/rc.h"
 #include "util/list.h"
 #include "util/rb_map.h"
 #include "util/name_set.h"
 #include "util/name_map.h"
+#include "util/options.h"
 #include "kernel/expr.h"
 #include "kernel/declaration.h"
 
@@ -87,6 +89,15 @@ public:
 
 void check_no_metavar_no_fvar(environment const & env, name const & n, expr const & e);
 
+/** \brief Return the value of the `kernel.async_theorems` option. */
+bool get_async_theorems(options const & opts);
+/** \brief When \c flag is true, `environment::add` adds theorems right after checking their types,
+    and type checks their values using tasks. */
+void set_async_theorem_checking(bool flag);
+/** \brief Wait for the pending theorem value checks, and return the names of the theorems that failed
+    together with the `KernelException`s they produced. */
+buffer<std::pair<name, object_ref>> wait_for_theorem_checks();
+
 void initialize_environment();
 void finalize_environment();
 }
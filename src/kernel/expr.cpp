@@ -72,29 +72,30 @@ bool is_atomic(expr const & e) {
     lean_unreachable(); // LCOV_EXCL_LINE
 }
 
-extern "C" uint8 lean_expr_binder_info(object * e);
-binder_info binding_info(expr const & e) { return static_cast<binder_info>(lean_expr_binder_info(e.to_obj_arg())); }
-
 extern "C" object * lean_lit_type(obj_arg e);
 expr lit_type(literal const & lit) { return expr(lean_lit_type(lit.to_obj_arg())); }
 
+extern "C" uint8 lean_expr_binder_info(obj_arg e);
 extern "C" usize lean_expr_hash(obj_arg e);
-unsigned hash(expr const & e) { return lean_expr_hash(e.to_obj_arg()); }
-
 extern "C" uint8 lean_expr_has_fvar(obj_arg e);
-bool has_fvar(expr const & e) { return lean_expr_has_fvar(e.to_obj_arg()); }
-
 extern "C" uint8 lean_expr_has_expr_mvar(obj_arg e);
-bool has_expr_mvar(expr const & e) { return lean_expr_has_expr_mvar(e.to_obj_arg()); }
-
 extern "C" uint8 lean_expr_has_level_mvar(obj_arg e);
-bool has_univ_mvar(expr const & e) { return lean_expr_has_level_mvar(e.to_obj_arg()); }
-
 extern "C" uint8 lean_expr_has_level_param(obj_arg e);
-bool has_univ_param(expr const & e) { return lean_expr_has_level_param(e.to_obj_arg()); }
-
-extern "C" unsigned lean_expr_loose_bvar_range(object * e);
-unsigned get_loose_bvar_range(expr const & e) { return lean_expr_loose_bvar_range(e.to_obj_arg()); }
+extern "C" unsigned lean_expr_loose_bvar_range(obj_arg e);
+
+#ifdef LEAN_DEBUG
+/* Return true iff the inline `Expr.Data` accessors at `expr.h` agree with the Lean implementation. */
+static bool check_expr_data(expr const & e) {
+    return
+        hash(e) == static_cast<unsigned>(lean_expr_hash(e.to_obj_arg())) &&
+        has_fvar(e) == static_cast<bool>(lean_expr_has_fvar(e.to_obj_arg())) &&
+        has_expr_mvar(e) == static_cast<bool>(lean_expr_has_expr_mvar(e.to_obj_arg())) &&
+        has_univ_mvar(e) == static_cast<bool>(lean_expr_has_level_mvar(e.to_obj_arg())) &&
+        has_univ_param(e) == static_cast<bool>(lean_expr_has_level_param(e.to_obj_arg())) &&
+        get_loose_bvar_range(e) == lean_expr_loose_bvar_range(e.to_obj_arg()) &&
+        (!is_binding(e) || static_cast<uint8>(binding_info(e)) == lean_expr_binder_info(e.to_obj_arg()));
+}
+#endif
 
 // =======================================
 // Constructors
@@ -470,7 +471,7 @@ expr lower_loose_bvars(expr const & e, unsigned s, unsigned d) {
     if (d == 0 || s >= get_loose_bvar_range(e))
         return e;
     lean_assert(s >= d);
-    return replace(e, [=](expr const & e, unsigned offset) -> optional<expr> {
+    return replace_rec(e, [=](expr const & e, unsigned offset) -> optional<expr> {
             unsigned s1 = s + offset;
             if (s1 < s)
                 return some_expr(e); // overflow, vidx can't be >= max unsigned
@@ -500,7 +501,7 @@ extern "C" object * lean_expr_lower_loose_bvars(b_obj_arg e, b_obj_arg s, b_obj_
 expr lift_loose_bvars(expr const & e, unsigned s, unsigned d) {
     if (d == 0 || s >= get_loose_bvar_range(e))
         return e;
-    return replace(e, [=](expr const & e, unsigned offset) -> optional<expr> {
+    return replace_rec(e, [=](expr const & e, unsigned offset) -> optional<expr> {
             unsigned s1 = s + offset;
             if (s1 < s)
                 return some_expr(e); // overflow, vidx can't be >= max unsigned
@@ -562,6 +563,22 @@ void initialize_expr() {
     mark_persistent(g_Type0->raw());
     g_Prop         = new expr(mk_sort(mk_level_zero()));
     mark_persistent(g_Prop->raw());
+#ifdef LEAN_DEBUG
+    {
+        level u = mk_univ_param("u");
+        level m = mk_univ_mvar("m");
+        expr x  = mk_fvar("x");
+        expr b  = mk_bvar(3);
+        expr c  = mk_const("c", levels(u));
+        expr cm = mk_const("c", levels(m));
+        expr es[] = { *g_Prop, *g_Type0, x, b, c, cm, mk_mvar("?m"), mk_sort(u), mk_app(c, b), mk_app(x, cm),
+                      mk_lambda("a", c, b, mk_inst_implicit_binder_info()), mk_pi("a", *g_Prop, mk_bvar(7), mk_strict_implicit_binder_info()),
+                      mk_pi("a", x, b, mk_rec_info()), mk_let("a", c, x, b), mk_proj("S", 0u, b), mk_lit(literal(10u)),
+                      mk_mdata(kvmap(), b) };
+        for (expr const & e : es)
+            lean_assert(check_expr_data(e));
+    }
+#endif
     /* TODO(Leo): add support for builtin constants in the kernel.
        Something similar to what we have in the library directory. */
 }
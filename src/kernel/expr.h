@@ -138,13 +138,30 @@ inline bool is_eqp(optional<expr> const & a, optional<expr> const & b) {
     return static_cast<bool>(a) == static_cast<bool>(b) && (!a || is_eqp(*a, *b));
 }
 
-unsigned hash(expr const & e);
-bool has_expr_mvar(expr const & e);
-bool has_univ_mvar(expr const & e);
-inline bool has_mvar(expr const & e) { return has_expr_mvar(e) || has_univ_mvar(e); }
-bool has_fvar(expr const & e);
-bool has_univ_param(expr const & e);
-unsigned get_loose_bvar_range(expr const & e);
+/* `Expr.Data` is a `UInt64` stored in the scalar area of every `Expr` constructor, right after
+   the object fields. Its layout is defined by `Expr.mkDataCore` at `src/Lean/Expr.lean`:
+
+   - bits 0-31:  hash
+   - bit 32:     hasFVar
+   - bit 33:     hasExprMVar
+   - bit 34:     hasLevelMVar
+   - bit 35:     hasLevelParam
+   - bit 36:     nonDepLet
+   - bits 37-39: binder info
+   - bits 40-63: loose bound variable range
+
+   The following accessors read it directly without touching the reference counter.
+   `initialize_expr` checks them against the Lean implementation in debug mode. */
+inline uint64 get_expr_data(expr const & e) {
+    return lean_ctor_get_uint64(e.raw(), lean_ctor_num_objs(e.raw()) * sizeof(void*));
+}
+inline unsigned hash(expr const & e) { return static_cast<unsigned>(get_expr_data(e)); }
+inline bool has_fvar(expr const & e) { return (get_expr_data(e) >> 32) & 1; }
+inline bool has_expr_mvar(expr const & e) { return (get_expr_data(e) >> 33) & 1; }
+inline bool has_univ_mvar(expr const & e) { return (get_expr_data(e) >> 34) & 1; }
+inline bool has_mvar(expr const & e) { return (get_expr_data(e) >> 33) & 3; }
+inline bool has_univ_param(expr const & e) { return (get_expr_data(e) >> 35) & 1; }
+inline unsigned get_loose_bvar_range(expr const & e) { return static_cast<unsigned>(get_expr_data(e) >> 40); }
 
 struct expr_hash { unsigned operator()(expr const & e) const { return hash(e); } };
 struct expr_pair_hash {
@@ -240,7 +257,7 @@ inline expr const &    app_arg(expr const & e)               { lean_assert(is_ap
 inline name const &    binding_name(expr const & e)          { lean_assert(is_binding(e)); return static_cast<name const &>(cnstr_get_ref(e, 0)); }
 inline expr const &    binding_domain(expr const & e)        { lean_assert(is_binding(e)); return static_cast<expr const &>(cnstr_get_ref(e, 1)); }
 inline expr const &    binding_body(expr const & e)          { lean_assert(is_binding(e)); return static_cast<expr const &>(cnstr_get_ref(e, 2)); }
-binder_info binding_info(expr const & e);
+inline binder_info     binding_info(expr const & e)          { lean_assert(is_binding(e)); return static_cast<binder_info>((get_expr_data(e) >> 37) & 7); }
 inline name const &    let_name(expr const & e)              { lean_assert(is_let(e)); return static_cast<name const &>(cnstr_get_ref(e, 0)); }
 inline expr const &    let_type(expr const & e)              { lean_assert(is_let(e)); return static_cast<expr const &>(cnstr_get_ref(e, 1)); }
 inline expr const &    let_value(expr const & e)             { lean_assert(is_let(e)); return static_cast<expr const &>(cnstr_get_ref(e, 2)); }
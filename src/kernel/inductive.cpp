@@ -4,6 +4,7 @@ Released under Apache 2.0 license as described in the file LICENSE.
 
 Author: Leonardo de Moura
 */
+#include <memory>
 #include <lean/sstream.h>
 #include <lean/utf8.h>
 #include "util/name_generator.h"
@@ -107,6 +108,11 @@ class add_inductive_fn {
        and for nested inductive datatypes. */
     buffer<rec_info>       m_rec_infos;
 
+    /* Type checker state shared by all `tc()` calls, so that `whnf`, `infer_type` and `is_def_eq`
+       reuse each other's caches. Cached results depend on `m_env`, and the state is reset by `add_core`.
+       `m_lctx` is only extended with fresh free variables, and does not invalidate them. */
+    std::unique_ptr<type_checker::state> m_tc_state;
+
 public:
     add_inductive_fn(environment const & env, inductive_decl const & decl, bool is_nested):
         m_env(env), m_ngen(*g_ind_fresh), m_lparams(decl.get_lparams()), m_is_unsafe(decl.is_unsafe()),
@@ -117,7 +123,16 @@ public:
         to_buffer(decl.get_types(), m_ind_types);
     }
 
-    type_checker tc() { return type_checker(m_env, m_lctx, !m_is_unsafe); }
+    type_checker tc() {
+        if (!m_tc_state)
+            m_tc_state.reset(new type_checker::state(m_env));
+        return type_checker(*m_tc_state, m_lctx, !m_is_unsafe);
+    }
+
+    void add_core(constant_info const & info) {
+        m_env.add_core(info);
+        m_tc_state.reset();
+    }
 
     /** Return type of the parameter at position `i` */
     expr get_param_type(unsigned i) const {
@@ -271,7 +286,7 @@ public:
             for (constructor const & cnstr : ind_type.get_cnstrs()) {
                 cnstr_names.push_back(constructor_name(cnstr));
             }
-            m_env.add_core(constant_info(inductive_val(n, m_lparams, ind_type.get_type(), m_nparams, m_nindices[idx],
+            add_core(constant_info(inductive_val(n, m_lparams, ind_type.get_type(), m_nparams, m_nindices[idx],
                                                        all, names(cnstr_names), rec, m_is_unsafe, reflexive, m_is_nested)));
         }
     }
@@ -403,7 +418,7 @@ public:
                 }
                 lean_assert(arity >= m_nparams);
                 unsigned nfields = arity - m_nparams;
-                m_env.add_core(constant_info(constructor_val(n, m_lparams, t, ind_type.get_name(), cidx, m_nparams, nfields, m_is_unsafe)));
+                add_core(constant_info(constructor_val(n, m_lparams, t, ind_type.get_name(), cidx, m_nparams, nfields, m_is_unsafe)));
                 cidx++;
             }
         }
@@ -525,17 +540,11 @@ public:
         /* First, populate the fields, m_C, m_indices, m_major */
         for (inductive_type const & ind_type : m_ind_types) {
             rec_info info;
-            expr t      = ind_type.get_type();
-            unsigned i  = 0;
+            expr t      = instantiate_binders(ind_type.get_type(), m_params);
             while (is_pi(t)) {
-                if (i < m_nparams) {
-                    t = instantiate(binding_body(t), m_params[i]);
-                } else {
-                    expr idx = mk_local_decl_for(t);
-                    info.m_indices.push_back(idx);
-                    t = instantiate(binding_body(t), idx);
-                }
-                i++;
+                expr idx = mk_local_decl_for(t);
+                info.m_indices.push_back(idx);
+                t = instantiate(binding_body(t), idx);
             }
             info.m_major = mk_local_decl("t", mk_app(mk_app(m_ind_cnsts[d_idx], m_params), info.m_indices));
             expr C_ty = mk_sort(m_elim_level);
@@ -558,19 +567,13 @@ public:
                 buffer<expr> u;   // rec args
                 buffer<expr> v;   // inductive args
                 name cnstr_name = constructor_name(cnstr);
-                expr t          = constructor_type(cnstr);
-                unsigned i      = 0;
+                expr t          = instantiate_binders(constructor_type(cnstr), m_params);
                 while (is_pi(t)) {
-                    if (i < m_nparams) {
-                        t = instantiate(binding_body(t), m_params[i]);
-                    } else {
-                        expr l = mk_local_decl_for(t);
-                        b_u.push_back(l);
-                        if (is_rec_argument(binding_domain(t)))
-                            u.push_back(l);
-                        t = instantiate(binding_body(t), l);
-                    }
-                    i++;
+                    expr l = mk_local_decl_for(t);
+                    b_u.push_back(l);
+                    if (is_rec_argument(binding_domain(t)))
+                        u.push_back(l);
+                    t = instantiate(binding_body(t), l);
                 }
                 buffer<expr> it_indices;
                 unsigned it_idx = get_I_indices(t, it_indices);
@@ -643,19 +646,13 @@ public:
         for (constructor const & cnstr : d.get_cnstrs()) {
             buffer<expr> b_u;
             buffer<expr> u;
-            expr t = constructor_type(cnstr);
-            unsigned i = 0;
+            expr t = instantiate_binders(constructor_type(cnstr), m_params);
             while (is_pi(t)) {
-                if (i < m_nparams) {
-                    t = instantiate(binding_body(t), m_params[i]);
-                } else {
-                    expr l = mk_local_decl_for(t);
-                    b_u.push_back(l);
-                    if (is_rec_argument(binding_domain(t)))
-                        u.push_back(l);
-                    t = instantiate(binding_body(t), l);
-                }
-                i++;
+                expr l = mk_local_decl_for(t);
+                b_u.push_back(l);
+                if (is_rec_argument(binding_domain(t)))
+                    u.push_back(l);
+                t = instantiate(binding_body(t), l);
             }
             buffer<expr> v;
             for (unsigned i = 0; i < u.size(); i++) {
@@ -702,7 +699,7 @@ public:
             recursor_rules rules  = mk_rec_rules(d_idx, Cs, minors, minor_idx);
             name rec_name         = mk_rec_name(m_ind_types[d_idx].get_name());
             names rec_lparams     = get_rec_lparams();
-            m_env.add_core(constant_info(recursor_val(rec_name, rec_lparams, rec_ty, all,
+            add_core(constant_info(recursor_val(rec_name, rec_lparams, rec_ty, all,
                                                       m_nparams, m_nindices[d_idx], nmotives, nminors,
                                                       rules, m_K_target, m_is_unsafe)));
         }
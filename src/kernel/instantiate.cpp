@@ -14,7 +14,7 @@ namespace lean {
 expr instantiate(expr const & a, unsigned s, unsigned n, expr const * subst) {
     if (s >= get_loose_bvar_range(a) || n == 0)
         return a;
-    return replace(a, [=](expr const & m, unsigned offset) -> optional<expr> {
+    return replace_rec(a, [=](expr const & m, unsigned offset) -> optional<expr> {
             unsigned s1 = s + offset;
             if (s1 < s)
                 return some_expr(m); // overflow, vidx can't be >= max unsigned
@@ -57,7 +57,7 @@ static object * lean_expr_instantiate_core(b_obj_arg a0, size_t n, object** subs
         lean_inc(a0);
         return a0;
     }
-    expr r = replace(a, [=](expr const & m, unsigned offset) -> optional<expr> {
+    expr r = replace_rec(a, [=](expr const & m, unsigned offset) -> optional<expr> {
             if (offset >= get_loose_bvar_range(m))
                 return some_expr(m); // expression m does not contain loose bound variables with idx >= offset
             if (is_bvar(m)) {
@@ -98,7 +98,7 @@ extern "C" object * lean_expr_instantiate_range(b_obj_arg a, b_obj_arg begin, b_
 expr instantiate_rev(expr const & a, unsigned n, expr const * subst) {
     if (!has_loose_bvars(a))
         return a;
-    return replace(a, [=](expr const & m, unsigned offset) -> optional<expr> {
+    return replace_rec(a, [=](expr const & m, unsigned offset) -> optional<expr> {
             if (offset >= get_loose_bvar_range(m))
                 return some_expr(m); // expression m does not contain loose bound variables with idx >= offset
             if (is_bvar(m)) {
@@ -122,7 +122,7 @@ static object * lean_expr_instantiate_rev_core(object * a0, size_t n, object **
         lean_inc(a0);
         return a0;
     }
-    expr r = replace(a, [=](expr const & m, unsigned offset) -> optional<expr> {
+    expr r = replace_rec(a, [=](expr const & m, unsigned offset) -> optional<expr> {
             if (offset >= get_loose_bvar_range(m))
                 return some_expr(m); // expression m does not contain loose bound variables with idx >= offset
             if (is_bvar(m)) {
@@ -160,6 +160,40 @@ extern "C" object * lean_expr_instantiate_rev_range(b_obj_arg a, b_obj_arg begin
     }
 }
 
+/* Return the body of the first `n` lambda/Pi binders of `e`, and store in `k` the number of binders skipped (<= n).
+   We stop at `let` binders: callers instantiate parameter telescopes, where a `let` does not consume a parameter. */
+static expr const & get_binders_body(expr const & e, size_t n, size_t & k) {
+    expr const * it = &e;
+    k = 0;
+    while (k < n && is_binding(*it)) {
+        it = &binding_body(*it);
+        k++;
+    }
+    return *it;
+}
+
+expr instantiate_binders(expr const & e, unsigned n, expr const * s) {
+    size_t k;
+    expr const & b = get_binders_body(e, n, k);
+    return instantiate_rev(b, k, s);
+}
+
+extern "C" object * lean_expr_instantiate_binders(b_obj_arg a, b_obj_arg begin, b_obj_arg end, b_obj_arg subst) {
+    if (!lean_is_scalar(begin) || !lean_is_scalar(end)) {
+        lean_internal_panic("invalid range for Expr.instantiateBinders");
+    } else {
+        usize sz = lean_array_size(subst);
+        usize b  = lean_unbox(begin);
+        usize e  = lean_unbox(end);
+        if (b > e || e > sz) {
+            lean_internal_panic("invalid range for Expr.instantiateBinders");
+        }
+        size_t k;
+        expr const & body = get_binders_body(TO_REF(expr, a), e - b, k);
+        return lean_expr_instantiate_rev_core(body.raw(), k, lean_array_cptr(subst) + b);
+    }
+}
+
 bool is_head_beta(expr const & t) {
     return is_app(t) && is_lambda(get_app_fn(t));
 }
@@ -24,6 +24,16 @@ inline expr instantiate_rev(expr const & e, buffer<expr> const & s) {
     return instantiate_rev(e, s.size(), s.data());
 }
 
+/** \brief Given \c e of the form <tt>(x_1 : A_1) ... (x_n : A_n), b</tt> where the binders are lambdas or Pis,
+    return <tt>b[x_1 := s[0], ..., x_n := s[n-1]]</tt>. This is equivalent to applying
+    <tt>instantiate(binding_body(e), s[i])</tt> for each binder, but \c b is traversed only once.
+    If \c e has fewer than \c n leading lambda/Pi binders, then only the existing ones are instantiated.
+    In particular, \c let binders are not skipped. */
+expr instantiate_binders(expr const & e, unsigned n, expr const * s);
+inline expr instantiate_binders(expr const & e, buffer<expr> const & s) {
+    return instantiate_binders(e, s.size(), s.data());
+}
+
 expr apply_beta(expr f, unsigned num_rev_args, expr const * rev_args);
 bool is_head_beta(expr const & t);
 expr head_beta_reduce(expr const & t);
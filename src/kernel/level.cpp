@@ -38,10 +38,16 @@ level mk_imax_core(level const & l1, level const & l2) { return level(lean_level
 level mk_univ_param(name const & n) { return level(lean_level_mk_param(n.to_obj_arg())); }
 level mk_univ_mvar(name const & n) { return level(lean_level_mk_mvar(n.to_obj_arg())); }
 
-unsigned level::hash() const { return lean_level_hash(to_obj_arg()); }
-unsigned get_depth(level const & l) { return lean_level_depth(l.to_obj_arg()); }
-bool has_param(level const & l) { return lean_level_has_param(l.to_obj_arg()); }
-bool has_mvar(level const & l) { return lean_level_has_mvar(l.to_obj_arg()); }
+#ifdef LEAN_DEBUG
+/* Return true iff the inline `Level.Data` accessors at `level.h` agree with the Lean implementation. */
+static bool check_level_data(level const & l) {
+    return
+        l.hash() == static_cast<unsigned>(lean_level_hash(l.to_obj_arg())) &&
+        get_depth(l) == lean_level_depth(l.to_obj_arg()) &&
+        has_param(l) == static_cast<bool>(lean_level_has_param(l.to_obj_arg())) &&
+        has_mvar(l) == static_cast<bool>(lean_level_has_mvar(l.to_obj_arg()));
+}
+#endif
 
 bool is_explicit(level const & l) {
     switch (kind(l)) {
@@ -618,6 +624,15 @@ void initialize_level() {
     mark_persistent(g_level_zero->raw());
     g_level_one  = new level(mk_succ(*g_level_zero));
     mark_persistent(g_level_one->raw());
+#ifdef LEAN_DEBUG
+    {
+        level u = mk_univ_param("u");
+        level m = mk_univ_mvar("m");
+        level ls[] = { *g_level_zero, *g_level_one, u, m, mk_succ(mk_succ(u)), mk_max_core(u, m), mk_imax_core(mk_succ(m), u) };
+        for (level const & l : ls)
+            lean_assert(check_level_data(l));
+    }
+#endif
 }
 
 void finalize_level() {
@@ -46,7 +46,11 @@ public:
     level(level const & other):object_ref(other) {}
     level(level && other):object_ref(other) {}
     level_kind kind() const { return static_cast<level_kind>(lean_ptr_tag(raw())); }
-    unsigned hash() const;
+    /* `Level.Data` is a `UInt64` stored in the scalar area of every `Level` constructor.
+       Its layout is defined by `Level.mkData` at `src/Lean/Level.lean`: bits 0-31 hash,
+       bit 32 hasMVar, bit 33 hasParam, and bits 40-63 depth. */
+    uint64 data() const { return lean_ctor_get_uint64(raw(), lean_ctor_num_objs(raw()) * sizeof(void*)); }
+    unsigned hash() const { return static_cast<unsigned>(data()); }
 
     level & operator=(level const & other) { object_ref::operator=(other); return *this; }
     level & operator=(level && other) { object_ref::operator=(other); return *this; }
@@ -116,7 +120,7 @@ inline bool is_max(level const & l)    { return l.is_max(); }
 inline bool is_imax(level const & l)   { return l.is_imax(); }
 bool is_one(level const & l);
 
-unsigned get_depth(level const & l);
+inline unsigned get_depth(level const & l) { return static_cast<unsigned>(l.data() >> 40); }
 
 /** \brief Return true iff \c l is an explicit level.
     We say a level l is explicit iff
@@ -127,9 +131,9 @@ bool is_explicit(level const & l);
     \pre is_explicit(l) */
 unsigned to_explicit(level const & l);
 /** \brief Return true iff \c l contains placeholder (aka meta parameters). */
-bool has_mvar(level const & l);
+inline bool has_mvar(level const & l) { return (l.data() >> 32) & 1; }
 /** \brief Return true iff \c l contains parameters */
-bool has_param(level const & l);
+inline bool has_param(level const & l) { return (l.data() >> 33) & 1; }
 
 /** \brief Return a new level expression based on <tt>l == succ(arg)</tt>, where \c arg is replaced with
     \c new_arg.
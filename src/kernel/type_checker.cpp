@@ -6,10 +6,14 @@ Author: Leonardo de Moura
 */
 #include <utility>
 #include <vector>
+#include <unordered_map>
 #include <lean/interrupt.h>
+#include <lean/thread.h>
+#include <lean/io.h>
 #include <lean/sstream.h>
 #include <lean/flet.h>
 #include "util/lbool.h"
+#include "util/option_declarations.h"
 #include "kernel/type_checker.h"
 #include "kernel/expr_maps.h"
 #include "kernel/instantiate.h"
@@ -20,8 +24,17 @@ Author: Leonardo de Moura
 #include "kernel/quot.h"
 #include "kernel/inductive.h"
 
+#ifndef LEAN_DEFAULT_KERNEL_CACHE_CAPACITY
+#define LEAN_DEFAULT_KERNEL_CACHE_CAPACITY 0
+#endif
+
+#ifndef LEAN_KERNEL_CACHE_NUM_SHARDS
+#define LEAN_KERNEL_CACHE_NUM_SHARDS 16
+#endif
+
 namespace lean {
 static name * g_kernel_fresh = nullptr;
+static name * g_kernel_cache_capacity = nullptr;
 static expr * g_dont_care    = nullptr;
 static expr * g_nat_zero     = nullptr;
 static expr * g_nat_succ     = nullptr;
@@ -33,6 +46,104 @@ static expr * g_nat_div      = nullptr;
 static expr * g_nat_beq      = nullptr;
 static expr * g_nat_ble      = nullptr;
 
+/* Process wide cache of `infer_type` (in `infer_only` mode), `whnf_core` and `whnf` results for persistent closed terms.
+   Persistent terms come from imported .olean files (or are created at initialization time), they cannot be modified,
+   and the results for them only depend on imported declarations. Thus, these results are valid for all declarations
+   and environments that share the same imports.
+
+   The entries are keyed by pointer, and the shard is selected using the hash code.
+   Each shard has two generations: when the young one is full, it becomes the old one, and
+   the old entries are released. Old entries are moved back to the young generation when they are used. */
+class type_checker_cache {
+public:
+    enum kind { InferType = 0, WhnfCore, Whnf, NumKinds };
+private:
+    typedef std::unordered_map<object *, expr> map;
+    struct shard {
+        mutex m_mutex;
+        map   m_young[NumKinds];
+        map   m_old[NumKinds];
+    };
+    size_t m_shard_capacity;
+    shard  m_shards[LEAN_KERNEL_CACHE_NUM_SHARDS];
+
+    shard & get_shard(expr const & e) { return m_shards[hash(e) % LEAN_KERNEL_CACHE_NUM_SHARDS]; }
+
+    void insert_core(shard & s, kind k, object * e, expr const & r) {
+        map & young = s.m_young[k];
+        if (young.size() >= m_shard_capacity) {
+            s.m_old[k].swap(young);
+            young.clear();
+        }
+        young.insert(mk_pair(e, r));
+    }
+public:
+    type_checker_cache(size_t capacity):
+        m_shard_capacity(std::max<size_t>(capacity / LEAN_KERNEL_CACHE_NUM_SHARDS, 1)) {}
+
+    optional<expr> find(kind k, expr const & e) {
+        shard & s = get_shard(e);
+        lock_guard<mutex> lock(s.m_mutex);
+        auto it = s.m_young[k].find(e.raw());
+        if (it != s.m_young[k].end())
+            return optional<expr>(it->second);
+        it = s.m_old[k].find(e.raw());
+        if (it == s.m_old[k].end())
+            return optional<expr>();
+        expr r = it->second;
+        s.m_old[k].erase(it);
+        insert_core(s, k, e.raw(), r);
+        return optional<expr>(r);
+    }
+
+    void insert(kind k, expr const & e, expr const & r) {
+        /* `r` may be used by type checkers running in other threads. */
+        mark_mt(r.raw());
+        shard & s = get_shard(e);
+        lock_guard<mutex> lock(s.m_mutex);
+        insert_core(s, k, e.raw(), r);
+    }
+
+    void clear() {
+        for (shard & s : m_shards) {
+            lock_guard<mutex> lock(s.m_mutex);
+            for (unsigned k = 0; k < NumKinds; k++) {
+                s.m_young[k].clear();
+                s.m_old[k].clear();
+            }
+        }
+    }
+};
+
+static type_checker_cache * g_cache = nullptr;
+
+unsigned get_kernel_cache_capacity(options const & opts) {
+    return opts.get_unsigned(*g_kernel_cache_capacity, LEAN_DEFAULT_KERNEL_CACHE_CAPACITY);
+}
+
+void set_kernel_cache_capacity(unsigned capacity) {
+    delete g_cache;
+    g_cache = capacity > 0 ? new type_checker_cache(capacity) : nullptr;
+}
+
+void clear_kernel_cache() {
+    if (g_cache)
+        g_cache->clear();
+}
+
+/*
+@[extern "lean_kernel_clear_cache"]
+constant Kernel.clearCache : IO Unit */
+extern "C" obj_res lean_kernel_clear_cache(obj_arg) {
+    clear_kernel_cache();
+    return io_result_mk_ok(box(0));
+}
+
+/* Return true if results for `e` may be stored in the process wide cache. */
+bool type_checker::use_global_cache(expr const & e) const {
+    return g_cache && m_safe_only && lean_is_persistent(e.raw()) && !has_fvar(e);
+}
+
 type_checker::state::state(environment const & env):
     m_env(env), m_ngen(*g_kernel_fresh) {}
 
@@ -246,11 +357,18 @@ expr type_checker::infer_proj(expr const & e, bool infer_only) {
 
     constant_info c_info = env().get(head(I_val.get_cnstrs()));
     expr r = instantiate_type_lparams(c_info, const_levels(I));
-    for (unsigned i = 0; i < I_val.get_nparams(); i++) {
+    unsigned nparams = I_val.get_nparams();
+    unsigned i = 0;
+    while (i < nparams) {
         lean_assert(i < args.size());
         r = whnf(r);
         if (!is_pi(r)) throw invalid_proj_exception(env(), m_lctx, e);
-        r = instantiate(binding_body(r), args[i]);
+        /* instantiate all consecutive Pi binders at once */
+        unsigned j = i + 1;
+        for (expr const * it = &binding_body(r); j < nparams && is_pi(*it); it = &binding_body(*it))
+            j++;
+        r = instantiate_binders(r, j - i, args.data() + i);
+        i = j;
     }
     for (unsigned i = 0; i < idx; i++) {
         r = whnf(r);
@@ -278,6 +396,16 @@ expr type_checker::infer_type_core(expr const & e, bool infer_only) {
     if (it != m_st->m_infer_type[infer_only].end())
         return it->second;
 
+    /* Remark: we do not use the global cache when `infer_only == false` since `check` also
+       validates the universe parameters in `m_lparams`. */
+    bool use_global = infer_only && use_global_cache(e);
+    if (use_global) {
+        if (auto r = g_cache->find(type_checker_cache::InferType, e)) {
+            m_st->m_infer_type[infer_only].insert(mk_pair(e, *r));
+            return *r;
+        }
+    }
+
     expr r;
     switch (e.kind()) {
     case expr_kind::Lit:      r = lit_type(lit_value(e)); break;
@@ -299,6 +427,8 @@ expr type_checker::infer_type_core(expr const & e, bool infer_only) {
     }
 
     m_st->m_infer_type[infer_only].insert(mk_pair(e, r));
+    if (use_global)
+        g_cache->insert(type_checker_cache::InferType, e, r);
     return r;
 }
 
@@ -414,10 +544,18 @@ expr type_checker::whnf_core(expr const & e, bool cheap) {
     }
 
     // check cache
+    bool use_global = false;
     if (!cheap) {
         auto it = m_st->m_whnf_core.find(e);
         if (it != m_st->m_whnf_core.end())
             return it->second;
+        use_global = use_global_cache(e);
+        if (use_global) {
+            if (auto r = g_cache->find(type_checker_cache::WhnfCore, e)) {
+                m_st->m_whnf_core.insert(mk_pair(e, *r));
+                return *r;
+            }
+        }
     }
 
     // do the actual work
@@ -468,6 +606,8 @@ expr type_checker::whnf_core(expr const & e, bool cheap) {
 
     if (!cheap) {
         m_st->m_whnf_core.insert(mk_pair(e, r));
+        if (use_global)
+            g_cache->insert(type_checker_cache::WhnfCore, e, r);
     }
     return r;
 }
@@ -619,21 +759,32 @@ expr type_checker::whnf(expr const & e) {
     if (it != m_st->m_whnf.end())
         return it->second;
 
+    bool use_global = use_global_cache(e);
+    if (use_global) {
+        if (auto r = g_cache->find(type_checker_cache::Whnf, e)) {
+            m_st->m_whnf.insert(mk_pair(e, *r));
+            return *r;
+        }
+    }
+
+    auto cache = [&](expr const & r) {
+        m_st->m_whnf.insert(mk_pair(e, r));
+        if (use_global)
+            g_cache->insert(type_checker_cache::Whnf, e, r);
+        return r;
+    };
+
     expr t = e;
     while (true) {
         expr t1 = whnf_core(t);
         if (auto v = reduce_native(env(), t1)) {
-            m_st->m_whnf.insert(mk_pair(e, *v));
-            return *v;
+            return cache(*v);
         } else if (auto v = reduce_nat(t1)) {
-            m_st->m_whnf.insert(mk_pair(e, *v));
-            return *v;
+            return cache(*v);
         } else if (auto next_t = unfold_definition(t1)) {
             t = *next_t;
         } else {
-            auto r = t1;
-            m_st->m_whnf.insert(mk_pair(e, r));
-            return r;
+            return cache(t1);
         }
     }
 }
@@ -1025,6 +1176,11 @@ extern "C" lean_object * lean_kernel_whnf(lean_object * env, lean_object * lctx,
 }
 
 void initialize_type_checker() {
+    g_kernel_cache_capacity = new name{"kernel", "cache_capacity"};
+    mark_persistent(g_kernel_cache_capacity->raw());
+    register_unsigned_option(*g_kernel_cache_capacity, LEAN_DEFAULT_KERNEL_CACHE_CAPACITY,
+                             "(kernel) maximum number of cached whnf/type inference results for imported terms "
+                             "that are shared by all declarations, 0 disables the cache");
     g_dont_care    = new expr(mk_const("dontcare"));
     mark_persistent(g_dont_care->raw());
     g_kernel_fresh = new name("_kernel_fresh");
@@ -1057,6 +1213,8 @@ void initialize_type_checker() {
 }
 
 void finalize_type_checker() {
+    delete g_cache;
+    delete g_kernel_cache_capacity;
     delete g_dont_care;
     delete g_kernel_fresh;
     delete g_nat_succ;
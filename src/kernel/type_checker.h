@@ -5,7 +5,6 @@ Released under Apache 2.0 license as described in the file LICENSE.
 Author: Leonardo de Moura
 */
 #pragma once
-#include <unordered_set>
 #include <memory>
 #include <utility>
 #include <algorithm>
@@ -24,7 +23,7 @@ class type_checker {
 public:
     class state {
         typedef expr_map<expr> infer_cache;
-        typedef std::unordered_set<expr_pair, expr_pair_hash, expr_pair_eq> expr_pair_set;
+        typedef flat_hash_set<expr_pair, expr_pair_hash, expr_pair_eq> expr_pair_set;
         environment               m_env;
         name_generator            m_ngen;
         infer_cache               m_infer_type[2];
@@ -87,6 +86,7 @@ private:
     reduction_status lazy_delta_reduction_step(expr & t_n, expr & s_n);
     lbool lazy_delta_reduction(expr & t_n, expr & s_n);
     bool is_def_eq_core(expr const & t, expr const & s);
+    bool use_global_cache(expr const & e) const;
     /** \brief Like \c check, but ignores undefined universes */
     expr check_ignore_undefined_universes(expr const & e);
 
@@ -142,6 +142,15 @@ public:
     optional<expr> unfold_definition(expr const & e);
 };
 
+/** \brief Return the value of the `kernel.cache_capacity` option. */
+unsigned get_kernel_cache_capacity(options const & opts);
+/** \brief Set the capacity of the process wide cache of type checker results for persistent (i.e., imported) closed terms.
+    The cache is disabled when \c capacity is 0. This function must not be invoked while type checkers are running. */
+void set_kernel_cache_capacity(unsigned capacity);
+/** \brief Remove all entries from the process wide type checker cache. It must be invoked before
+    the compacted regions containing imported terms are freed. */
+void clear_kernel_cache();
+
 void initialize_type_checker();
 void finalize_type_checker();
 }
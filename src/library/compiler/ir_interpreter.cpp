@@ -10,24 +10,31 @@ Motivation
 ==========
 
 Even with a JIT compiler, we still have a need for a simpler interpreter on platforms LLVM JIT does not support (i.e.
-WebAssembly). Because this is mostly an edge case, we strive for simplicity instead of performance and thus reuse the
-existing compiler IR instead of inventing something like a new bytecode format.
+WebAssembly). Because this is mostly an edge case, we strive for simplicity instead of performance. However, walking the
+IR objects directly turned out to be dominated by decoding costs (`Nat` fields, symbol and join point lookups), so we
+lower each declaration once to a compact bytecode close to the IR.
 
 Implementation
 ==============
 
 The interpreter mainly consists of a homogeneous stack of `value`s, which are either unboxed values or pointers to boxed
 objects. The IR type system tells us which union member is active at any time. IR variables are mapped to stack
-slots by adding the current base pointer to the variable index. Further stacks are used for storing join points and call
-stack metadata. The interpreted IR is taken directly from the environment. Whenever possible, we try to switch to native
-code by checking for the mangled symbol via dlsym/GetProcAddress, which is also how we can call external functions
-(which only works if the file declaring them has already been compiled). We always call the "boxed" versions of native
-functions, which have a (relatively) homogeneous ABI that we can use without runtime code generation; see also
-`call/lookup_symbol` below.
+slots by adding the current base pointer to the variable index. A further stack is used for storing call stack
+metadata. The interpreted IR is taken directly from the environment and lowered to `bytecode` on the first call of each
+function (see `bytecode_compiler`): variables become frame slots, join points become labels, `case` becomes a jump
+table, constructor layouts and field offsets are precomputed, and callees are resolved on first use. The result is kept
+in a per-thread `code_cache` that is shared by nested interpreter runs on the same environment. Whenever possible, we try to switch
+to native code by checking for the mangled symbol via dlsym/GetProcAddress, which is also how we can call external
+functions (which only works if the file declaring them has already been compiled). We always call the "boxed" versions
+of native functions, which have a (relatively) homogeneous ABI that we can use without runtime code generation; see also
+`call/code_cache::get` below.
 
 */
 #include <string>
 #include <vector>
+#include <limits>
+#include <memory>
+#include <unordered_map>
 #ifdef LEAN_WINDOWS
 #include <windows.h>
 #undef ERROR // thanks, wingdi.h
@@ -46,6 +53,7 @@ functions, which have a (relatively) homogeneous ABI that we can use without run
 #include "util/array_ref.h"
 #include "util/nat.h"
 #include "util/option_declarations.h"
+#include "util/name_hash_map.h"
 
 #ifndef LEAN_DEFAULT_INTERPRETER_PREFER_NATIVE
 #if LEAN_IS_STAGE0 == 1
@@ -297,57 +305,526 @@ void * lookup_symbol_in_cur_exe(char const * sym) {
 #endif
 }
 
+/** \brief Bytecode instructions. Each opcode is followed by its operands in `bytecode::m_code`. Variables are frame
+    slots, arguments are frame slots or `g_irrelevant_arg`, and labels are offsets into `bytecode::m_code`. */
+enum class opcode : uint32 {
+    Ctor,        // dst tag num_objs scalar_sz n arg*n
+    Reset,       // dst x num_objs
+    Reuse,       // dst x update_header tag num_objs scalar_sz n arg*n
+    Proj,        // dst x idx
+    UProj,       // dst x idx
+    SProj,       // dst x offset type
+    FAp,         // dst callee n arg*n
+    Load,        // dst callee type
+    TailCall,    // n arg*n
+    PAp,         // dst callee n arg*n
+    Ap,          // dst x n arg*n
+    Box,         // dst x type
+    Unbox,       // dst x type
+    Imm,         // dst imm
+    Lit,         // dst lit
+    IsShared,    // dst x
+    IsTaggedPtr, // dst x
+    Set,         // x idx arg
+    SetTag,      // x tag
+    USet,        // x idx y
+    SSet,        // x offset y type
+    Inc,         // x n
+    Dec,         // x n
+    Del,         // x
+    Case,        // x is_scalar n label*n default_label
+    Ret,         // arg
+    Jmp,         // n (param arg)*n label
+    Unreachable, //
+    Error,       // msg
+};
+
+#ifdef LEAN_DEBUG
+static char const * g_opcode_names[] = {
+    "ctor", "reset", "reuse", "proj", "uproj", "sproj", "fap", "load", "tailcall", "pap", "ap", "box", "unbox", "imm",
+    "lit", "isShared", "isTaggedPtr", "set", "setTag", "uset", "sset", "inc", "dec", "del", "case", "ret", "jmp",
+    "unreachable", "error"
+};
+#endif
+
+static constexpr uint32 g_irrelevant_arg = std::numeric_limits<uint32>::max();
+static constexpr uint32 g_no_label       = std::numeric_limits<uint32>::max();
+
+struct fn_info;
+
+/** \brief Bytecode of a function body, see `bytecode_compiler`. */
+struct bytecode {
+    std::vector<uint32>      m_code;
+    // number of variable slots, including the parameters
+    unsigned                 m_frame_size = 0;
+    // unboxed literals and nullary constructors
+    std::vector<value>       m_imms;
+    // boxed literals
+    std::vector<object_ref>  m_lits;
+    // callees are resolved on first use because the IR may refer to declarations that do not exist (yet)
+    std::vector<name>        m_callee_names;
+    std::vector<fn_info *>   m_callees;
+    std::vector<std::string> m_errors;
+};
+
+/** \brief Declaration, calling convention, and native symbol of a function. */
+struct fn_info {
+    name              m_name;
+    decl              m_decl;
+    unsigned          m_arity;
+    type              m_type;
+    std::vector<type> m_param_types;
+    std::vector<bool> m_param_borrow;
+    // symbol address; `nullptr` if function does not have native code
+    void *            m_addr;
+    // true iff we chose the boxed version of a function where the IR uses the unboxed version
+    bool              m_boxed;
+    // compiled on first interpreted call
+    std::unique_ptr<bytecode> m_code;
+
+    fn_info(name const & n, decl const & d, void * addr, bool boxed):
+        m_name(n), m_decl(d), m_arity(decl_params(d).size()), m_type(decl_type(d)), m_addr(addr), m_boxed(boxed) {
+        for (param const & p : decl_params(d)) {
+            m_param_types.push_back(param_type(p));
+            m_param_borrow.push_back(param_borrow(p));
+        }
+    }
+};
+
+/** \brief Declarations and their bytecode for a given environment. The data only depends on the environment and
+    `interpreter.prefer_native`, so it is shared by nested interpreter runs. See `get_code_cache`. */
+class code_cache {
+    environment           m_env;
+    bool                  m_prefer_native;
+    name_hash_map<fn_info> m_fns;
+public:
+    code_cache(environment const & env, bool prefer_native):m_env(env), m_prefer_native(prefer_native) {}
+
+    environment const & env() const { return m_env; }
+    bool prefer_native() const { return m_prefer_native; }
+
+    /** \brief Retrieve Lean declaration from environment. */
+    decl get_decl(name const & fn) {
+        option_ref<decl> d = find_ir_decl(m_env, fn);
+        if (!d) {
+            throw exception(sstream() << "unknown declaration '" << fn << "'");
+        }
+        return d.get().value();
+    }
+
+    /** \brief Return cached information for given unmangled function name, and look up its symbol in the current
+        binary. */
+    fn_info & get(name const & fn) {
+        auto it = m_fns.find(fn);
+        if (it != m_fns.end())
+            return it->second;
+        decl d = get_decl(fn);
+        void * addr = nullptr;
+        bool boxed  = false;
+        if (m_prefer_native || decl_tag(d) == decl_kind::Extern || has_init_attribute(m_env, fn)) {
+            string_ref mangled = name_mangle(fn, *g_mangle_prefix);
+            string_ref boxed_mangled(string_append(mangled.to_obj_arg(), g_boxed_mangled_suffix->raw()));
+            // check for boxed version first
+            if (void *p_boxed = lookup_symbol_in_cur_exe(boxed_mangled.data())) {
+                addr  = p_boxed;
+                boxed = true;
+            } else if (void *p = lookup_symbol_in_cur_exe(mangled.data())) {
+                // if there is no boxed version, there are no unboxed parameters, so use default version
+                addr = p;
+            }
+        }
+        return m_fns.emplace(fn, fn_info(fn, d, addr, boxed)).first->second;
+    }
+};
+
+/* The cache of the environment used last by the current thread. It is thread-local so that we never release IR
+   objects owned by another thread. We use `std::shared_ptr` because nested interpreters for different environments may
+   replace it while outer ones are still running. The cache holds a reference to the environment, so it is released
+   when the outermost interpreter of the thread finishes (see `~interpreter`). */
+MK_THREAD_LOCAL_GET_DEF(std::shared_ptr<code_cache>, get_code_cache_slot);
+
+static std::shared_ptr<code_cache> get_code_cache(environment const & env, bool prefer_native) {
+    std::shared_ptr<code_cache> & c = get_code_cache_slot();
+    if (!c || !is_eqp(c->env(), env) || c->prefer_native() != prefer_native)
+        c = std::make_shared<code_cache>(env, prefer_native);
+    return c;
+}
+
+/** \brief Lower the IR body of a declaration to `bytecode`. Variable `x_i` is stored at frame slot `i - 1`,
+    join points become labels, and `case` becomes a jump table indexed by the constructor tag. */
+class bytecode_compiler {
+    bytecode & m_bc;
+    name       m_fn;
+    struct jp_info {
+        jp_id               m_id;
+        array_ref<param>    m_params;
+        // label of the join point body, `g_no_label` until it has been placed
+        uint32              m_label;
+        std::vector<size_t> m_fixups;
+    };
+    std::vector<jp_info> m_jps;
+    name_hash_map<uint32> m_callee_idx;
+
+    void emit(uint32 w) { m_bc.m_code.push_back(w); }
+    void emit(opcode op) { emit(static_cast<uint32>(op)); }
+    uint32 here() const { return m_bc.m_code.size(); }
+
+    uint32 var(var_id const & x) {
+        unsigned i = x.get_small_value();
+        lean_assert(i > 0);
+        m_bc.m_frame_size = std::max(m_bc.m_frame_size, i);
+        return i - 1;
+    }
+
+    uint32 to_arg(arg const & a) {
+        // an "irrelevant" argument is type- or proof-erased; we can use an arbitrary value for it
+        return arg_is_irrelevant(a) ? g_irrelevant_arg : var(arg_var_id(a));
+    }
+
+    void emit_args(array_ref<arg> const & args) {
+        emit(args.size());
+        for (arg const & a : args)
+            emit(to_arg(a));
+    }
+
+    uint32 callee(name const & fn) {
+        auto it = m_callee_idx.find(fn);
+        if (it != m_callee_idx.end())
+            return it->second;
+        uint32 idx = m_bc.m_callee_names.size();
+        m_bc.m_callee_names.push_back(fn);
+        m_bc.m_callees.push_back(nullptr);
+        m_callee_idx.insert(mk_pair(fn, idx));
+        return idx;
+    }
+
+    void emit_imm(uint32 dst, value v) {
+        emit(opcode::Imm); emit(dst); emit(m_bc.m_imms.size());
+        m_bc.m_imms.push_back(v);
+    }
+
+    void emit_lit(uint32 dst, object_ref const & o) {
+        emit(opcode::Lit); emit(dst); emit(m_bc.m_lits.size());
+        m_bc.m_lits.push_back(o);
+    }
+
+    void emit_error(std::string const & msg) {
+        emit(opcode::Error); emit(m_bc.m_errors.size());
+        m_bc.m_errors.push_back(msg);
+    }
+
+    static uint32 ctor_scalar_size(ctor_info const & i) {
+        // unboxed USize fields (whose byte size the IR is ignorant of) followed by all other unboxed fields
+        return ctor_info_usize(i).get_small_value() * sizeof(void *) + ctor_info_ssize(i).get_small_value();
+    }
+
+    static bool is_sproj_type(type t) {
+        return t == type::Float || t == type::UInt8 || t == type::UInt16 || t == type::UInt32 || t == type::UInt64;
+    }
+
+    void compile_expr(uint32 dst, expr const & e, type t) {
+        switch (expr_tag(e)) {
+            case expr_kind::Ctor: {
+                ctor_info const & i = expr_ctor_info(e);
+                size_t tag = ctor_info_tag(i).get_small_value();
+                if (ctor_info_size(i).get_small_value() == 0 && ctor_scalar_size(i) == 0) {
+                    // a constructor without data is optimized to a tagged pointer
+                    emit_imm(dst, box(tag));
+                } else {
+                    emit(opcode::Ctor); emit(dst); emit(tag); emit(ctor_info_size(i).get_small_value()); emit(ctor_scalar_size(i));
+                    emit_args(expr_ctor_args(e));
+                }
+                return;
+            }
+            case expr_kind::Reset:
+                emit(opcode::Reset); emit(dst); emit(var(expr_reset_obj(e))); emit(expr_reset_num_objs(e).get_small_value());
+                return;
+            case expr_kind::Reuse: {
+                ctor_info const & i = expr_reuse_ctor(e);
+                emit(opcode::Reuse); emit(dst); emit(var(expr_reuse_obj(e))); emit(expr_reuse_update_header(e));
+                emit(ctor_info_tag(i).get_small_value()); emit(ctor_info_size(i).get_small_value()); emit(ctor_scalar_size(i));
+                emit_args(expr_reuse_args(e));
+                return;
+            }
+            case expr_kind::Proj:
+                emit(opcode::Proj); emit(dst); emit(var(expr_proj_obj(e))); emit(expr_proj_idx(e).get_small_value());
+                return;
+            case expr_kind::UProj:
+                emit(opcode::UProj); emit(dst); emit(var(expr_uproj_obj(e))); emit(expr_uproj_idx(e).get_small_value());
+                return;
+            case expr_kind::SProj:
+                if (!is_sproj_type(t)) {
+                    emit_error("invalid instruction");
+                    return;
+                }
+                emit(opcode::SProj); emit(dst); emit(var(expr_sproj_obj(e)));
+                emit(expr_sproj_idx(e).get_small_value() * sizeof(void *) + expr_sproj_offset(e).get_small_value());
+                emit(static_cast<uint32>(t));
+                return;
+            case expr_kind::FAp:
+                if (expr_fap_args(e).size()) {
+                    emit(opcode::FAp); emit(dst); emit(callee(expr_fap_fun(e))); emit_args(expr_fap_args(e));
+                } else {
+                    // nullary function ("constant")
+                    emit(opcode::Load); emit(dst); emit(callee(expr_fap_fun(e))); emit(static_cast<uint32>(t));
+                }
+                return;
+            case expr_kind::PAp:
+                emit(opcode::PAp); emit(dst); emit(callee(expr_pap_fun(e))); emit_args(expr_pap_args(e));
+                return;
+            case expr_kind::Ap:
+                emit(opcode::Ap); emit(dst); emit(var(expr_ap_fun(e))); emit_args(expr_ap_args(e));
+                return;
+            case expr_kind::Box:
+                emit(opcode::Box); emit(dst); emit(var(expr_box_obj(e))); emit(static_cast<uint32>(expr_box_type(e)));
+                return;
+            case expr_kind::Unbox:
+                emit(opcode::Unbox); emit(dst); emit(var(expr_unbox_obj(e))); emit(static_cast<uint32>(t));
+                return;
+            case expr_kind::Lit:
+                switch (lit_val_tag(expr_lit_val(e))) {
+                    case lit_val_kind::Num: {
+                        nat const & n = lit_val_num(expr_lit_val(e));
+                        switch (t) {
+                            case type::Float:
+                                emit_imm(dst, value::from_float(lean_float_of_nat(n.raw())));
+                                return;
+                            case type::UInt8:
+                            case type::UInt16:
+                            case type::UInt32:
+                            case type::USize:
+                                emit_imm(dst, lean_usize_of_nat(n.raw()));
+                                return;
+                            case type::UInt64:
+                                emit_imm(dst, lean_uint64_of_nat(n.raw()));
+                                return;
+                            // `nat` literal
+                            case type::Object:
+                            case type::TObject:
+                                emit_lit(dst, n);
+                                return;
+                            default:
+                                emit_error("invalid instruction");
+                                return;
+                        }
+                    }
+                    case lit_val_kind::Str:
+                        emit_lit(dst, lit_val_str(expr_lit_val(e)));
+                        return;
+                }
+                break;
+            case expr_kind::IsShared:
+                emit(opcode::IsShared); emit(dst); emit(var(expr_is_shared_obj(e)));
+                return;
+            case expr_kind::IsTaggedPtr:
+                emit(opcode::IsTaggedPtr); emit(dst); emit(var(expr_is_tagged_ptr_obj(e)));
+                return;
+        }
+        emit_error((sstream() << "unexpected instruction kind " << static_cast<unsigned>(expr_tag(e))).str());
+    }
+
+    bool is_self_tail_call(fn_body const & b) {
+        expr const & e = fn_body_vdecl_expr(b);
+        fn_body const & cont = fn_body_vdecl_cont(b);
+        return expr_tag(e) == expr_kind::FAp && expr_fap_fun(e) == m_fn && expr_fap_args(e).size() > 0 &&
+            fn_body_tag(cont) == fn_body_kind::Ret && !arg_is_irrelevant(fn_body_ret_arg(cont)) &&
+            arg_var_id(fn_body_ret_arg(cont)) == fn_body_vdecl_var(b);
+    }
+
+    void compile_case(fn_body const & b) {
+        array_ref<alt_core> const & alts = fn_body_case_alts(b);
+        // index of the alternative taken for each tag, the first matching alternative wins
+        std::vector<unsigned> table;
+        unsigned default_alt = g_no_label;
+        for (unsigned i = 0; i < alts.size() && default_alt == g_no_label; i++) {
+            alt_core const & a = alts[i];
+            if (alt_core_tag(a) == alt_core_kind::Default) {
+                default_alt = i;
+            } else {
+                size_t tag = ctor_info_tag(alt_core_ctor_info(a)).get_small_value();
+                if (tag >= table.size())
+                    table.resize(tag + 1, g_no_label);
+                if (table[tag] == g_no_label)
+                    table[tag] = i;
+            }
+        }
+        emit(opcode::Case); emit(var(fn_body_case_var(b))); emit(type_is_scalar(fn_body_case_var_type(b)));
+        emit(table.size());
+        size_t table_pos = here();
+        for (unsigned i = 0; i < table.size(); i++)
+            emit(g_no_label);
+        emit(g_no_label);
+        for (unsigned i = 0; i < alts.size(); i++) {
+            bool used = default_alt == i;
+            for (unsigned alt_idx : table)
+                used = used || alt_idx == i;
+            if (!used)
+                continue;
+            uint32 label = here();
+            for (unsigned tag = 0; tag < table.size(); tag++) {
+                if (table[tag] == i)
+                    m_bc.m_code[table_pos + tag] = label;
+            }
+            if (default_alt == i) {
+                m_bc.m_code[table_pos + table.size()] = label;
+                compile_body(alt_core_default_cont(alts[i]));
+            } else {
+                compile_body(alt_core_ctor_cont(alts[i]));
+            }
+        }
+    }
+
+    void compile_jmp(fn_body const & b) {
+        jp_id const & id = fn_body_jmp_jp(b);
+        for (size_t i = m_jps.size(); i > 0; i--) {
+            jp_info & jp = m_jps[i - 1];
+            if (jp.m_id.get_small_value() == id.get_small_value()) {
+                array_ref<arg> const & args = fn_body_jmp_args(b);
+                lean_assert(jp.m_params.size() == args.size());
+                emit(opcode::Jmp); emit(args.size());
+                for (size_t j = 0; j < args.size(); j++) {
+                    emit(var(param_var(jp.m_params[j])));
+                    emit(to_arg(args[j]));
+                }
+                if (jp.m_label == g_no_label)
+                    jp.m_fixups.push_back(here());
+                emit(jp.m_label);
+                return;
+            }
+        }
+        emit_error((sstream() << "unknown join point " << id.get_small_value()).str());
+    }
+
+    void compile_body(fn_body const & b0) {
+        fn_body b = b0;
+        while (true) {
+            switch (fn_body_tag(b)) {
+                case fn_body_kind::VDecl: // variable declaration
+                    if (is_self_tail_call(b)) {
+                        // tail recursion! copy argument values to parameter slots and jump to the beginning
+                        emit(opcode::TailCall); emit_args(expr_fap_args(fn_body_vdecl_expr(b)));
+                        return;
+                    }
+                    compile_expr(var(fn_body_vdecl_var(b)), fn_body_vdecl_expr(b), fn_body_vdecl_type(b));
+                    b = fn_body_vdecl_cont(b);
+                    break;
+                case fn_body_kind::JDecl: { // join-point declaration; the body is placed after the continuation
+                    size_t idx = m_jps.size();
+                    m_jps.push_back(jp_info { fn_body_jdecl_id(b), fn_body_jdecl_params(b), g_no_label, {} });
+                    compile_body(fn_body_jdecl_cont(b));
+                    uint32 label = here();
+                    m_jps[idx].m_label = label;
+                    for (size_t pos : m_jps[idx].m_fixups)
+                        m_bc.m_code[pos] = label;
+                    compile_body(fn_body_jdecl_body(b));
+                    m_jps.pop_back();
+                    return;
+                }
+                case fn_body_kind::Set:
+                    emit(opcode::Set); emit(var(fn_body_set_var(b))); emit(fn_body_set_idx(b).get_small_value());
+                    emit(to_arg(fn_body_set_arg(b)));
+                    b = fn_body_set_cont(b);
+                    break;
+                case fn_body_kind::SetTag:
+                    emit(opcode::SetTag); emit(var(fn_body_set_tag_var(b))); emit(fn_body_set_tag_cidx(b).get_small_value());
+                    b = fn_body_set_tag_cont(b);
+                    break;
+                case fn_body_kind::USet:
+                    emit(opcode::USet); emit(var(fn_body_uset_target(b))); emit(fn_body_uset_idx(b).get_small_value());
+                    emit(var(fn_body_uset_source(b)));
+                    b = fn_body_uset_cont(b);
+                    break;
+                case fn_body_kind::SSet:
+                    if (!is_sproj_type(fn_body_sset_type(b))) {
+                        emit_error("invalid instruction");
+                        return;
+                    }
+                    emit(opcode::SSet); emit(var(fn_body_sset_target(b)));
+                    emit(fn_body_sset_idx(b).get_small_value() * sizeof(void *) + fn_body_sset_offset(b).get_small_value());
+                    emit(var(fn_body_sset_source(b))); emit(static_cast<uint32>(fn_body_sset_type(b)));
+                    b = fn_body_sset_cont(b);
+                    break;
+                case fn_body_kind::Inc:
+                    emit(opcode::Inc); emit(var(fn_body_inc_var(b))); emit(fn_body_inc_val(b).get_small_value());
+                    b = fn_body_inc_cont(b);
+                    break;
+                case fn_body_kind::Dec:
+                    emit(opcode::Dec); emit(var(fn_body_dec_var(b))); emit(fn_body_dec_val(b).get_small_value());
+                    b = fn_body_dec_cont(b);
+                    break;
+                case fn_body_kind::Del:
+                    emit(opcode::Del); emit(var(fn_body_del_var(b)));
+                    b = fn_body_del_cont(b);
+                    break;
+                case fn_body_kind::MData: // metadata; no-op
+                    b = fn_body_mdata_cont(b);
+                    break;
+                case fn_body_kind::Case:
+                    compile_case(b);
+                    return;
+                case fn_body_kind::Ret:
+                    emit(opcode::Ret); emit(to_arg(fn_body_ret_arg(b)));
+                    return;
+                case fn_body_kind::Jmp:
+                    compile_jmp(b);
+                    return;
+                case fn_body_kind::Unreachable:
+                    emit(opcode::Unreachable);
+                    return;
+            }
+        }
+    }
+
+public:
+    explicit bytecode_compiler(bytecode & bc):m_bc(bc) {}
+
+    void operator()(decl const & d) {
+        m_fn = decl_fun_id(d);
+        for (param const & p : decl_params(d))
+            var(param_var(p));
+        compile_body(decl_fun_body(d));
+    }
+};
+
 class interpreter;
 LEAN_THREAD_PTR(interpreter, g_interpreter);
 
 class interpreter {
     // stack of IR variable slots
     std::vector<value> m_arg_stack;
-    // stack of join points
-    std::vector<fn_body const *> m_jp_stack;
     struct frame {
-        name m_fn;
-        // base pointers into the stack above
+        fn_info const * m_fn;
+        // base pointer into the stack above
         size_t m_arg_bp;
-        size_t m_jp_bp;
 
-        frame(name const & mFn, size_t mArgBp, size_t mJpBp) : m_fn(mFn), m_arg_bp(mArgBp), m_jp_bp(mJpBp) {}
+        frame(fn_info const * mFn, size_t mArgBp) : m_fn(mFn), m_arg_bp(mArgBp) {}
     };
     std::vector<frame> m_call_stack;
     environment const & m_env;
     options const & m_opts;
     // if `false`, use IR code where possible
     bool m_prefer_native;
+    std::shared_ptr<code_cache> m_code_cache;
     struct constant_cache_entry {
       bool m_is_scalar;
       value m_val;
     };
     // caches values of nullary functions ("constants")
-    name_map<constant_cache_entry> m_constant_cache;
-    struct symbol_cache_entry {
-        decl m_decl;
-        // symbol address; `nullptr` if function does not have native code
-        void * m_addr;
-        // true iff we chose the boxed version of a function where the IR uses the unboxed version
-        bool m_boxed;
-    };
-    // caches symbol lookup successes _and_ failures
-    name_map<symbol_cache_entry> m_symbol_cache;
+    std::unordered_map<fn_info const *, constant_cache_entry> m_constant_cache;
 
     /** \brief Get current stack frame */
     inline frame & get_frame() {
         return m_call_stack.back();
     }
 
-    /** \brief Get reference to stack slot of IR variable */
-    inline value & var(var_id const & v) {
-        // variables are 1-indexed
-        size_t i = get_frame().m_arg_bp + v.get_small_value() - 1;
-        // we don't know the frame size (unless we do an additional IR pass), so we extend it dynamically
-        if (i >= m_arg_stack.size()) {
-            m_arg_stack.resize(i + 1);
-        }
-        return m_arg_stack[i];
+    /** \brief Get reference to stack slot of IR variable in the frame starting at `bp`.
+        \remark The reference is invalidated by nested calls, which may resize the stack. */
+    inline value & var(size_t bp, uint32 x) {
+        return m_arg_stack[bp + x];
+    }
+
+    inline value eval_arg(size_t bp, uint32 a) {
+        return a == g_irrelevant_arg ? value(box(0)) : var(bp, a);
     }
 
 public:
@@ -367,27 +844,15 @@ public:
     }
 
 private:
-    value eval_arg(arg const & a) {
-        // an "irrelevant" argument is type- or proof-erased; we can use an arbitrary value for it
-        return arg_is_irrelevant(a) ? box(0) : var(arg_var_id(a));
-    }
-
     /** \brief Allocate constructor object with given tag and arguments */
-    object * alloc_ctor(ctor_info const & i, array_ref<arg> const & args) {
-        size_t tag = ctor_info_tag(i).get_small_value();
-        // number of boxed object fields
-        size_t size = ctor_info_size(i).get_small_value();
-        // number of unboxed USize fields (whose byte size the IR is ignorant of)
-        size_t usize = ctor_info_usize(i).get_small_value();
-        // byte size of all other unboxed fields
-        size_t ssize = ctor_info_ssize(i).get_small_value();
-        if (size == 0 && usize == 0 && ssize == 0) {
+    object * alloc_ctor(size_t bp, unsigned tag, unsigned num_objs, unsigned scalar_sz, unsigned n, uint32 const * args) {
+        if (num_objs == 0 && scalar_sz == 0) {
             // a constructor without data is optimized to a tagged pointer
             return box(tag);
         } else {
-            object *o = alloc_cnstr(tag, size, usize * sizeof(void *) + ssize);
-            for (size_t i = 0; i < args.size(); i++) {
-                cnstr_set(o, i, eval_arg(args[i]).m_obj);
+            object *o = alloc_cnstr(tag, num_objs, scalar_sz);
+            for (unsigned i = 0; i < n; i++) {
+                cnstr_set(o, i, eval_arg(bp, args[i]).m_obj);
             }
             return o;
         }
@@ -406,128 +871,6 @@ private:
         return cls;
     }
 
-    value eval_expr(expr const & e, type t) {
-        switch (expr_tag(e)) {
-            case expr_kind::Ctor:
-                return value { alloc_ctor(expr_ctor_info(e), expr_ctor_args(e)) };
-            case expr_kind::Reset: { // release fields if unique reference in preparation for `Reuse` below
-                object * o = var(expr_reset_obj(e)).m_obj;
-                if (is_exclusive(o)) {
-                    for (size_t i = 0; i < expr_reset_num_objs(e).get_small_value(); i++) {
-                        cnstr_release(o, i);
-                    }
-                    return o;
-                } else {
-                    dec_ref(o);
-                    return box(0);
-                }
-            }
-            case expr_kind::Reuse: { // reuse dead allocation if possible
-                object * o = var(expr_reuse_obj(e)).m_obj;
-                // check if `Reset` above had a unique reference it consumed
-                if (is_scalar(o)) {
-                    // fall back to regular allocation
-                    return alloc_ctor(expr_reuse_ctor(e), expr_reuse_args(e));
-                } else {
-                    // create new constructor object in-place
-                    if (expr_reuse_update_header(e)) {
-                        cnstr_set_tag(o, ctor_info_tag(expr_reuse_ctor(e)).get_small_value());
-                    }
-                    for (size_t i = 0; i < expr_reuse_args(e).size(); i++) {
-                        cnstr_set(o, i, eval_arg(expr_reuse_args(e)[i]).m_obj);
-                    }
-                    return o;
-                }
-            }
-            case expr_kind::Proj: // object field access
-                return cnstr_get(var(expr_proj_obj(e)).m_obj, expr_proj_idx(e).get_small_value());
-            case expr_kind::UProj: // USize field access
-                return cnstr_get_usize(var(expr_uproj_obj(e)).m_obj, expr_uproj_idx(e).get_small_value());
-            case expr_kind::SProj: { // other unboxed field access
-                size_t offset = expr_sproj_idx(e).get_small_value() * sizeof(void *) +
-                                expr_sproj_offset(e).get_small_value();
-                object * o = var(expr_sproj_obj(e)).m_obj;
-                switch (t) {
-                    case type::Float: return value::from_float(cnstr_get_float(o, offset));
-                    case type::UInt8: return cnstr_get_uint8(o, offset);
-                    case type::UInt16: return cnstr_get_uint16(o, offset);
-                    case type::UInt32: return cnstr_get_uint32(o, offset);
-                    case type::UInt64: return cnstr_get_uint64(o, offset);
-                    default: throw exception("invalid instruction");
-                }
-            }
-            case expr_kind::FAp: { // satured ("full") application of top-level function
-                if (expr_fap_args(e).size()) {
-                    return call(expr_fap_fun(e), expr_fap_args(e));
-                } else {
-                    // nullary function ("constant")
-                    return load(expr_fap_fun(e), t);
-                }
-            }
-            case expr_kind::PAp: { // unsatured (partial) application of top-level function
-                symbol_cache_entry sym = lookup_symbol(expr_pap_fun(e));
-                if (sym.m_addr) {
-                    // point closure directly at native symbol
-                    object * cls = alloc_closure(sym.m_addr, decl_params(sym.m_decl).size(), expr_pap_args(e).size());
-                    for (unsigned i = 0; i < expr_pap_args(e).size(); i++) {
-                        closure_set(cls, i, eval_arg(expr_pap_args(e)[i]).m_obj);
-                    }
-                    return cls;
-                } else {
-                    // point closure at interpreter stub
-                    object ** args = static_cast<object **>(LEAN_ALLOCA(expr_pap_args(e).size() * sizeof(object *))); // NOLINT
-                    for (size_t i = 0; i < expr_pap_args(e).size(); i++) {
-                        args[i] = eval_arg(expr_pap_args(e)[i]).m_obj;
-                    }
-                    return mk_stub_closure(sym.m_decl, expr_pap_args(e).size(), args);
-                }
-            }
-            case expr_kind::Ap: { // (saturated or unsatured) application of closure; mostly handled by runtime
-                object ** args = static_cast<object **>(LEAN_ALLOCA(expr_ap_args(e).size() * sizeof(object *))); // NOLINT
-                for (size_t i = 0; i < expr_ap_args(e).size(); i++) {
-                    args[i] = eval_arg(expr_ap_args(e)[i]).m_obj;
-                }
-                object * r = apply_n(var(expr_ap_fun(e)).m_obj, expr_ap_args(e).size(), args);
-                return r;
-            }
-            case expr_kind::Box: // box unboxed value
-                return box_t(var(expr_box_obj(e)).m_num, expr_box_type(e));
-            case expr_kind::Unbox: // unbox boxed value
-                return unbox_t(var(expr_unbox_obj(e)).m_obj, t);
-            case expr_kind::Lit: // load numeric or string literal
-                switch (lit_val_tag(expr_lit_val(e))) {
-                    case lit_val_kind::Num: {
-                        nat const & n = lit_val_num(expr_lit_val(e));
-                        switch (t) {
-                            case type::Float:
-                                return value::from_float(lean_float_of_nat(n.raw()));
-                            case type::UInt8:
-                            case type::UInt16:
-                            case type::UInt32:
-                            case type::USize:
-                                return lean_usize_of_nat(n.raw());
-                            case type::UInt64:
-                                return lean_uint64_of_nat(n.raw());
-                            // `nat` literal
-                            case type::Object:
-                            case type::TObject:
-                                return n.to_obj_arg();
-                            default:
-                                throw exception("invalid instruction");
-                        }
-                    }
-                    case lit_val_kind::Str:
-                        return lit_val_str(expr_lit_val(e)).to_obj_arg();
-                }
-            case expr_kind::IsShared:
-                return !is_exclusive(var(expr_is_shared_obj(e)).m_obj);
-            case expr_kind::IsTaggedPtr:
-                return !is_scalar(var(expr_is_tagged_ptr_obj(e)).m_obj);
-            default:
-                throw exception(sstream() << "unexpected instruction kind " << static_cast<unsigned>(expr_tag(e)));
-        }
-    }
-
     void check_system() {
         try {
             lean::check_system("interpreter");
@@ -536,181 +879,348 @@ private:
             ss << ex.what() << "\n";
             ss << "interpreter stacktrace:\n";
             for (unsigned i = 0; i < m_call_stack.size(); i++) {
-                ss << "#" << (i + 1) << " " << m_call_stack[m_call_stack.size() - i - 1].m_fn << "\n";
+                ss << "#" << (i + 1) << " " << m_call_stack[m_call_stack.size() - i - 1].m_fn->m_name << "\n";
             }
             throw throwable(ss);
         }
     }
 
-    value eval_body(fn_body const & b0) {
-        check_system();
+    /** \brief Return bytecode of given function, compiling it on first use. */
+    bytecode & get_code(fn_info & fn) {
+        if (!fn.m_code) {
+            if (decl_tag(fn.m_decl) == decl_kind::Extern) {
+                throw exception(sstream() << "could not find native implementation of external declaration '" << fn.m_name << "'");
+            }
+            std::unique_ptr<bytecode> bc(new bytecode());
+            bytecode_compiler compiler(*bc);
+            compiler(fn.m_decl);
+            fn.m_code = std::move(bc);
+        }
+        return *fn.m_code;
+    }
 
-        // make reference reassignable...
-        std::reference_wrapper<fn_body const> b(b0);
-        while (true) {
-            DEBUG_CODE(lean_trace(name({"interpreter", "step"}),
-                                  tout() << std::string(m_call_stack.size(), ' ') << format_fn_body_head(b) << "\n";);)
-            switch (fn_body_tag(b)) {
-                case fn_body_kind::VDecl: { // variable declaration
-                    expr const & e = fn_body_vdecl_expr(b);
-                    fn_body const & cont = fn_body_vdecl_cont(b);
-                    // tail recursion?
-                    if (expr_tag(e) == expr_kind::FAp && expr_fap_fun(e) == get_frame().m_fn &&
-                        fn_body_tag(cont) == fn_body_kind::Ret && !arg_is_irrelevant(fn_body_ret_arg(cont)) &&
-                        arg_var_id(fn_body_ret_arg(cont)) == fn_body_vdecl_var(b)) {
-                        // tail recursion! copy argument values to parameter slots and reset `b`
-                        array_ref<arg> const & args = expr_fap_args(e);
-                        // argument and parameter slots may overlap, so first copy arguments to end of stack
-                        size_t old_size = m_arg_stack.size();
-                        for (const auto & arg : args) {
-                            m_arg_stack.push_back(eval_arg(arg));
-                        }
-                        // now copy to parameter slots
-                        for (size_t i = 0; i < args.size(); i++) {
-                            m_arg_stack[get_frame().m_arg_bp + i] = m_arg_stack[old_size + i];
-                        }
-                        m_arg_stack.resize(get_frame().m_arg_bp + args.size());
-                        b = b0;
-                        check_system();
-                        break;
-                    }
-                    value v = eval_expr(fn_body_vdecl_expr(b), fn_body_vdecl_type(b));
-                    // NOTE: `var` must be called *after* `eval_expr` because the stack may get resized and invalidate
-                    // the pointer
-                    var(fn_body_vdecl_var(b)) = v;
-                    DEBUG_CODE(lean_trace(name({"interpreter", "step"}),
-                                          tout() << std::string(m_call_stack.size(), ' ') << "=> x_";
-                                          tout() << fn_body_vdecl_var(b).get_small_value() << " = ";
-                                          print_value(tout(), var(fn_body_vdecl_var(b)), fn_body_vdecl_type(b));
-                                          tout() << "\n";);)
-                    b = fn_body_vdecl_cont(b);
-                    break;
-                }
-                case fn_body_kind::JDecl: { // join-point declaration; store in stack slot just like variables
-                    size_t i = get_frame().m_jp_bp + fn_body_jdecl_id(b).get_small_value();
-                    if (i >= m_jp_stack.size()) {
-                        m_jp_stack.resize(i + 1);
-                    }
-                    m_jp_stack[i] = &b.get();
-                    b = fn_body_jdecl_cont(b);
-                    break;
-                }
-                case fn_body_kind::Set: { // set boxed field of unique reference
-                    object * o = var(fn_body_set_var(b)).m_obj;
-                    lean_assert(is_exclusive(o));
-                    cnstr_set(o, fn_body_set_idx(b).get_small_value(), eval_arg(fn_body_set_arg(b)).m_obj);
-                    b = fn_body_set_cont(b);
-                    break;
-                }
-                case fn_body_kind::SetTag: { // set constructor tag of unique reference
-                    object * o = var(fn_body_set_tag_var(b)).m_obj;
-                    lean_assert(is_exclusive(o));
-                    cnstr_set_tag(o, fn_body_set_tag_cidx(b).get_small_value());
-                    b = fn_body_set_tag_cont(b);
-                    break;
-                }
-                case fn_body_kind::USet: { // set USize field of unique reference
-                    object * o = var(fn_body_uset_target(b)).m_obj;
-                    lean_assert(is_exclusive(o));
-                    cnstr_set_usize(o, fn_body_uset_idx(b).get_small_value(), var(fn_body_uset_source(b)).m_num);
-                    b = fn_body_uset_cont(b);
-                    break;
+    /** \brief Return callee `i` of `bc`, resolving it on first use. */
+    fn_info & get_callee(bytecode & bc, uint32 i) {
+        fn_info * fn = bc.m_callees[i];
+        if (!fn) {
+            fn = &m_code_cache->get(bc.m_callee_names[i]);
+            bc.m_callees[i] = fn;
+        }
+        return *fn;
+    }
+
+#if defined(__GNUC__)
+// threaded dispatch using computed gotos
+#define LEAN_BC_BEGIN() LEAN_BC_DISPATCH();
+#define LEAN_BC_OP(o) L_##o:
+#define LEAN_BC_GOTO() goto *labels[*pc]
+#define LEAN_BC_END()
+#else
+#define LEAN_BC_BEGIN() while (true) switch (static_cast<opcode>(*pc)) {
+#define LEAN_BC_OP(o) case opcode::o:
+#define LEAN_BC_GOTO() continue
+#define LEAN_BC_END() }
+#endif
+#ifdef LEAN_DEBUG
+#define LEAN_BC_DISPATCH() { trace_step(bc, pc); LEAN_BC_GOTO(); }
+#else
+#define LEAN_BC_DISPATCH() LEAN_BC_GOTO()
+#endif
+
+#ifdef LEAN_DEBUG
+    void trace_step(bytecode const & bc, uint32 const * pc) {
+        lean_trace(name({"interpreter", "step"}),
+                   tout() << std::string(m_call_stack.size(), ' ') << (pc - bc.m_code.data()) << ": "
+                          << g_opcode_names[*pc] << "\n";);
+    }
+#endif
+
+    /** \brief Execute the body of `fn` in the frame starting at `bp`, which already contains the arguments. */
+    value exec(fn_info & fn, size_t bp) {
+        bytecode & bc = get_code(fn);
+        m_arg_stack.resize(bp + bc.m_frame_size);
+        check_system();
+        uint32 const * code = bc.m_code.data();
+        uint32 const * pc   = code;
+#if defined(__GNUC__)
+        static void * const labels[] = {
+            &&L_Ctor, &&L_Reset, &&L_Reuse, &&L_Proj, &&L_UProj, &&L_SProj, &&L_FAp, &&L_Load, &&L_TailCall, &&L_PAp,
+            &&L_Ap, &&L_Box, &&L_Unbox, &&L_Imm, &&L_Lit, &&L_IsShared, &&L_IsTaggedPtr, &&L_Set, &&L_SetTag, &&L_USet,
+            &&L_SSet, &&L_Inc, &&L_Dec, &&L_Del, &&L_Case, &&L_Ret, &&L_Jmp, &&L_Unreachable, &&L_Error
+        };
+#endif
+        // NOTE: results of operations that may call back into the interpreter must be stored *after* the call
+        // because the stack may get resized and invalidate the slot reference
+        LEAN_BC_BEGIN()
+        LEAN_BC_OP(Ctor) { // dst tag num_objs scalar_sz n arg*n
+            var(bp, pc[1]) = alloc_ctor(bp, pc[2], pc[3], pc[4], pc[5], pc + 6);
+            pc += 6 + pc[5];
+            LEAN_BC_DISPATCH();
+        }
+        LEAN_BC_OP(Reset) { // release fields if unique reference in preparation for `Reuse` below
+            object * o = var(bp, pc[2]).m_obj;
+            value r;
+            if (is_exclusive(o)) {
+                for (size_t i = 0; i < pc[3]; i++) {
+                    cnstr_release(o, i);
                 }
-                case fn_body_kind::SSet: { // set other unboxed field of unique reference
-                    object * o = var(fn_body_sset_target(b)).m_obj;
-                    size_t offset = fn_body_sset_idx(b).get_small_value() * sizeof(void *) +
-                                    fn_body_sset_offset(b).get_small_value();
-                    value v = var(fn_body_sset_source(b));
-                    lean_assert(is_exclusive(o));
-                    switch (fn_body_sset_type(b)) {
-                        case type::Float: cnstr_set_float(o, offset, v.m_float); break;
-                        case type::UInt8: cnstr_set_uint8(o, offset, v.m_num); break;
-                        case type::UInt16: cnstr_set_uint16(o, offset, v.m_num); break;
-                        case type::UInt32: cnstr_set_uint32(o, offset, v.m_num); break;
-                        case type::UInt64: cnstr_set_uint64(o, offset, v.m_num); break;
-                        default: throw exception(sstream() << "invalid instruction");
-                    }
-                    b = fn_body_sset_cont(b);
-                    break;
+                r = o;
+            } else {
+                dec_ref(o);
+                r = box(0);
+            }
+            var(bp, pc[1]) = r;
+            pc += 4;
+            LEAN_BC_DISPATCH();
+        }
+        LEAN_BC_OP(Reuse) { // reuse dead allocation if possible
+            object * o = var(bp, pc[2]).m_obj;
+            uint32 n = pc[7];
+            // check if `Reset` above had a unique reference it consumed
+            if (is_scalar(o)) {
+                // fall back to regular allocation
+                o = alloc_ctor(bp, pc[4], pc[5], pc[6], n, pc + 8);
+            } else {
+                // create new constructor object in-place
+                if (pc[3]) {
+                    cnstr_set_tag(o, pc[4]);
                 }
-                case fn_body_kind::Inc: // increment reference counter
-                    inc(var(fn_body_inc_var(b)).m_obj, fn_body_inc_val(b).get_small_value());
-                    b = fn_body_inc_cont(b);
-                    break;
-                case fn_body_kind::Dec: { // decrement reference counter
-                    size_t n = fn_body_dec_val(b).get_small_value();
-                    for (size_t i = 0; i < n; i++) {
-                        dec(var(fn_body_dec_var(b)).m_obj);
-                    }
-                    b = fn_body_dec_cont(b);
-                    break;
+                for (size_t i = 0; i < n; i++) {
+                    cnstr_set(o, i, eval_arg(bp, pc[8 + i]).m_obj);
                 }
-                case fn_body_kind::Del: // delete object of unique reference
-                    lean_free_object(var(fn_body_del_var(b)).m_obj);
-                    b = fn_body_del_cont(b);
-                    break;
-                case fn_body_kind::MData: // metadata; no-op
-                    b = fn_body_mdata_cont(b);
-                    break;
-                case fn_body_kind::Case: { // branch according to constructor tag
-                    array_ref<alt_core> const & alts = fn_body_case_alts(b);
-                    unsigned tag;
-                    value v = var(fn_body_case_var(b));
-                    if (type_is_scalar(fn_body_case_var_type(b))) {
-                        tag = v.m_num;
-                    } else {
-                        tag = lean_obj_tag(v.m_obj);
-                    }
-                    for (alt_core const & a : alts) {
-                        switch (alt_core_tag(a)) {
-                            case alt_core_kind::Ctor:
-                                if (tag == ctor_info_tag(alt_core_ctor_info(a)).get_small_value()) {
-                                    b = alt_core_ctor_cont(a);
-                                    goto done;
-                                }
-                                break;
-                            case alt_core_kind::Default:
-                                b = alt_core_default_cont(a);
-                                goto done;
-                        }
-                    }
-                    throw exception("incomplete case");
-                    done: break;
+            }
+            var(bp, pc[1]) = o;
+            pc += 8 + n;
+            LEAN_BC_DISPATCH();
+        }
+        LEAN_BC_OP(Proj) { // object field access
+            var(bp, pc[1]) = cnstr_get(var(bp, pc[2]).m_obj, pc[3]);
+            pc += 4;
+            LEAN_BC_DISPATCH();
+        }
+        LEAN_BC_OP(UProj) { // USize field access
+            var(bp, pc[1]) = cnstr_get_usize(var(bp, pc[2]).m_obj, pc[3]);
+            pc += 4;
+            LEAN_BC_DISPATCH();
+        }
+        LEAN_BC_OP(SProj) { // other unboxed field access
+            object * o = var(bp, pc[2]).m_obj;
+            unsigned offset = pc[3];
+            value r;
+            switch (static_cast<type>(pc[4])) {
+                case type::Float: r = value::from_float(cnstr_get_float(o, offset)); break;
+                case type::UInt8: r = cnstr_get_uint8(o, offset); break;
+                case type::UInt16: r = cnstr_get_uint16(o, offset); break;
+                case type::UInt32: r = cnstr_get_uint32(o, offset); break;
+                case type::UInt64: r = cnstr_get_uint64(o, offset); break;
+                default: lean_unreachable();
+            }
+            var(bp, pc[1]) = r;
+            pc += 5;
+            LEAN_BC_DISPATCH();
+        }
+        LEAN_BC_OP(FAp) { // satured ("full") application of top-level function
+            uint32 n = pc[3];
+            value r = call(get_callee(bc, pc[2]), n, pc + 4, bp);
+            var(bp, pc[1]) = r;
+            pc += 4 + n;
+            LEAN_BC_DISPATCH();
+        }
+        LEAN_BC_OP(Load) { // nullary function ("constant")
+            value r = load(get_callee(bc, pc[2]), static_cast<type>(pc[3]));
+            var(bp, pc[1]) = r;
+            pc += 4;
+            LEAN_BC_DISPATCH();
+        }
+        LEAN_BC_OP(TailCall) {
+            // argument and parameter slots may overlap, so first copy arguments to a temporary buffer
+            uint32 n = pc[1];
+            value * args = static_cast<value *>(LEAN_ALLOCA(n * sizeof(value))); // NOLINT
+            for (uint32 i = 0; i < n; i++) {
+                args[i] = eval_arg(bp, pc[2 + i]);
+            }
+            for (uint32 i = 0; i < n; i++) {
+                var(bp, i) = args[i];
+            }
+            pc = code;
+            check_system();
+            LEAN_BC_DISPATCH();
+        }
+        LEAN_BC_OP(PAp) { // unsatured (partial) application of top-level function
+            fn_info & fn = get_callee(bc, pc[2]);
+            uint32 n = pc[3];
+            object * cls;
+            if (fn.m_addr) {
+                // point closure directly at native symbol
+                cls = alloc_closure(fn.m_addr, fn.m_arity, n);
+                for (uint32 i = 0; i < n; i++) {
+                    closure_set(cls, i, eval_arg(bp, pc[4 + i]).m_obj);
                 }
-                case fn_body_kind::Ret:
-                    return eval_arg(fn_body_ret_arg(b));
-                case fn_body_kind::Jmp: { // jump to join-point
-                    fn_body const & jp = *m_jp_stack[get_frame().m_jp_bp + fn_body_jmp_jp(b).get_small_value()];
-                    lean_assert(fn_body_jdecl_params(jp).size() == fn_body_jmp_args(b).size());
-                    for (size_t i = 0; i < fn_body_jdecl_params(jp).size(); i++) {
-                        var(param_var(fn_body_jdecl_params(jp)[i])) = eval_arg(fn_body_jmp_args(b)[i]);
-                    }
-                    b = fn_body_jdecl_body(jp);
-                    break;
+            } else {
+                // point closure at interpreter stub
+                object ** args = static_cast<object **>(LEAN_ALLOCA(n * sizeof(object *))); // NOLINT
+                for (uint32 i = 0; i < n; i++) {
+                    args[i] = eval_arg(bp, pc[4 + i]).m_obj;
                 }
-                case fn_body_kind::Unreachable:
-                    throw exception("unreachable code");
+                cls = mk_stub_closure(fn.m_decl, n, args);
+            }
+            var(bp, pc[1]) = cls;
+            pc += 4 + n;
+            LEAN_BC_DISPATCH();
+        }
+        LEAN_BC_OP(Ap) { // (saturated or unsatured) application of closure; mostly handled by runtime
+            uint32 n = pc[3];
+            object ** args = static_cast<object **>(LEAN_ALLOCA(n * sizeof(object *))); // NOLINT
+            for (uint32 i = 0; i < n; i++) {
+                args[i] = eval_arg(bp, pc[4 + i]).m_obj;
+            }
+            object * r = apply_n(var(bp, pc[2]).m_obj, n, args);
+            var(bp, pc[1]) = r;
+            pc += 4 + n;
+            LEAN_BC_DISPATCH();
+        }
+        LEAN_BC_OP(Box) { // box unboxed value
+            var(bp, pc[1]) = box_t(var(bp, pc[2]), static_cast<type>(pc[3]));
+            pc += 4;
+            LEAN_BC_DISPATCH();
+        }
+        LEAN_BC_OP(Unbox) { // unbox boxed value
+            var(bp, pc[1]) = unbox_t(var(bp, pc[2]).m_obj, static_cast<type>(pc[3]));
+            pc += 4;
+            LEAN_BC_DISPATCH();
+        }
+        LEAN_BC_OP(Imm) { // load unboxed literal
+            var(bp, pc[1]) = bc.m_imms[pc[2]];
+            pc += 3;
+            LEAN_BC_DISPATCH();
+        }
+        LEAN_BC_OP(Lit) { // load `nat` or string literal
+            object * o = bc.m_lits[pc[2]].raw();
+            inc(o);
+            var(bp, pc[1]) = o;
+            pc += 3;
+            LEAN_BC_DISPATCH();
+        }
+        LEAN_BC_OP(IsShared) {
+            var(bp, pc[1]) = static_cast<uint64>(!is_exclusive(var(bp, pc[2]).m_obj));
+            pc += 3;
+            LEAN_BC_DISPATCH();
+        }
+        LEAN_BC_OP(IsTaggedPtr) {
+            var(bp, pc[1]) = static_cast<uint64>(!is_scalar(var(bp, pc[2]).m_obj));
+            pc += 3;
+            LEAN_BC_DISPATCH();
+        }
+        LEAN_BC_OP(Set) { // set boxed field of unique reference
+            object * o = var(bp, pc[1]).m_obj;
+            lean_assert(is_exclusive(o));
+            cnstr_set(o, pc[2], eval_arg(bp, pc[3]).m_obj);
+            pc += 4;
+            LEAN_BC_DISPATCH();
+        }
+        LEAN_BC_OP(SetTag) { // set constructor tag of unique reference
+            object * o = var(bp, pc[1]).m_obj;
+            lean_assert(is_exclusive(o));
+            cnstr_set_tag(o, pc[2]);
+            pc += 3;
+            LEAN_BC_DISPATCH();
+        }
+        LEAN_BC_OP(USet) { // set USize field of unique reference
+            object * o = var(bp, pc[1]).m_obj;
+            lean_assert(is_exclusive(o));
+            cnstr_set_usize(o, pc[2], var(bp, pc[3]).m_num);
+            pc += 4;
+            LEAN_BC_DISPATCH();
+        }
+        LEAN_BC_OP(SSet) { // set other unboxed field of unique reference
+            object * o = var(bp, pc[1]).m_obj;
+            unsigned offset = pc[2];
+            value v = var(bp, pc[3]);
+            lean_assert(is_exclusive(o));
+            switch (static_cast<type>(pc[4])) {
+                case type::Float: cnstr_set_float(o, offset, v.m_float); break;
+                case type::UInt8: cnstr_set_uint8(o, offset, v.m_num); break;
+                case type::UInt16: cnstr_set_uint16(o, offset, v.m_num); break;
+                case type::UInt32: cnstr_set_uint32(o, offset, v.m_num); break;
+                case type::UInt64: cnstr_set_uint64(o, offset, v.m_num); break;
+                default: lean_unreachable();
             }
+            pc += 5;
+            LEAN_BC_DISPATCH();
+        }
+        LEAN_BC_OP(Inc) { // increment reference counter
+            inc(var(bp, pc[1]).m_obj, pc[2]);
+            pc += 3;
+            LEAN_BC_DISPATCH();
+        }
+        LEAN_BC_OP(Dec) { // decrement reference counter
+            uint32 n = pc[2];
+            for (uint32 i = 0; i < n; i++) {
+                dec(var(bp, pc[1]).m_obj);
+            }
+            pc += 3;
+            LEAN_BC_DISPATCH();
+        }
+        LEAN_BC_OP(Del) { // delete object of unique reference
+            lean_free_object(var(bp, pc[1]).m_obj);
+            pc += 2;
+            LEAN_BC_DISPATCH();
+        }
+        LEAN_BC_OP(Case) { // branch according to constructor tag
+            value v = var(bp, pc[1]);
+            unsigned tag = pc[2] ? static_cast<unsigned>(v.m_num) : lean_obj_tag(v.m_obj);
+            uint32 n = pc[3];
+            uint32 label = tag < n ? pc[4 + tag] : g_no_label;
+            if (label == g_no_label)
+                label = pc[4 + n];
+            if (label == g_no_label)
+                throw exception("incomplete case");
+            pc = code + label;
+            LEAN_BC_DISPATCH();
+        }
+        LEAN_BC_OP(Ret) {
+            return eval_arg(bp, pc[1]);
+        }
+        LEAN_BC_OP(Jmp) { // jump to join point, assigning its parameters
+            uint32 n = pc[1];
+            for (uint32 i = 0; i < n; i++) {
+                var(bp, pc[2 + 2*i]) = eval_arg(bp, pc[3 + 2*i]);
+            }
+            pc = code + pc[2 + 2*n];
+            LEAN_BC_DISPATCH();
+        }
+        LEAN_BC_OP(Unreachable) {
+            throw exception("unreachable code");
         }
+        LEAN_BC_OP(Error) {
+            throw exception(bc.m_errors[pc[1]]);
+        }
+        LEAN_BC_END()
+        lean_unreachable();
     }
 
+#undef LEAN_BC_BEGIN
+#undef LEAN_BC_OP
+#undef LEAN_BC_GOTO
+#undef LEAN_BC_END
+#undef LEAN_BC_DISPATCH
+
     // specify argument base pointer explicitly because we've usually already pushed some function arguments
-    void push_frame(decl const & d, size_t arg_bp) {
+    void push_frame(fn_info const & fn, size_t arg_bp) {
         DEBUG_CODE({
             lean_trace(name({"interpreter", "call"}),
                        tout() << std::string(m_call_stack.size(), ' ')
-                              << decl_fun_id(d);
+                              << fn.m_name;
                        for (size_t i = arg_bp; i < m_arg_stack.size(); i++) {
-                           tout() << " "; print_value(tout(), m_arg_stack[i], param_type(decl_params(d)[i - arg_bp]));
+                           tout() << " "; print_value(tout(), m_arg_stack[i], fn.m_param_types[i - arg_bp]);
                        }
                        tout() << "\n";);
         });
-        m_call_stack.emplace_back(decl_fun_id(d), arg_bp, m_jp_stack.size());
+        m_call_stack.emplace_back(&fn, arg_bp);
     }
 
     void pop_frame(value DEBUG_CODE(r), type DEBUG_CODE(t)) {
         m_arg_stack.resize(get_frame().m_arg_bp);
-        m_jp_stack.resize(get_frame().m_jp_bp);
         m_call_stack.pop_back();
         DEBUG_CODE({
             lean_trace(name({"interpreter", "call"}),
@@ -721,92 +1231,60 @@ private:
        });
     }
 
-    /** \brief Return cached lookup result for given unmangled function name in the current binary. */
-    symbol_cache_entry lookup_symbol(name const & fn) {
-        if (symbol_cache_entry const * e = m_symbol_cache.find(fn)) {
-            return *e;
-        } else {
-            symbol_cache_entry e_new { get_decl(fn), nullptr, false };
-            if (m_prefer_native || decl_tag(e_new.m_decl) == decl_kind::Extern || has_init_attribute(m_env, fn)) {
-                string_ref mangled = name_mangle(fn, *g_mangle_prefix);
-                string_ref boxed_mangled(string_append(mangled.to_obj_arg(), g_boxed_mangled_suffix->raw()));
-                // check for boxed version first
-                if (void *p_boxed = lookup_symbol_in_cur_exe(boxed_mangled.data())) {
-                    e_new.m_addr = p_boxed;
-                    e_new.m_boxed = true;
-                } else if (void *p = lookup_symbol_in_cur_exe(mangled.data())) {
-                    // if there is no boxed version, there are no unboxed parameters, so use default version
-                    e_new.m_addr = p;
-                }
-            }
-            m_symbol_cache.insert(fn, e_new);
-            return e_new;
-        }
-    }
-
-    /** \brief Retrieve Lean declaration from environment. */
-    decl get_decl(name const & fn) {
-        option_ref<decl> d = find_ir_decl(m_env, fn);
-        if (!d) {
-            throw exception(sstream() << "unknown declaration '" << fn << "'");
-        }
-        return d.get().value();
-    }
-
     /** \brief Evaluate nullary function ("constant"). */
-    value load(name const & fn, type t) {
-        if (constant_cache_entry const * cached = m_constant_cache.find(fn)) {
-            if (!cached->m_is_scalar) {
-                inc(cached->m_val.m_obj);
+    value load(fn_info & fn, type t) {
+        auto it = m_constant_cache.find(&fn);
+        if (it != m_constant_cache.end()) {
+            if (!it->second.m_is_scalar) {
+                inc(it->second.m_val.m_obj);
             }
-            return cached->m_val;
+            return it->second.m_val;
         }
-        if (object * const * o = g_init_globals->find(fn)) {
+        if (object * const * o = g_init_globals->find(fn.m_name)) {
             // persistent, so no `inc` needed
             return *o;
         }
 
-        if (get_regular_init_fn_name_for(m_env, fn)) {
+        if (get_regular_init_fn_name_for(m_env, fn.m_name)) {
             // We don't know whether `[init]` decls can be re-executed, so let's not.
-            throw exception(sstream() << "cannot evaluate `[init]` declaration '" << fn << "' in the same module");
+            throw exception(sstream() << "cannot evaluate `[init]` declaration '" << fn.m_name << "' in the same module");
         }
-        symbol_cache_entry e = lookup_symbol(fn);
-        if (e.m_addr) {
+        if (fn.m_addr) {
             // constants do not have boxed wrappers, but we'll survive
             switch (t) {
-                case type::Float: return value::from_float(*static_cast<double *>(e.m_addr));
-                case type::UInt8: return *static_cast<uint8 *>(e.m_addr);
-                case type::UInt16: return *static_cast<uint16 *>(e.m_addr);
-                case type::UInt32: return *static_cast<uint32 *>(e.m_addr);
-                case type::UInt64: return *static_cast<uint64 *>(e.m_addr);
-                case type::USize: return *static_cast<size_t *>(e.m_addr);
+                case type::Float: return value::from_float(*static_cast<double *>(fn.m_addr));
+                case type::UInt8: return *static_cast<uint8 *>(fn.m_addr);
+                case type::UInt16: return *static_cast<uint16 *>(fn.m_addr);
+                case type::UInt32: return *static_cast<uint32 *>(fn.m_addr);
+                case type::UInt64: return *static_cast<uint64 *>(fn.m_addr);
+                case type::USize: return *static_cast<size_t *>(fn.m_addr);
                 case type::Object:
                 case type::TObject:
                 case type::Irrelevant:
-                    return *static_cast<object **>(e.m_addr);
+                    return *static_cast<object **>(fn.m_addr);
             }
+            lean_unreachable();
         } else {
-            push_frame(e.m_decl, m_arg_stack.size());
-            value r = eval_body(decl_fun_body(e.m_decl));
-            pop_frame(r, decl_type(e.m_decl));
+            size_t bp = m_arg_stack.size();
+            push_frame(fn, bp);
+            value r = exec(fn, bp);
+            pop_frame(r, fn.m_type);
             if (!type_is_scalar(t)) {
                 inc(r.m_obj);
             }
-            m_constant_cache.insert(fn, constant_cache_entry { type_is_scalar(t), r });
+            m_constant_cache.insert(mk_pair(&fn, constant_cache_entry { type_is_scalar(t), r }));
             return r;
         }
     }
 
-    value call(name const & fn, array_ref<arg> const & args) {
+    value call(fn_info & fn, unsigned n, uint32 const * args, size_t bp) {
         size_t old_size = m_arg_stack.size();
         value r;
-        symbol_cache_entry e = lookup_symbol(fn);
-        if (e.m_addr) {
-            object ** args2 = static_cast<object **>(LEAN_ALLOCA(args.size() * sizeof(object *))); // NOLINT
-            for (size_t i = 0; i < args.size(); i++) {
-                type t = param_type(decl_params(e.m_decl)[i]);
-                args2[i] = box_t(eval_arg(args[i]), t);
-                if (e.m_boxed && param_borrow(decl_params(e.m_decl)[i])) {
+        if (fn.m_addr) {
+            object ** args2 = static_cast<object **>(LEAN_ALLOCA(n * sizeof(object *))); // NOLINT
+            for (unsigned i = 0; i < n; i++) {
+                args2[i] = box_t(eval_arg(bp, args[i]), fn.m_param_types[i]);
+                if (fn.m_boxed && fn.m_param_borrow[i]) {
                     // NOTE: If we chose the boxed version where the IR chose the unboxed one, we need to manually increment
                     // originally borrowed parameters because the wrapper will decrement these after the call.
                     // Basically the wrapper is more homogeneous (removing both unboxed and borrowed parameters) than we
@@ -814,41 +1292,42 @@ private:
                     inc(args2[i]);
                 }
             }
-            push_frame(e.m_decl, old_size);
-            object * o = curry(e.m_addr, args.size(), args2);
-            type t = decl_type(e.m_decl);
-            if (type_is_scalar(t)) {
-                lean_assert(e.m_boxed);
+            push_frame(fn, old_size);
+            object * o = curry(fn.m_addr, n, args2);
+            if (type_is_scalar(fn.m_type)) {
+                lean_assert(fn.m_boxed);
                 // NOTE: this unboxing does not exist in the IR, so we should manually consume `o`
-                r = unbox_t(o, t);
+                r = unbox_t(o, fn.m_type);
                 lean_dec(o);
             } else {
                 r = o;
             }
         } else {
-            if (decl_tag(e.m_decl) == decl_kind::Extern) {
-                throw exception(sstream() << "could not find native implementation of external declaration '" << fn << "'");
+            if (decl_tag(fn.m_decl) == decl_kind::Extern) {
+                throw exception(sstream() << "could not find native implementation of external declaration '" << fn.m_name << "'");
             }
             // evaluate args in old stack frame
-            for (const auto & arg : args) {
-                m_arg_stack.push_back(eval_arg(arg));
+            for (unsigned i = 0; i < n; i++) {
+                value v = eval_arg(bp, args[i]);
+                m_arg_stack.push_back(v);
             }
-            push_frame(e.m_decl, old_size);
-            r = eval_body(decl_fun_body(e.m_decl));
+            push_frame(fn, old_size);
+            r = exec(fn, old_size);
         }
-        pop_frame(r, decl_type(e.m_decl));
+        pop_frame(r, fn.m_type);
         return r;
     }
 
     // closure stub
     object * stub_m(object ** args) {
         decl d(args[2]);
+        fn_info & fn = m_code_cache->get(decl_fun_id(d));
         size_t old_size = m_arg_stack.size();
-        for (size_t i = 0; i < decl_params(d).size(); i++) {
+        for (size_t i = 0; i < fn.m_arity; i++) {
             m_arg_stack.push_back(args[3 + i]);
         }
-        push_frame(d, old_size);
-        object * r = eval_body(decl_fun_body(d)).m_obj;
+        push_frame(fn, old_size);
+        object * r = exec(fn, old_size).m_obj;
         pop_frame(r, type::TObject);
         return r;
     }
@@ -905,14 +1384,19 @@ private:
 public:
     explicit interpreter(environment const & env, options const & opts) : m_env(env), m_opts(opts) {
         m_prefer_native = opts.get_bool(*g_interpreter_prefer_native, LEAN_DEFAULT_INTERPRETER_PREFER_NATIVE);
+        m_code_cache = get_code_cache(env, m_prefer_native);
     }
 
     ~interpreter() {
-        for_each(m_constant_cache, [](name const &, constant_cache_entry const & e) {
-            if (!e.m_is_scalar) {
-                dec(e.m_val.m_obj);
+        for (auto const & p : m_constant_cache) {
+            if (!p.second.m_is_scalar) {
+                dec(p.second.m_val.m_obj);
             }
-        });
+        }
+        // `with_interpreter` has already restored `g_interpreter`, so this is the outermost interpreter of the thread
+        // if it is `nullptr`. We must not keep the environment alive after that.
+        if (!g_interpreter)
+            get_code_cache_slot().reset();
     }
 
     /** A variant of `call` designed for external uses.
@@ -920,19 +1404,18 @@ public:
      *  * supports under- and over-application.
      *  * supports "calling" (evaluating) nullary constants. */
     object * call_boxed(name const & fn, unsigned n, object ** args) {
-        symbol_cache_entry e = lookup_symbol(fn);
-        unsigned arity = decl_params(e.m_decl).size();
+        fn_info & e = m_code_cache->get(fn);
         object * r;
-        if (arity == 0) {
-            r = box_t(load(fn, decl_type(e.m_decl)), decl_type(e.m_decl));
+        if (e.m_arity == 0) {
+            r = box_t(load(e, e.m_type), e.m_type);
         } else {
             // First allocate a closure with zero fixed parameters. This is slightly wasteful in the under-application
             // case, but simpler to handle.
             if (e.m_addr) {
-                // `lookup_symbol` always prefers the boxed version for compiled functions, so nothing to do here
-                r = alloc_closure(e.m_addr, arity, 0);
+                // `code_cache::get` always prefers the boxed version for compiled functions, so nothing to do here
+                r = alloc_closure(e.m_addr, e.m_arity, 0);
             } else {
-                // `lookup_symbol` does not prefer the boxed version for interpreted functions, so check manually.
+                // `code_cache::get` does not prefer the boxed version for interpreted functions, so check manually.
                 decl d = e.m_decl;
                 if (option_ref<decl> d_boxed = find_ir_decl(m_env, fn + *g_boxed_suffix)) {
                     d = *d_boxed.get();
@@ -947,7 +1430,7 @@ public:
     }
 
     uint32 run_main(int argc, char * argv[]) {
-        decl d = get_decl("main");
+        decl d = m_code_cache->get_decl("main");
         array_ref<param> const & params = decl_params(d);
         buffer<object *> args;
         if (params.size() == 2) { // List String -> IO UInt32
@@ -988,7 +1471,7 @@ public:
                 object * o = io_result_get_value(r);
                 mark_persistent(o);
                 dec_ref(r);
-                symbol_cache_entry e = lookup_symbol(decl);
+                fn_info & e = m_code_cache->get(decl);
                 if (e.m_addr) {
                     *((object **)e.m_addr) = o;
                 } else {
@@ -6,12 +6,19 @@ Authors: Leonardo de Moura, Gabriel Ebner, Sebastian Ullrich
 */
 #include <unordered_map>
 #include <vector>
+#include <memory>
 #include <utility>
 #include <string>
 #include <sstream>
 #include <fstream>
 #include <algorithm>
 #include <sys/stat.h>
+#if !defined(LEAN_WINDOWS) && !defined(LEAN_EMSCRIPTEN)
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#define LEAN_MMAP_OLEAN
+#endif
 #include <lean/thread.h>
 #include <lean/interrupt.h>
 #include <lean/sstream.h>
@@ -22,10 +29,12 @@ Authors: Leonardo de Moura, Gabriel Ebner, Sebastian Ullrich
 #include "util/buffer.h"
 #include "util/name_map.h"
 #include "util/file_lock.h"
+#include "util/lz.h"
 #include "library/module.h"
 #include "library/constants.h"
 #include "library/time_task.h"
 #include "library/util.h"
+#include "util/option_declarations.h"
 
 #if defined(__has_feature)
 #if __has_feature(address_sanitizer)
@@ -33,76 +42,353 @@ Authors: Leonardo de Moura, Gabriel Ebner, Sebastian Ullrich
 #endif
 #endif
 
+#ifndef LEAN_DEFAULT_OLEAN_COMPRESS
+#define LEAN_DEFAULT_OLEAN_COMPRESS false
+#endif
+
 namespace lean {
-// manually padded to multiple of word size, see `initialize_module`
-static char const * g_olean_header   = "oleanfile!!!!!!!";
+enum olean_flags : uint8 {
+    // The compacted data is split into blocks of `m_block_size` bytes that are compressed independently with `lz_compress`.
+    // The header is followed by a table of the compressed block sizes (`uint32` each) and the compressed blocks.
+    olean_compressed = 1
+};
+
+/* Header of .olean files. Unless the file is compressed, the compacted object graph follows the header. */
+struct olean_header {
+    // 5 bytes: "olean"
+    char    m_marker[5] = {'o', 'l', 'e', 'a', 'n'};
+    // 1 byte: format version, incremented whenever the layout of the header or the compacted data changes
+    uint8   m_version = 2;
+    // 1 byte: `olean_flags`
+    uint8   m_flags = 0;
+    // 1 byte: padding, must be zero
+    char    m_padding = 0;
+    // Address at which the beginning of the file (including the header) should be mapped.
+    // When the file is mapped at this address, the data can be used without any pointer fix-up.
+    // `0` if the file should always be relocated.
+    size_t  m_base_addr = 0;
+    // Hash of the uncompressed compacted data, see `olean_data_hash`. Build tools can use it to check whether a module
+    // changed by reading only the header.
+    uint64  m_data_hash = 0;
+    // Size of the uncompressed compacted data.
+    uint64  m_data_size = 0;
+    // Size of the uncompressed blocks if the file is compressed, `0` otherwise.
+    uint32  m_block_size = 0;
+    // 4 bytes: padding, must be zero
+    uint32  m_padding2 = 0;
+};
+static_assert(sizeof(olean_header) % sizeof(void*) == 0, "olean_header must be padded to a multiple of the word size");
+
+static bool is_valid_olean_header(olean_header const & h) {
+    olean_header expected;
+    return memcmp(h.m_marker, expected.m_marker, sizeof(h.m_marker)) == 0 && h.m_version == expected.m_version &&
+        (h.m_flags & ~olean_compressed) == 0 && (!(h.m_flags & olean_compressed) || h.m_block_size > 0);
+}
+
+static uint64 olean_data_hash(char const * data, size_t size) {
+    return hash_str64(size, data, 11);
+}
+
+/* Uncompressed size of the blocks of compressed .olean files. */
+static constexpr uint32 g_olean_block_size = 1024 * 1024;
+static atomic<bool> g_olean_compression(false);
+static name * g_olean_compress = nullptr;
+
+void set_olean_compression(bool flag) {
+    g_olean_compression = flag;
+}
+
+bool get_olean_compress(options const & opts) {
+    return opts.get_bool(*g_olean_compress, LEAN_DEFAULT_OLEAN_COMPRESS);
+}
+
+/* Compress `data[0, size)` block by block and write it to `out`, followed by the block table. We compress into a single
+   block-sized buffer, so the compressed file is never held in memory completely. */
+static void write_compressed_olean_data(std::ofstream & out, char const * data, size_t size) {
+    size_t num_blocks = (size + g_olean_block_size - 1) / g_olean_block_size;
+    std::vector<uint32> block_sizes(num_blocks, 0);
+    std::streampos table_pos = out.tellp();
+    // reserve space for the block table, it is filled in at the end
+    out.write(reinterpret_cast<char const *>(block_sizes.data()), num_blocks * sizeof(uint32));
+    std::vector<char> buffer(lz_compress_bound(g_olean_block_size));
+    for (size_t i = 0; i < num_blocks; i++) {
+        size_t offset = i * g_olean_block_size;
+        size_t sz     = lz_compress(data + offset, std::min<size_t>(g_olean_block_size, size - offset), buffer.data());
+        block_sizes[i] = sz;
+        out.write(buffer.data(), sz);
+    }
+    out.seekp(table_pos);
+    out.write(reinterpret_cast<char const *>(block_sizes.data()), num_blocks * sizeof(uint32));
+    out.seekp(0, out.end);
+}
+
+/* Return an address for mapping the .olean file `olean_fn`. The address is derived from the file name so that
+   different modules are likely to be assigned disjoint address ranges. A bad choice only prevents `mmap` from
+   being used for this file, the module can still be imported by relocating it. */
+static size_t get_olean_base_addr(std::string const & olean_fn) {
+#if defined(LEAN_MMAP_OLEAN)
+    if (sizeof(void*) == 8) {
+        // Use 30 bits of the hash, aligned to 64KB, i.e., the address is in [0, 2^46), which is
+        // safely in the lower half of the 47-bit x86-64 user space.
+        size_t h = hash_str(olean_fn.size(), olean_fn.c_str(), 11) & ((1u << 30) - 1);
+        // Avoid the first 4GB where the program itself is usually mapped.
+        if (h < (1u << 16)) h += (1u << 16);
+        return h << 16;
+    }
+#endif
+    return 0;
+}
 
 extern "C" object * lean_save_module_data(object * fname, object * mdata, object *) {
     std::string olean_fn(string_cstr(fname));
+    // We write to a temporary file and then rename it, so that processes that have mapped the previous
+    // version of the file into memory are not affected.
+    std::string olean_tmp_fn = olean_fn + ".tmp";
     object_ref mdata_ref(mdata);
     try {
         exclusive_file_lock output_lock(olean_fn);
-        std::ofstream out(olean_fn, std::ios_base::binary);
+        std::ofstream out(olean_tmp_fn, std::ios_base::binary);
         if (out.fail()) {
             return io_result_mk_error((sstream() << "failed to create file '" << olean_fn << "'").str());
         }
-        object_compactor compactor;
+        olean_header header;
+        header.m_base_addr = get_olean_base_addr(olean_fn);
+        object_compactor compactor(reinterpret_cast<void *>(header.m_base_addr + sizeof(olean_header)));
         compactor(mdata_ref.raw());
-        out.write(g_olean_header, strlen(g_olean_header));
-        out.write(static_cast<char const *>(compactor.data()), compactor.size());
+        char const * data  = static_cast<char const *>(compactor.data());
+        header.m_data_size = compactor.size();
+        header.m_data_hash = olean_data_hash(data, compactor.size());
+        if (g_olean_compression) {
+            header.m_flags     |= olean_compressed;
+            header.m_block_size = g_olean_block_size;
+        }
+        out.write(reinterpret_cast<char const *>(&header), sizeof(header));
+        if (header.m_flags & olean_compressed)
+            write_compressed_olean_data(out, data, compactor.size());
+        else
+            out.write(data, compactor.size());
         out.close();
+#if defined(LEAN_WINDOWS)
+        std::remove(olean_fn.c_str());
+#endif
+        if (out.fail() || std::rename(olean_tmp_fn.c_str(), olean_fn.c_str()) != 0) {
+            std::remove(olean_tmp_fn.c_str());
+            return io_result_mk_error((sstream() << "failed to write '" << olean_fn << "'").str());
+        }
         return io_result_mk_ok(box(0));
     } catch (exception & ex) {
         return io_result_mk_error((sstream() << "failed to write '" << olean_fn << "': " << ex.what()).str());
     }
 }
 
+#if defined(LEAN_MMAP_OLEAN)
+/* Try to map the whole .olean file at the base address stored in its header. Return `nullptr` if the
+   address is not available. The mapping is read-only and private, so the pages are shared by all
+   processes that import the same module. */
+static compacted_region * mmap_module_data(std::string const & olean_fn, size_t size, char * base_addr) {
+    int fd = open(olean_fn.c_str(), O_RDONLY);
+    if (fd == -1)
+        return nullptr;
+    void * addr = mmap(base_addr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED)
+        return nullptr;
+    if (addr != base_addr) {
+        munmap(addr, size);
+        return nullptr;
+    }
+    char * data = base_addr + sizeof(olean_header);
+    return new compacted_region(size - sizeof(olean_header), data, data, [=]() { munmap(base_addr, size); });
+}
+#endif
+
+/* Decompress the blocks of a compressed .olean file. `in` points to the block table. Return `false` if the data is
+   malformed. Remark: we decompress in the calling thread, `lean_read_module_data_parallel` already reads different
+   files in parallel using the task manager. */
+static bool decompress_olean_data(olean_header const & header, char const * in, size_t in_size, char * out) {
+    size_t num_blocks = (header.m_data_size + header.m_block_size - 1) / header.m_block_size;
+    if (in_size / sizeof(uint32) < num_blocks)
+        return false;
+    std::vector<uint32> block_sizes(num_blocks);
+    memcpy(block_sizes.data(), in, num_blocks * sizeof(uint32));
+    std::vector<size_t> block_offsets(num_blocks);
+    size_t offset = num_blocks * sizeof(uint32);
+    for (size_t i = 0; i < num_blocks; i++) {
+        block_offsets[i] = offset;
+        offset += block_sizes[i];
+        if (offset > in_size)
+            return false;
+    }
+    if (offset != in_size)
+        return false;
+    for (size_t i = 0; i < num_blocks; i++) {
+        size_t out_offset = i * header.m_block_size;
+        size_t out_size   = std::min<size_t>(header.m_block_size, header.m_data_size - out_offset);
+        if (!lz_decompress(in + block_offsets[i], block_sizes[i], out + out_offset, out_size))
+            return false;
+    }
+    return true;
+}
+
+/* Read the header of the .olean file `olean_fn` and store the size of the file in `size`.
+   Return an error message on failure. */
+static optional<std::string> read_olean_header(std::ifstream & in, std::string const & olean_fn, olean_header & header, size_t & size) {
+    if (in.fail()) {
+        return optional<std::string>((sstream() << "failed to open file '" << olean_fn << "'").str());
+    }
+    /* Get file size */
+    in.seekg(0, in.end);
+    size = in.tellg();
+    in.seekg(0);
+    if (size >= sizeof(olean_header))
+        in.read(reinterpret_cast<char *>(&header), sizeof(header));
+    if (size < sizeof(olean_header) || !in || !is_valid_olean_header(header)) {
+        return optional<std::string>((sstream() << "failed to read file '" << olean_fn << "', invalid header").str());
+    }
+    if (!(header.m_flags & olean_compressed) && size - sizeof(olean_header) != header.m_data_size) {
+        return optional<std::string>((sstream() << "failed to read file '" << olean_fn << "', file is truncated").str());
+    }
+    return optional<std::string>();
+}
+
+/* Allocate the buffer for the compacted data of a module. The size is read from the .olean file, so it may be
+   arbitrarily large. We use `malloc` here as expected by `compacted_region`. */
+static char * alloc_olean_buffer(size_t size) {
+    char * buffer = static_cast<char *>(malloc(size));
+    if (buffer == nullptr)
+        throw exception(sstream() << "out of memory, failed to allocate " << size << " bytes");
+    return buffer;
+}
+
 extern "C" object * lean_read_module_data(object * fname, object *) {
     std::string olean_fn(string_cstr(fname));
     try {
         shared_file_lock olean_lock(olean_fn);
         std::ifstream in(olean_fn, std::ios_base::binary);
-        if (in.fail()) {
-            return io_result_mk_error((sstream() << "failed to open file '" << olean_fn << "'").str());
-        }
-        /* Get file size */
-        in.seekg(0, in.end);
-        size_t size = in.tellg();
-        in.seekg(0);
-        size_t header_size = strlen(g_olean_header);
-        if (size < header_size) {
-            return io_result_mk_error((sstream() << "failed to read file '" << olean_fn << "', invalid header").str());
+        olean_header header;
+        size_t size;
+        if (optional<std::string> error = read_olean_header(in, olean_fn, header, size)) {
+            return io_result_mk_error(*error);
         }
-        char * header = new char[header_size];
-        in.read(header, header_size);
-        if (strncmp(header, g_olean_header, header_size) != 0) {
-            return io_result_mk_error((sstream() << "failed to read file '" << olean_fn << "', invalid header").str());
+        char * base_addr = reinterpret_cast<char *>(header.m_base_addr);
+        void * data_base_addr = reinterpret_cast<void *>(header.m_base_addr + sizeof(olean_header));
+        /* The region owns the mapped or allocated data. It is only released to the Lean object at the end,
+           so that it is freed on every error path. */
+        std::unique_ptr<compacted_region> region;
+        if (header.m_flags & olean_compressed) {
+            std::vector<char> compressed(size - sizeof(olean_header));
+            in.read(compressed.data(), compressed.size());
+            char * buffer = alloc_olean_buffer(header.m_data_size);
+            region.reset(new compacted_region(header.m_data_size, buffer, data_base_addr, [=]() { free(buffer); }));
+            if (!in || !decompress_olean_data(header, compressed.data(), compressed.size(), buffer)) {
+                return io_result_mk_error((sstream() << "failed to read file '" << olean_fn << "', invalid compressed data").str());
+            }
+            if (olean_data_hash(buffer, header.m_data_size) != header.m_data_hash) {
+                return io_result_mk_error((sstream() << "failed to read file '" << olean_fn << "', checksum mismatch").str());
+            }
         }
-        delete[] header;
-        // use `malloc` here as expected by `compacted_region`
-        char * buffer = static_cast<char *>(malloc(size - header_size));
-        in.read(buffer, size - header_size);
-        if (!in) {
-            return io_result_mk_error((sstream() << "failed to read file '" << olean_fn << "'").str());
+#if defined(LEAN_MMAP_OLEAN)
+        if (!region && base_addr != nullptr)
+            region.reset(mmap_module_data(olean_fn, size, base_addr));
+#endif
+        if (!region) {
+            char * buffer = alloc_olean_buffer(header.m_data_size);
+            region.reset(new compacted_region(header.m_data_size, buffer, data_base_addr, [=]() { free(buffer); }));
+            in.read(buffer, header.m_data_size);
+            if (!in) {
+                return io_result_mk_error((sstream() << "failed to read file '" << olean_fn << "'").str());
+            }
         }
         in.close();
-        compacted_region * region = new compacted_region(size - header_size, buffer);
+        object * mod = region->read();
+        object * mod_region = alloc_cnstr(0, 2, 0);
+        cnstr_set(mod_region, 0, mod);
+        cnstr_set(mod_region, 1, box_size_t(reinterpret_cast<size_t>(region.get())));
 #if defined(__has_feature)
 #if __has_feature(address_sanitizer)
         // do not report as leak
-        __lsan_ignore_object(region);
+        __lsan_ignore_object(region.get());
 #endif
 #endif
-        object * mod = region->read();
-        object * mod_region = alloc_cnstr(0, 2, 0);
-        cnstr_set(mod_region, 0, mod);
-        cnstr_set(mod_region, 1, box_size_t(reinterpret_cast<size_t>(region)));
+        region.release();
         return io_result_mk_ok(mod_region);
     } catch (exception & ex) {
         return io_result_mk_error((sstream() << "failed to read '" << olean_fn << "': " << ex.what()).str());
     }
 }
 
+/*
+@[extern 2 "lean_read_module_data_hash"]
+constant readModuleDataHash (fname : @& String) : IO UInt64
+
+Return the hash of the compacted data stored in the header of the given .olean file without reading the rest
+of the file. */
+extern "C" object * lean_read_module_data_hash(b_obj_arg fname, object *) {
+    std::string olean_fn(string_cstr(fname));
+    try {
+        shared_file_lock olean_lock(olean_fn);
+        std::ifstream in(olean_fn, std::ios_base::binary);
+        olean_header header;
+        size_t size;
+        if (optional<std::string> error = read_olean_header(in, olean_fn, header, size)) {
+            return io_result_mk_error(*error);
+        }
+        return io_result_mk_ok(box_uint64(header.m_data_hash));
+    } catch (exception & ex) {
+        return io_result_mk_error((sstream() << "failed to read '" << olean_fn << "': " << ex.what()).str());
+    }
+}
+
+static obj_res read_module_data_fn(obj_arg fname, obj_arg) {
+    object * r = lean_read_module_data(fname, io_mk_world());
+    dec(fname);
+    return r;
+}
+
+/*
+@[extern 2 "lean_read_module_data_parallel"]
+constant readModuleDataParallel (fnames : @& Array String) : IO (Array (ModuleData × CompactedRegion))
+
+Read the given .olean files using the task manager worker threads, i.e., the number of files
+read concurrently is bounded by the `--threads` option. */
+extern "C" object * lean_read_module_data_parallel(object * fnames, object *) {
+    size_t n = array_size(fnames);
+    buffer<object *> tasks;
+    for (size_t i = 0; i < n; i++) {
+        object * c = lean_alloc_closure((void*)read_module_data_fn, 2, 1);
+        object * fname = array_get(fnames, i);
+        inc(fname);
+        lean_closure_set(c, 0, fname);
+        tasks.push_back(lean_task_spawn_core(c, 0, /* keep_alive */ false));
+    }
+    object * mods  = alloc_array(0, n);
+    object * error = nullptr;
+    for (object * t : tasks) {
+        object * r = lean_task_get(t);
+        if (io_result_is_ok(r)) {
+            object * mod = io_result_get_value(r);
+            inc(mod);
+            mods = lean_array_push(mods, mod);
+        } else if (error == nullptr) {
+            inc(r);
+            error = r;
+        }
+        dec(t);
+    }
+    if (error != nullptr) {
+        /* Free the regions of the modules that have been read. The objects in a region are never deallocated
+           by `dec`, so we can release `mods` first. */
+        buffer<compacted_region *> regions;
+        for (size_t i = 0; i < array_size(mods); i++)
+            regions.push_back(reinterpret_cast<compacted_region *>(unbox_size_t(cnstr_get(array_get(mods, i), 1))));
+        dec(mods);
+        for (compacted_region * region : regions)
+            delete region;
+        return error;
+    }
+    return io_result_mk_ok(mods);
+}
+
 /*
 @[export lean.write_module_core]
 def writeModule (env : Environment) (fname : String) : IO Unit := */
@@ -111,4 +397,14 @@ extern "C" object * lean_write_module(object * env, object * fname, object *);
 void write_module(environment const & env, std::string const & olean_fn) {
     consume_io_result(lean_write_module(env.to_obj_arg(), mk_string(olean_fn), io_mk_world()));
 }
+void initialize_module() {
+    g_olean_compress = new name{"olean", "compress"};
+    mark_persistent(g_olean_compress->raw());
+    register_bool_option(*g_olean_compress, LEAN_DEFAULT_OLEAN_COMPRESS,
+                         "(lean) compress .olean files; compressed files cannot be memory-mapped but are usually several times smaller");
+}
+
+void finalize_module() {
+    delete g_olean_compress;
+}
 }
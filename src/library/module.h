@@ -16,4 +16,11 @@ Authors: Leonardo de Moura, Gabriel Ebner, Sebastian Ullrich
 namespace lean {
 /** \brief Store module using \c env. */
 void write_module(environment const & env, std::string const & olean_fn);
+
+/** \brief Compress .olean files written by this process, see `olean.compress` option. */
+void set_olean_compression(bool flag);
+bool get_olean_compress(options const & opts);
+
+void initialize_module();
+void finalize_module();
 }
@@ -5,6 +5,16 @@ Released under Apache 2.0 license as described in the file LICENSE.
 Author: Leonardo de Moura
 */
 #include <vector>
+#include <algorithm>
+#include <cstring>
+#ifdef LEAN_RUNTIME_STATS
+#include <iostream>
+#endif
+#if defined(LEAN_WINDOWS)
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
 #include <lean/thread.h>
 #include <lean/debug.h>
 #include <lean/alloc.h>
@@ -12,33 +22,107 @@ Author: Leonardo de Moura
 
 #define LEAN_PAGE_SIZE             8192        // 8 Kb
 #define LEAN_SEGMENT_SIZE          8*1024*1024 // 8 Mb
-#define LEAN_NUM_SLOTS             (LEAN_MAX_SMALL_OBJECT_SIZE / LEAN_OBJECT_SIZE_DELTA)
+#define LEAN_NUM_SLOTS             LEAN_NUM_SMALL_OBJECT_SLOTS
 #define LEAN_MAX_TO_EXPORT_OBJS    1024
+#define LEAN_DEFAULT_MAX_EMPTY_MEM 4*1024*1024 // 4 Mb
+/* Objects bigger than LEAN_MAX_SMALL_OBJECT_SIZE are "medium" up to LEAN_MAX_MEDIUM_OBJECT_SIZE, and "huge" otherwise.
+   The size of a medium object is rounded up to its size class. There are 4 size classes per power of two. */
+#define LEAN_MAX_MEDIUM_OBJECT_SIZE 4*1024*1024 // 4 Mb
+#define LEAN_NUM_MEDIUM_CLASSES    40
+#define LEAN_MAX_MEDIUM_CACHE_SIZE 8*1024*1024 // 8 Mb
+#define LEAN_HUGE_OBJECT_ALIGN     4096
 
 LEAN_CASSERT(LEAN_PAGE_SIZE > LEAN_MAX_SMALL_OBJECT_SIZE);
 LEAN_CASSERT(LEAN_SEGMENT_SIZE > LEAN_PAGE_SIZE);
+LEAN_CASSERT(LEAN_MAX_SMALL_OBJECT_SIZE == 4096);
+LEAN_CASSERT(LEAN_MAX_MEDIUM_OBJECT_SIZE == (LEAN_MAX_SMALL_OBJECT_SIZE << (LEAN_NUM_MEDIUM_CLASSES / 4)));
 
 namespace lean {
 namespace allocator {
+/* Memory returned to the OS. These counters are always maintained since they are only updated when
+   memory is released, and that is a system call anyway. */
+static atomic<uint64_t> g_decommitted_bytes(0);
+static atomic<uint64_t> g_unmapped_bytes(0);
+/* Maximum amount of memory (in bytes) in empty pages that each heap keeps for reuse. */
+static atomic<size_t> g_max_empty_mem(LEAN_DEFAULT_MAX_EMPTY_MEM);
+
+static uint64_t get_decommitted_bytes() { return g_decommitted_bytes.load(memory_order_relaxed); }
+static uint64_t get_unmapped_bytes() { return g_unmapped_bytes.load(memory_order_relaxed); }
+
+/* Counter that is only updated by the thread owning a heap, but that may be read by any thread
+   (see `lean_get_alloc_stats`). We use relaxed loads and stores instead of `fetch_add` since
+   a single thread updates it, and read-modify-write atomic operations are much more expensive. */
+struct stat_counter {
+    atomic<uint64_t> m_value{0};
+    uint64_t get() const { return m_value.load(memory_order_relaxed); }
+    void set(uint64_t v) { m_value.store(v, memory_order_relaxed); }
+    void add(uint64_t d) { set(get() + d); }
+    void sub(uint64_t d) { set(get() - d); }
+    void inc() { add(1); }
+};
+
+/* Statistics of a heap. Counters are folded on demand by `lean_get_alloc_stats`. */
+struct heap_stats {
+    stat_counter m_num_small_alloc[LEAN_NUM_SLOTS];
+    /* Number of small objects deallocated by the owner of this heap. The objects may belong to other heaps. */
+    stat_counter m_num_small_dealloc[LEAN_NUM_SLOTS];
+    stat_counter m_num_big_alloc;
+    stat_counter m_num_big_dealloc;
+    stat_counter m_big_alloc_bytes;
+    stat_counter m_big_dealloc_bytes;
+    /* Segments and pages owned by this heap. */
+    stat_counter m_num_segments;
+    stat_counter m_num_pages;
+    stat_counter m_num_empty_pages;
+    stat_counter m_num_decommitted_pages;
+    /* Number of objects of other heaps that were deallocated by this heap. */
+    stat_counter m_num_remote_frees_out;
+    stat_counter m_num_exports;
+    /* Number of objects taken from `m_to_import_list`. */
+    stat_counter m_num_imported;
+    /* Number of medium objects allocated from the medium object cache. */
+    stat_counter m_num_medium_reuse;
+    stat_counter m_num_huge_alloc;
+    /* Number of objects resized without copying, see `reallocate`. */
+    stat_counter m_num_in_place_resize;
+};
+
+/* Big objects allocated and deallocated by threads without a heap. */
+static atomic<uint64_t> g_num_big_alloc(0);
+static atomic<uint64_t> g_num_big_dealloc(0);
+static atomic<uint64_t> g_big_alloc_bytes(0);
+static atomic<uint64_t> g_big_dealloc_bytes(0);
+
 #ifdef LEAN_RUNTIME_STATS
-static atomic<uint64> g_num_alloc(0);
-static atomic<uint64> g_num_small_alloc(0);
-static atomic<uint64> g_num_dealloc(0);
-static atomic<uint64> g_num_small_dealloc(0);
-static atomic<uint64> g_num_segments(0);
-static atomic<uint64> g_num_pages(0);
-static atomic<uint64> g_num_exports(0);
-static atomic<uint64> g_num_recycled_pages(0);
+static atomic<uint64_t> g_num_recycled_pages(0);
+static atomic<uint64_t> g_num_emptied_pages(0);
+static atomic<uint64_t> g_num_reused_pages(0);
 struct alloc_stats {
     ~alloc_stats() {
-        std::cerr << "num. alloc.:         " << g_num_alloc << "\n";
-        std::cerr << "num. small alloc.:   " << g_num_small_alloc << "\n";
-        std::cerr << "num. dealloc.:       " << g_num_dealloc << "\n";
-        std::cerr << "num. small dealloc.: " << g_num_small_dealloc << "\n";
-        std::cerr << "num. segments:       " << g_num_segments << "\n";
-        std::cerr << "num. pages:          " << g_num_pages << "\n";
+        lean_alloc_stats s;
+        lean_get_alloc_stats(&s);
+        uint64_t num_small_alloc = 0, num_small_dealloc = 0;
+        for (unsigned i = 0; i < LEAN_NUM_SLOTS; i++) {
+            num_small_alloc   += s.m_num_small_alloc[i];
+            num_small_dealloc += s.m_num_small_dealloc[i];
+        }
+        std::cerr << "num. small alloc.:   " << num_small_alloc << "\n";
+        std::cerr << "num. small dealloc.: " << num_small_dealloc << "\n";
+        std::cerr << "num. big alloc.:     " << s.m_num_big_alloc << "\n";
+        std::cerr << "num. big dealloc.:   " << s.m_num_big_dealloc << "\n";
+        std::cerr << "live bytes:          " << s.m_live_bytes << "\n";
+        std::cerr << "num. segments:       " << s.m_num_segments << "\n";
+        std::cerr << "num. pages:          " << s.m_num_pages << "\n";
         std::cerr << "num. recycled pages: " << g_num_recycled_pages << "\n";
-        std::cerr << "num. exports:        " << g_num_exports << "\n";
+        std::cerr << "num. emptied pages:  " << g_num_emptied_pages << "\n";
+        std::cerr << "num. reused pages:   " << g_num_reused_pages << "\n";
+        std::cerr << "num. medium reuse:   " << s.m_num_medium_reuse << "\n";
+        std::cerr << "num. huge alloc.:    " << s.m_num_huge_alloc << "\n";
+        std::cerr << "num. in place resize:" << s.m_num_in_place_resize << "\n";
+        std::cerr << "num. exports:        " << s.m_num_exports << "\n";
+        std::cerr << "num. remote frees:   " << s.m_num_remote_frees << "\n";
+        std::cerr << "num. decommitted:    " << s.m_decommitted_bytes << " bytes\n";
+        std::cerr << "num. unmapped:       " << s.m_unmapped_bytes << " bytes\n";
     }
 };
 static alloc_stats g_alloc_stats;
@@ -46,8 +130,10 @@ static alloc_stats g_alloc_stats;
 
 struct heap;
 struct page;
+struct segment;
 struct page_header {
     atomic<heap *>   m_heap;
+    segment *        m_segment;
     page *           m_next;
     page *           m_prev;
     void *           m_free_list;
@@ -77,9 +163,46 @@ inline char * align_ptr(char * p, size_t a) {
     return reinterpret_cast<char*>(lean_align(reinterpret_cast<size_t>(p), a));
 }
 
+/* Operating system interface for segments and empty pages. Segments are mapped directly (instead of using `new`)
+   to make sure `free_segment_mem` really returns them to the OS. */
+static void * alloc_segment_mem(size_t sz) {
+#if defined(LEAN_WINDOWS)
+    void * r = VirtualAlloc(nullptr, sz, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    if (r == nullptr) lean_internal_panic_out_of_memory();
+#else
+    void * r = mmap(nullptr, sz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (r == MAP_FAILED) lean_internal_panic_out_of_memory();
+#endif
+    return r;
+}
+
+static void free_segment_mem(void * p, size_t sz) {
+#if defined(LEAN_WINDOWS)
+    VirtualFree(p, 0, MEM_RELEASE);
+#else
+    munmap(p, sz);
+#endif
+    g_unmapped_bytes.fetch_add(sz, memory_order_relaxed);
+}
+
+/* Tell the OS that the contents of `[p, p+sz)` are not needed anymore. The memory remains mapped, and it is
+   transparently committed again when it is touched. */
+static void decommit_mem(char * p, size_t sz) {
+#if defined(LEAN_WINDOWS)
+    VirtualAlloc(p, sz, MEM_RESET, PAGE_READWRITE);
+#elif defined(__linux__)
+    madvise(p, sz, MADV_DONTNEED);
+#else
+    madvise(p, sz, MADV_FREE);
+#endif
+    g_decommitted_bytes.fetch_add(sz, memory_order_relaxed);
+}
+
 struct segment {
     segment *    m_next{nullptr};
     char *       m_next_page_mem;
+    /* Number of pages in this segment that are in the empty page lists of its heap. */
+    unsigned     m_num_empty_pages{0};
     char         m_data[LEAN_SEGMENT_SIZE];
 
     char * get_first_page_mem() {
@@ -96,31 +219,112 @@ struct segment {
         return m_next_page_mem + LEAN_PAGE_SIZE > m_data + LEAN_SEGMENT_SIZE;
     }
 
-    void move_to_heap(heap *);
+    unsigned get_num_pages() {
+        return (m_next_page_mem - get_first_page_mem()) / LEAN_PAGE_SIZE;
+    }
+
+    static segment * mk() {
+        return new (alloc_segment_mem(sizeof(segment))) segment();
+    }
+
+    static void free(segment * s) {
+        free_segment_mem(s, sizeof(segment));
+    }
+
+    void move_to_heap(heap * from, heap * to);
+};
+
+/* Page that does not contain any allocated object. The page does not belong to any page list, and can be
+   reused for objects of any size. We store the segment here because the header of a decommitted page is lost. */
+struct empty_page {
+    page *    m_page;
+    segment * m_segment;
 };
 
 struct heap {
     segment * m_curr_segment{nullptr};
     heap *    m_next_orphan{nullptr};
+    /* All heaps are in a doubly linked list, see `heap_manager`. */
+    heap *    m_next_heap{nullptr};
+    heap *    m_prev_heap{nullptr};
     page *    m_curr_page[LEAN_NUM_SLOTS];
     page *    m_page_free_list[LEAN_NUM_SLOTS];
     /* Objects that must be sent to other heaps. */
     void *    m_to_export_list{nullptr};
     unsigned  m_to_export_list_size{0};
-    mutex     m_mutex; /* for the following fields */
-    /* The following list contains object by this heap that were deallocated
-       by other heaps. */
-    void *    m_to_import_list{nullptr};
+    /* The following list contains objects of this heap that were deallocated by other heaps.
+       It is a lock-free stack: other heaps push batches of objects onto it (see `export_objs`),
+       and the owner takes the whole list at once (see `import_objs`). Since the owner never
+       pops individual elements, there is no ABA problem. */
+    atomic<void *> m_to_import_list{nullptr};
+    /* Number of objects of this heap that were deallocated by other heaps. */
+    atomic<uint64_t> m_num_remote_frees_in{0};
     uint64_t  m_heartbeat{0}; /* Counter for implementing "deterministic timeouts". It is currently the number of small allocations */
+    /* Empty pages whose memory is still committed, the most recently emptied ones at the end. */
+    std::vector<empty_page> m_empty_pages;
+    /* Empty pages whose memory was returned to the OS. */
+    std::vector<empty_page> m_decommitted_pages;
+    /* Medium objects deallocated by this thread that can be reused, see `alloc_medium`. */
+    void *    m_medium_free_list[LEAN_NUM_MEDIUM_CLASSES];
+    size_t    m_medium_cache_size{0};
+    heap_stats m_stats;
+    void update_empty_page_stats() {
+        m_stats.m_num_empty_pages.set(m_empty_pages.size());
+        m_stats.m_num_decommitted_pages.set(m_decommitted_pages.size());
+    }
     void import_objs();
     void export_objs();
     void alloc_segment();
+    void push_empty_page(page * p);
+    void push_current_empty_pages();
+    bool pop_empty_page(empty_page & r);
+    void release_segments();
+    void release_empty_pages(size_t max_empty_pages);
+    void flush_medium_cache();
 };
 
+static void add_stats(lean_alloc_stats & r, heap_stats const & s);
+
 struct heap_manager {
-    /* The mutex protects the list of orphan segments. */
+    /* The mutex protects the list of orphan segments, the list of all heaps, and `m_retired_stats`. */
     mutex             m_mutex;
     heap *            m_orphans{nullptr};
+    heap *            m_heaps{nullptr};
+    /* Statistics of deleted heaps. */
+    lean_alloc_stats  m_retired_stats;
+
+    heap_manager() {
+        memset(&m_retired_stats, 0, sizeof(m_retired_stats));
+    }
+
+    void register_heap(heap * h) {
+        lock_guard<mutex> lock(m_mutex);
+        h->m_next_heap = m_heaps;
+        if (m_heaps)
+            m_heaps->m_prev_heap = h;
+        m_heaps = h;
+    }
+
+    void delete_heap(heap * h) {
+        {
+            lock_guard<mutex> lock(m_mutex);
+            add_stats(m_retired_stats, h->m_stats);
+            if (h->m_prev_heap)
+                h->m_prev_heap->m_next_heap = h->m_next_heap;
+            else
+                m_heaps = h->m_next_heap;
+            if (h->m_next_heap)
+                h->m_next_heap->m_prev_heap = h->m_prev_heap;
+        }
+        delete h;
+    }
+
+    void get_stats(lean_alloc_stats & r) {
+        lock_guard<mutex> lock(m_mutex);
+        r = m_retired_stats;
+        for (heap * h = m_heaps; h != nullptr; h = h->m_next_heap)
+            add_stats(r, h->m_stats);
+    }
 
     void push_orphan(heap * h) {
         /* TODO(Leo): avoid mutex */
@@ -129,6 +333,15 @@ struct heap_manager {
         m_orphans = h;
     }
 
+    /* Return the memory of the empty pages of all orphan heaps to the OS. */
+    void release_orphans_empty_pages() {
+        lock_guard<mutex> lock(m_mutex);
+        for (heap * h = m_orphans; h != nullptr; h = h->m_next_orphan) {
+            h->import_objs();
+            h->release_empty_pages(0);
+        }
+    }
+
     heap * pop_orphan() {
         /* TODO(Leo): avoid mutex */
         lock_guard<mutex> lock(m_mutex);
@@ -167,8 +380,9 @@ static inline void page_list_insert(page * & head, page * new_head) {
 
 static inline void page_list_remove(page * & head, page * to_remove) {
     if (head == to_remove) {
-        /* First element */
+        /* First element. Remark: the `prev` field of the first element is not maintained. */
         head = to_remove->get_next();
+        return;
     }
     page * prev = to_remove->get_prev();
     lean_assert(prev);
@@ -193,7 +407,12 @@ void page::push_free_obj(void * o) {
     set_next_obj(o, m_header.m_free_list);
     m_header.m_free_list = o;
     m_header.m_num_free++;
-    if (!in_page_free_list() && has_many_free()) {
+    if (m_header.m_num_free == m_header.m_max_free) {
+        heap * h = get_heap();
+        /* Remark: the current page of each slot must remain in its list, see `lean_alloc_small` */
+        if (this != h->m_curr_page[m_header.m_slot_idx])
+            h->push_empty_page(this);
+    } else if (!in_page_free_list() && has_many_free()) {
         heap * h = get_heap();
         unsigned slot_idx = m_header.m_slot_idx;
         if (this != h->m_curr_page[slot_idx]) {
@@ -205,44 +424,76 @@ void page::push_free_obj(void * o) {
     }
 }
 
-void segment::move_to_heap(heap * h) {
+/* Move the entries of `from` that belong to `s` to `to`, and mark them in `is_empty`. */
+static void move_empty_pages(segment * s, std::vector<empty_page> & from, std::vector<empty_page> & to, std::vector<bool> & is_empty) {
+    char * first = s->get_first_page_mem();
+    auto it = std::remove_if(from.begin(), from.end(), [&](empty_page const & e) {
+            if (e.m_segment != s) return false;
+            is_empty[(reinterpret_cast<char*>(e.m_page) - first) / LEAN_PAGE_SIZE] = true;
+            to.push_back(e);
+            return true;
+        });
+    from.erase(it, from.end());
+}
+
+void segment::move_to_heap(heap * from, heap * h) {
     /* "Move" pages in `s` to this heap */
+    unsigned num_pages = get_num_pages();
+    std::vector<bool> is_empty(num_pages, false);
+    if (m_num_empty_pages > 0) {
+        move_empty_pages(this, from->m_empty_pages, h->m_empty_pages, is_empty);
+        move_empty_pages(this, from->m_decommitted_pages, h->m_decommitted_pages, is_empty);
+    }
+    from->m_stats.m_num_segments.sub(1);
+    from->m_stats.m_num_pages.sub(num_pages);
+    h->m_stats.m_num_segments.inc();
+    h->m_stats.m_num_pages.add(num_pages);
     page * it  = reinterpret_cast<page*>(get_first_page_mem());
     page * end = reinterpret_cast<page*>(m_next_page_mem);
-    for (; it != end; ++it) {
+    for (unsigned i = 0; it != end; ++it, ++i) {
+        if (is_empty[i])
+            continue; /* the header of a decommitted page must not be touched */
         page & p    = *it;
         p.set_heap(h);
         unsigned slot_idx = p.get_slot_idx();
-        if (p.in_page_free_list()) {
+        if (p.m_header.m_num_free == p.m_header.m_max_free) {
+            /* It was the current page of its slot in the old heap. */
+            m_num_empty_pages++;
+            h->m_empty_pages.push_back(empty_page{&p, this});
+        } else if (p.in_page_free_list()) {
             page_list_insert(h->m_page_free_list[slot_idx], &p);
         } else {
             page_list_insert(h->m_curr_page[slot_idx], &p);
         }
     }
+    from->update_empty_page_stats();
+    h->update_empty_page_stats();
 }
 
 void heap::import_objs() {
-    void * to_import = nullptr;
-    {   // TODO(Leo): avoid mutex using compare and swap
-        lock_guard<mutex> lock(m_mutex);
-        to_import = m_to_import_list;
-        m_to_import_list = nullptr;
-    }
+    if (m_to_import_list.load(memory_order_relaxed) == nullptr)
+        return;
+    void * to_import = m_to_import_list.exchange(nullptr, memory_order_acquire);
+    uint64_t num_imported = 0;
     while (to_import) {
         page * p = get_page_of(to_import);
         void * n = get_next_obj(to_import);
         p->push_free_obj(to_import);
         to_import = n;
+        num_imported++;
     }
+    m_stats.m_num_imported.add(num_imported);
 }
 
 struct export_entry {
-    heap * m_heap;
-    void * m_head;
-    void * m_tail;
+    heap *   m_heap;
+    void *   m_head;
+    void *   m_tail;
+    unsigned m_size;
 };
 
 void heap::export_objs() {
+    m_stats.m_num_exports.inc();
     std::vector<export_entry> to_export;
     void * o = m_to_export_list;
     while (o != nullptr) {
@@ -266,23 +517,30 @@ void heap::export_objs() {
                 if (e.m_heap == h) {
                     set_next_obj(o, e.m_head);
                     e.m_head = o;
+                    e.m_size++;
                     found = true;
                     break;
                 }
             }
             if (!found) {
                 set_next_obj(o, nullptr);
-                to_export.push_back(export_entry{h, o, o});
+                to_export.push_back(export_entry{h, o, o, 1});
             }
+        } else {
+            get_page_of(o)->push_free_obj(o);
         }
         o = n;
     }
     m_to_export_list      = nullptr;
     m_to_export_list_size = 0;
     for (export_entry const & e : to_export) {
-        unique_lock<mutex> lock(e.m_heap->m_mutex);
-        set_next_obj(e.m_tail, e.m_heap->m_to_import_list);
-        e.m_heap->m_to_import_list = e.m_head;
+        atomic<void *> & to_import = e.m_heap->m_to_import_list;
+        void * head = to_import.load(memory_order_relaxed);
+        do {
+            set_next_obj(e.m_tail, head);
+        } while (!to_import.compare_exchange_weak(head, e.m_head, memory_order_release, memory_order_relaxed));
+        e.m_heap->m_num_remote_frees_in.fetch_add(e.m_size, memory_order_relaxed);
+        m_stats.m_num_remote_frees_out.add(e.m_size);
     }
 }
 
@@ -294,11 +552,12 @@ void heap::alloc_segment() {
             h->import_objs();
             segment * s = h->m_curr_segment;
             h->m_curr_segment = s->m_next;
-            s->move_to_heap(this);
+            s->move_to_heap(h, this);
             if (h->m_curr_segment != nullptr) {
                 g_heap_manager->push_orphan(h);
             } else {
-                delete h;
+                lean_assert(h->m_empty_pages.empty() && h->m_decommitted_pages.empty());
+                g_heap_manager->delete_heap(h);
             }
             s->m_next      = m_curr_segment;
             m_curr_segment = s;
@@ -309,8 +568,8 @@ void heap::alloc_segment() {
             /* If `s` is full, we must "keep looking" because `alloc_page` assumes that `m_curr_segment`
                contains at least one free page. */
         } else {
-            LEAN_RUNTIME_STAT_CODE(g_num_segments++);
-            segment * s = new segment();
+            m_stats.m_num_segments.inc();
+            segment * s = segment::mk();
             s->m_next   = m_curr_segment;
             m_curr_segment = s;
             break;
@@ -318,15 +577,120 @@ void heap::alloc_segment() {
     }
 }
 
+void heap::push_empty_page(page * p) {
+    LEAN_RUNTIME_STAT_CODE(g_num_emptied_pages++);
+    unsigned slot_idx = p->get_slot_idx();
+    if (p->in_page_free_list()) {
+        page_list_remove(m_page_free_list[slot_idx], p);
+    } else {
+        page_list_remove(m_curr_page[slot_idx], p);
+    }
+    segment * s = p->m_header.m_segment;
+    s->m_num_empty_pages++;
+    m_empty_pages.push_back(empty_page{p, s});
+    size_t max_empty_pages = g_max_empty_mem.load(memory_order_relaxed) / LEAN_PAGE_SIZE;
+    if (m_empty_pages.size() > max_empty_pages) {
+        /* We release more than strictly needed to avoid invoking the OS again when the next page becomes empty. */
+        release_empty_pages(max_empty_pages / 2);
+    }
+    update_empty_page_stats();
+}
+
+/* Move the current pages that are empty to the empty page lists. This is only used when the heap is not going
+   to be used for allocation anymore, since it breaks the invariant that each slot has a current page. */
+void heap::push_current_empty_pages() {
+    for (unsigned i = 0; i < LEAN_NUM_SLOTS; i++) {
+        page * p = m_curr_page[i];
+        if (p && p->m_header.m_num_free == p->m_header.m_max_free) {
+            m_curr_page[i] = p->get_next();
+            p->m_header.m_segment->m_num_empty_pages++;
+            m_empty_pages.push_back(empty_page{p, p->m_header.m_segment});
+        }
+    }
+    update_empty_page_stats();
+}
+
+bool heap::pop_empty_page(empty_page & r) {
+    /* We prefer committed pages, and the most recently emptied ones since they are more likely to be in the cache. */
+    std::vector<empty_page> & ps = !m_empty_pages.empty() ? m_empty_pages : m_decommitted_pages;
+    if (ps.empty())
+        return false;
+    r = ps.back();
+    ps.pop_back();
+    lean_assert(r.m_segment->m_num_empty_pages > 0);
+    r.m_segment->m_num_empty_pages--;
+    update_empty_page_stats();
+    LEAN_RUNTIME_STAT_CODE(g_num_reused_pages++);
+    return true;
+}
+
+/* Unmap segments that only contain empty pages. The current segment is never released since `alloc_page`
+   assumes it contains at least one free page. */
+void heap::release_segments() {
+    if (m_curr_segment == nullptr)
+        return;
+    segment * prev = m_curr_segment;
+    segment * s    = m_curr_segment->m_next;
+    while (s != nullptr) {
+        segment * next = s->m_next;
+        if (s->m_num_empty_pages == s->get_num_pages()) {
+            auto in_s = [&](empty_page const & e) { return e.m_segment == s; };
+            m_empty_pages.erase(std::remove_if(m_empty_pages.begin(), m_empty_pages.end(), in_s), m_empty_pages.end());
+            m_decommitted_pages.erase(std::remove_if(m_decommitted_pages.begin(), m_decommitted_pages.end(), in_s),
+                                      m_decommitted_pages.end());
+            prev->m_next = next;
+            m_stats.m_num_segments.sub(1);
+            m_stats.m_num_pages.sub(s->get_num_pages());
+            segment::free(s);
+        } else {
+            prev = s;
+        }
+        s = next;
+    }
+}
+
+/* Return the memory of empty pages to the OS until at most `max_empty_pages` committed empty pages remain. */
+void heap::release_empty_pages(size_t max_empty_pages) {
+    release_segments();
+    if (m_empty_pages.size() <= max_empty_pages) {
+        update_empty_page_stats();
+        return;
+    }
+    /* Release the pages that have been empty for the longest time. We sort them by address to
+       coalesce adjacent pages into a single system call. */
+    auto end = m_empty_pages.begin() + (m_empty_pages.size() - max_empty_pages);
+    std::sort(m_empty_pages.begin(), end, [](empty_page const & e1, empty_page const & e2) { return e1.m_page < e2.m_page; });
+    auto it = m_empty_pages.begin();
+    while (it != end) {
+        char * begin_mem = reinterpret_cast<char*>(it->m_page);
+        char * end_mem   = begin_mem;
+        for (; it != end && reinterpret_cast<char*>(it->m_page) == end_mem; ++it) {
+            m_decommitted_pages.push_back(*it);
+            end_mem += LEAN_PAGE_SIZE;
+        }
+        decommit_mem(begin_mem, end_mem - begin_mem);
+    }
+    m_empty_pages.erase(m_empty_pages.begin(), end);
+    update_empty_page_stats();
+}
+
 static page * alloc_page(heap * h, unsigned obj_size) {
     lean_assert(lean_align(obj_size, LEAN_OBJECT_SIZE_DELTA) == obj_size);
-    segment * s = h->m_curr_segment;
-    LEAN_RUNTIME_STAT_CODE(g_num_pages++);
-    page * p    = new (s->m_next_page_mem) page();
-    s->m_next_page_mem += LEAN_PAGE_SIZE;
-    if (s->is_full()) {
-        /* s is full, we need to allocate a new one. */
-        h->alloc_segment();
+    page * p;
+    empty_page e;
+    if (h->pop_empty_page(e)) {
+        p = new (e.m_page) page();
+        p->m_header.m_segment = e.m_segment;
+    } else {
+        segment * s = h->m_curr_segment;
+        h->m_stats.m_num_pages.inc();
+        p = new (s->m_next_page_mem) page();
+        p->m_header.m_segment = s;
+        s->m_next_page_mem += LEAN_PAGE_SIZE;
+        if (s->is_full()) {
+            /* s is full, we need to allocate a new one. */
+            h->alloc_segment();
+        }
     }
     unsigned slot_idx        = lean_get_slot_idx(obj_size);
     p->m_header.m_heap       = h;
@@ -367,17 +731,24 @@ static void finalize_heap(void * _h) {
     heap * h = static_cast<heap*>(_h);
     h->export_objs();
     h->import_objs();
+    h->flush_medium_cache();
+    /* Nobody will allocate from `h` anymore, its segments will be reused by other heaps. */
+    h->push_current_empty_pages();
+    h->release_empty_pages(0);
     g_heap_manager->push_orphan(h);
 }
 
 static void init_heap(bool main) {
     lean_assert(g_heap == nullptr);
     g_heap = new heap();
+    g_heap_manager->register_heap(g_heap);
     g_curr_pages = g_heap->m_curr_page;
     for (unsigned i = 0; i < LEAN_NUM_SLOTS; i++) {
         g_heap->m_curr_page[i] = nullptr;
         g_heap->m_page_free_list[i] = nullptr;
     }
+    for (unsigned i = 0; i < LEAN_NUM_MEDIUM_CLASSES; i++)
+        g_heap->m_medium_free_list[i] = nullptr;
     g_heap->alloc_segment();
     unsigned obj_size = LEAN_OBJECT_SIZE_DELTA;
     for (unsigned i = 0; i < LEAN_NUM_SLOTS; i++) {
@@ -396,9 +767,10 @@ void init_thread_heap() {
     init_heap(false);
 }
 
-extern "C" void * lean_alloc_small(unsigned sz, unsigned slot_idx) {
+static inline void * alloc_small(unsigned sz, unsigned slot_idx) {
     page * p = g_heap->m_curr_page[slot_idx];
     g_heap->m_heartbeat++;
+    g_heap->m_stats.m_num_small_alloc[slot_idx].inc();
     void * r = p->m_header.m_free_list;
     if (LEAN_UNLIKELY(r == nullptr)) {
         if (g_heap->m_page_free_list[slot_idx] == nullptr) {
@@ -421,12 +793,55 @@ extern "C" void * lean_alloc_small(unsigned sz, unsigned slot_idx) {
     return r;
 }
 
+/* Objects whose deletion was deferred by `lean_del`, see `lean_set_del_budget` at object.cpp */
+LEAN_THREAD_EXTERN_PTR(lean_object, g_deferred_del);
+void del_deferred_step();
+
+/* Remark: objects allocated by the inline functions in `lean.h` do not go through `lean_alloc_object`,
+   so deferred deletions are also processed here. */
+extern "C" void * lean_alloc_small(unsigned sz, unsigned slot_idx) {
+    if (LEAN_UNLIKELY(g_deferred_del != nullptr))
+        del_deferred_step();
+    return alloc_small(sz, slot_idx);
+}
+
 /* Helper function for increasing hearbeat even when LEAN_SMALL_ALLOCATOR is not defined */
 extern "C" void lean_inc_heartbeat() {
+    if (LEAN_UNLIKELY(g_deferred_del != nullptr))
+        del_deferred_step();
     if (g_heap)
         g_heap->m_heartbeat++;
 }
 
+void get_remote_free_stats(uint64_t & num_in, uint64_t & num_out) {
+    if (g_heap) {
+        num_in  = g_heap->m_num_remote_frees_in.load(memory_order_relaxed);
+        num_out = g_heap->m_stats.m_num_remote_frees_out.get();
+    } else {
+        num_in = num_out = 0;
+    }
+}
+
+void release_free_memory() {
+    if (g_heap) {
+        g_heap->export_objs();
+        g_heap->import_objs();
+        g_heap->flush_medium_cache();
+        g_heap->release_empty_pages(0);
+    }
+    if (g_heap_manager)
+        g_heap_manager->release_orphans_empty_pages();
+}
+
+void set_max_empty_memory(size_t sz) {
+    g_max_empty_mem.store(sz, memory_order_relaxed);
+}
+
+void get_released_memory_stats(uint64_t & decommitted, uint64_t & unmapped) {
+    decommitted = get_decommitted_bytes();
+    unmapped    = get_unmapped_bytes();
+}
+
 uint64_t get_num_heartbeats() {
     if (g_heap)
         return g_heap->m_heartbeat;
@@ -434,27 +849,141 @@ uint64_t get_num_heartbeats() {
         return 0;
 }
 
+/* Return the index of the size class of the medium object size `sz`, and store the size of the class in `class_sz`. */
+static inline unsigned get_medium_class(size_t sz, size_t & class_sz) {
+    lean_assert(sz > LEAN_MAX_SMALL_OBJECT_SIZE && sz <= LEAN_MAX_MEDIUM_OBJECT_SIZE);
+    /* 2^b < sz <= 2^(b+1) */
+    unsigned b    = 63 - __builtin_clzll(static_cast<unsigned long long>(sz - 1));
+    unsigned q    = (sz + (static_cast<size_t>(1) << (b - 2)) - 1) >> (b - 2);
+    lean_assert(5 <= q && q <= 8);
+    class_sz      = static_cast<size_t>(q) << (b - 2);
+    return (b - 12) * 4 + (q - 5);
+}
+
+static inline size_t get_huge_size(size_t sz) {
+    return lean_align(sz, LEAN_HUGE_OBJECT_ALIGN);
+}
+
+void heap::flush_medium_cache() {
+    for (unsigned i = 0; i < LEAN_NUM_MEDIUM_CLASSES; i++) {
+        void * o = m_medium_free_list[i];
+        while (o != nullptr) {
+            void * n = get_next_obj(o);
+            free(o);
+            o = n;
+        }
+        m_medium_free_list[i] = nullptr;
+    }
+    m_medium_cache_size = 0;
+}
+
+/* Medium objects are allocated using `malloc`, but we keep a thread local cache of deallocated ones.
+   Thus, in the common case where a thread keeps allocating and deallocating arrays and strings of similar sizes,
+   we avoid the `malloc` locks and the repeated `mmap`/`munmap` calls it performs for big blocks. */
+static void * alloc_medium(size_t sz) {
+    size_t class_sz;
+    unsigned idx = get_medium_class(sz, class_sz);
+    if (heap * h = g_heap) {
+        if (void * r = h->m_medium_free_list[idx]) {
+            h->m_medium_free_list[idx] = get_next_obj(r);
+            h->m_medium_cache_size    -= class_sz;
+            h->m_stats.m_num_medium_reuse.inc();
+            return r;
+        }
+    }
+    void * r = malloc(class_sz);
+    if (r == nullptr) lean_internal_panic_out_of_memory();
+    return r;
+}
+
+static void dealloc_medium(void * o, size_t sz) {
+    size_t class_sz;
+    unsigned idx = get_medium_class(sz, class_sz);
+    heap * h     = g_heap;
+    if (h && h->m_medium_cache_size + class_sz <= LEAN_MAX_MEDIUM_CACHE_SIZE) {
+        set_next_obj(o, h->m_medium_free_list[idx]);
+        h->m_medium_free_list[idx] = o;
+        h->m_medium_cache_size    += class_sz;
+    } else {
+        free(o);
+    }
+}
+
+/* Huge objects are mapped directly. On Linux, we can then resize them using `mremap` without copying them. */
+static void * alloc_huge(size_t sz) {
+    if (heap * h = g_heap)
+        h->m_stats.m_num_huge_alloc.inc();
+#if defined(LEAN_WINDOWS)
+    void * r = malloc(sz);
+    if (r == nullptr) lean_internal_panic_out_of_memory();
+#else
+    void * r = mmap(nullptr, get_huge_size(sz), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (r == MAP_FAILED) lean_internal_panic_out_of_memory();
+#endif
+    return r;
+}
+
+static void dealloc_huge(void * o, size_t sz) {
+#if defined(LEAN_WINDOWS)
+    free(o);
+#else
+    munmap(o, get_huge_size(sz));
+#endif
+}
+
+static inline void count_big_alloc(size_t sz) {
+    if (heap * h = g_heap) {
+        h->m_stats.m_num_big_alloc.inc();
+        h->m_stats.m_big_alloc_bytes.add(sz);
+    } else {
+        g_num_big_alloc++;
+        g_big_alloc_bytes += sz;
+    }
+}
+
+static inline void count_big_dealloc(size_t sz) {
+    if (heap * h = g_heap) {
+        h->m_stats.m_num_big_dealloc.inc();
+        h->m_stats.m_big_dealloc_bytes.add(sz);
+    } else {
+        g_num_big_dealloc++;
+        g_big_dealloc_bytes += sz;
+    }
+}
+
+static void * alloc_big(size_t sz) {
+    count_big_alloc(sz);
+    if (sz <= LEAN_MAX_MEDIUM_OBJECT_SIZE)
+        return alloc_medium(sz);
+    else
+        return alloc_huge(sz);
+}
+
+static void dealloc_big(void * o, size_t sz) {
+    count_big_dealloc(sz);
+    if (sz <= LEAN_MAX_MEDIUM_OBJECT_SIZE)
+        dealloc_medium(o, sz);
+    else
+        dealloc_huge(o, sz);
+}
+
 void * alloc(size_t sz) {
     sz = lean_align(sz, LEAN_OBJECT_SIZE_DELTA);
-    LEAN_RUNTIME_STAT_CODE(g_num_alloc++);
     if (LEAN_UNLIKELY(sz > LEAN_MAX_SMALL_OBJECT_SIZE)) {
-        void * r = malloc(sz);
-        if (r == nullptr) lean_internal_panic_out_of_memory();
-        return r;
+        return alloc_big(sz);
     }
     lean_assert(g_heap);
-    LEAN_RUNTIME_STAT_CODE(g_num_small_alloc++);
     unsigned slot_idx = lean_get_slot_idx(sz);
-    return lean_alloc_small(sz, slot_idx);
+    return alloc_small(sz, slot_idx);
 }
 
 static inline void dealloc_small_core(void * o) {
-    LEAN_RUNTIME_STAT_CODE(g_num_small_dealloc++);
     if (LEAN_UNLIKELY(g_heap == nullptr)) {
         init_heap(false);
     }
     lean_assert(g_heap);
     page * p = get_page_of(o);
+    g_heap->m_stats.m_num_small_dealloc[p->get_slot_idx()].inc();
     if (LEAN_LIKELY(p->get_heap() == g_heap)) {
         p->push_free_obj(o);
     } else {
@@ -462,21 +991,53 @@ static inline void dealloc_small_core(void * o) {
         g_heap->m_to_export_list = o;
         g_heap->m_to_export_list_size++;
         if (g_heap->m_to_export_list_size > LEAN_MAX_TO_EXPORT_OBJS) {
-            LEAN_RUNTIME_STAT_CODE(g_num_exports++);
             g_heap->export_objs();
         }
     }
 }
 
 void dealloc(void * o, size_t sz) {
-    LEAN_RUNTIME_STAT_CODE(g_num_dealloc++);
     sz = lean_align(sz, LEAN_OBJECT_SIZE_DELTA);
     if (LEAN_UNLIKELY(sz > LEAN_MAX_SMALL_OBJECT_SIZE)) {
-        return free(o);
+        return dealloc_big(o, sz);
     }
     dealloc_small_core(o);
 }
 
+void * reallocate(void * o, size_t old_sz, size_t new_sz) {
+    old_sz = lean_align(old_sz, LEAN_OBJECT_SIZE_DELTA);
+    new_sz = lean_align(new_sz, LEAN_OBJECT_SIZE_DELTA);
+    if (old_sz > LEAN_MAX_SMALL_OBJECT_SIZE && new_sz > LEAN_MAX_SMALL_OBJECT_SIZE) {
+        bool in_place = false;
+        void * r      = o;
+        if (old_sz <= LEAN_MAX_MEDIUM_OBJECT_SIZE && new_sz <= LEAN_MAX_MEDIUM_OBJECT_SIZE) {
+            size_t old_class_sz, new_class_sz;
+            in_place = get_medium_class(old_sz, old_class_sz) == get_medium_class(new_sz, new_class_sz);
+        } else if (old_sz > LEAN_MAX_MEDIUM_OBJECT_SIZE && new_sz > LEAN_MAX_MEDIUM_OBJECT_SIZE) {
+#if defined(__linux__)
+            r = mremap(o, get_huge_size(old_sz), get_huge_size(new_sz), MREMAP_MAYMOVE);
+            if (r == MAP_FAILED) lean_internal_panic_out_of_memory();
+            in_place = true;
+#else
+            in_place = get_huge_size(old_sz) == get_huge_size(new_sz);
+#endif
+        }
+        if (in_place) {
+            if (heap * h = g_heap)
+                h->m_stats.m_num_in_place_resize.inc();
+            count_big_dealloc(old_sz);
+            count_big_alloc(new_sz);
+            return r;
+        }
+    } else if (old_sz <= LEAN_MAX_SMALL_OBJECT_SIZE && new_sz <= LEAN_MAX_SMALL_OBJECT_SIZE && old_sz == new_sz) {
+        return o;
+    }
+    void * r = alloc(new_sz);
+    memcpy(r, o, std::min(old_sz, new_sz));
+    dealloc(o, old_sz);
+    return r;
+}
+
 extern "C" void lean_free_small(void * o) {
     dealloc_small_core(o);
 }
@@ -486,6 +1047,49 @@ extern "C" unsigned lean_small_mem_size(void * o) {
     return p->m_header.m_obj_size;
 }
 
+namespace allocator {
+static void add_stats(lean_alloc_stats & r, heap_stats const & s) {
+    for (unsigned i = 0; i < LEAN_NUM_SLOTS; i++) {
+        r.m_num_small_alloc[i]   += s.m_num_small_alloc[i].get();
+        r.m_num_small_dealloc[i] += s.m_num_small_dealloc[i].get();
+    }
+    r.m_num_big_alloc         += s.m_num_big_alloc.get();
+    r.m_num_big_dealloc       += s.m_num_big_dealloc.get();
+    r.m_big_alloc_bytes       += s.m_big_alloc_bytes.get();
+    r.m_big_dealloc_bytes     += s.m_big_dealloc_bytes.get();
+    r.m_num_segments          += s.m_num_segments.get();
+    r.m_num_pages             += s.m_num_pages.get();
+    r.m_num_empty_pages       += s.m_num_empty_pages.get();
+    r.m_num_decommitted_pages += s.m_num_decommitted_pages.get();
+    r.m_num_remote_frees      += s.m_num_remote_frees_out.get();
+    r.m_num_exports           += s.m_num_exports.get();
+    r.m_num_imported          += s.m_num_imported.get();
+    r.m_num_medium_reuse      += s.m_num_medium_reuse.get();
+    r.m_num_huge_alloc        += s.m_num_huge_alloc.get();
+    r.m_num_in_place_resize   += s.m_num_in_place_resize.get();
+}
+}
+
+extern "C" void lean_get_alloc_stats(lean_alloc_stats * r) {
+    if (g_heap_manager) {
+        g_heap_manager->get_stats(*r);
+    } else {
+        memset(r, 0, sizeof(lean_alloc_stats));
+    }
+    r->m_num_big_alloc     += g_num_big_alloc;
+    r->m_num_big_dealloc   += g_num_big_dealloc;
+    r->m_big_alloc_bytes   += g_big_alloc_bytes;
+    r->m_big_dealloc_bytes += g_big_dealloc_bytes;
+    /* Remark: counters are read without synchronization with the threads updating them. So, an object may
+       be counted as deallocated but not as allocated, and the differences below may be negative. */
+    int64_t live_bytes = static_cast<int64_t>(r->m_big_alloc_bytes - r->m_big_dealloc_bytes);
+    for (unsigned i = 0; i < LEAN_NUM_SLOTS; i++)
+        live_bytes += static_cast<int64_t>(r->m_num_small_alloc[i] - r->m_num_small_dealloc[i]) * (i + 1) * LEAN_OBJECT_SIZE_DELTA;
+    r->m_live_bytes        = live_bytes > 0 ? live_bytes : 0;
+    r->m_decommitted_bytes = get_decommitted_bytes();
+    r->m_unmapped_bytes    = get_unmapped_bytes();
+}
+
 void initialize_alloc() {
     g_heap_manager = new heap_manager();
     init_heap(true);
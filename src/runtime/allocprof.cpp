@@ -6,8 +6,19 @@ Author: Leonardo de Moura
 */
 #include <lean/allocprof.h>
 namespace lean {
+static void get_alloc_totals(uint64 & num_small_alloc, uint64 & num_big_alloc, uint64 & live_bytes) {
+    lean_alloc_stats s;
+    lean_get_alloc_stats(&s);
+    num_small_alloc = 0;
+    for (unsigned i = 0; i < LEAN_NUM_SMALL_OBJECT_SLOTS; i++)
+        num_small_alloc += s.m_num_small_alloc[i];
+    num_big_alloc = s.m_num_big_alloc;
+    live_bytes    = s.m_live_bytes;
+}
+
 allocprof::allocprof(std::ostream & out, char const * msg):
     m_out(out), m_msg(msg) {
+        get_alloc_totals(m_num_small_alloc, m_num_big_alloc, m_live_bytes);
 #ifdef LEAN_RUNTIME_STATS
         m_num_ctor    = g_num_ctor;
         m_num_closure = g_num_closure;
@@ -20,6 +31,12 @@ allocprof::allocprof(std::ostream & out, char const * msg):
 }
 allocprof::~allocprof() {
     m_out << m_msg << "\n";
+    uint64 num_small_alloc, num_big_alloc, live_bytes;
+    get_alloc_totals(num_small_alloc, num_big_alloc, live_bytes);
+    m_out << "num. small alloc.: " << num_small_alloc - m_num_small_alloc << "\n";
+    m_out << "num. big alloc.:   " << num_big_alloc - m_num_big_alloc << "\n";
+    m_out << "live bytes:        " << live_bytes << " (" << (live_bytes >= m_live_bytes ? "+" : "-")
+          << (live_bytes >= m_live_bytes ? live_bytes - m_live_bytes : m_live_bytes - live_bytes) << ")\n";
 #ifdef LEAN_RUNTIME_STATS
     uint64 num_ctor    = g_num_ctor - m_num_ctor;
     uint64 num_closure = g_num_closure - m_num_closure;
@@ -39,9 +56,9 @@ allocprof::~allocprof() {
         num_thunk == 0 && num_task == 0 && num_ext == 0) {
         m_out << "***no runtime object allocation has occurred**\n";
     }
-    m_out << "-------------\n";
 #else
-    m_out << "Allocation profiling data is not available, compile lean using `-D RUNTIME_STATS=ON`\n";
+    m_out << "Number of allocations per kind of object is not available, compile lean using `-D RUNTIME_STATS=ON`\n";
 #endif
+    m_out << "-------------\n";
 }
 }
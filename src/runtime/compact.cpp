@@ -4,8 +4,8 @@ Released under Apache 2.0 license as described in the file LICENSE.
 
 Author: Leonardo de Moura
 */
-#include <unordered_set>
 #include <algorithm>
+#include <new>
 #include <string>
 #include <vector>
 #include <lean/hash.h>
@@ -13,41 +13,122 @@ Author: Leonardo de Moura
 #include <lean/compact.h>
 
 #define LEAN_COMPACTOR_INIT_SZ 1024*1024
-#define LEAN_MAX_SHARING_TABLE_INITIAL_SIZE 1024*1024
+#define LEAN_COMPACTOR_TABLE_INITIAL_SIZE 1024
 
 // uncomment to track the number of each kind of object in an .olean file
 // #define LEAN_TAG_COUNTERS
 
 namespace lean {
+/*
+  Open addressing hash table with linear probing used by `object_compactor`. The tables get an entry for every
+  object that is compacted, and entries are never erased. The capacity is a power of two, and the table is at most
+  half full. `Entry()` must be an empty entry, and `Entry` must provide `bool empty() const` and `uint64 hash() const`.
+*/
+template<typename Entry>
+struct compactor_table {
+    std::vector<Entry> m_entries;
+    size_t             m_size  = 0;
+    unsigned           m_shift = 64;
+
+    compactor_table() { resize(LEAN_COMPACTOR_TABLE_INITIAL_SIZE); }
+
+    /* Fibonacci hashing, `m_shift` is `64 - log2(capacity)`. */
+    size_t home(uint64 h) const { return static_cast<size_t>((h * 0x9E3779B97F4A7C15ull) >> m_shift); }
+
+    size_t next(size_t i) const { return (i + 1) & (m_entries.size() - 1); }
+
+    void resize(size_t new_capacity) {
+        std::vector<Entry> old_entries(new_capacity, Entry());
+        old_entries.swap(m_entries);
+        m_shift = 64;
+        while ((static_cast<size_t>(1) << (64 - m_shift)) < new_capacity)
+            m_shift--;
+        for (Entry const & e : old_entries) {
+            if (!e.empty()) {
+                size_t i = home(e.hash());
+                while (!m_entries[i].empty())
+                    i = next(i);
+                m_entries[i] = e;
+            }
+        }
+    }
 
-struct max_sharing_key {
-    size_t m_offset;
-    size_t m_size;
-    max_sharing_key(size_t offset, size_t sz):m_offset(offset), m_size(sz) {}
+    /* Make sure that a new entry can be inserted. */
+    void reserve_one() {
+        if (2 * (m_size + 1) > m_entries.size())
+            resize(2 * m_entries.size());
+    }
 };
 
-struct max_sharing_hash {
-    object_compactor * m;
-    max_sharing_hash(object_compactor * manager):m(manager) {}
-    unsigned operator()(max_sharing_key const & k) const {
-        return hash_str(k.m_size, reinterpret_cast<char const *>(m->m_begin) + k.m_offset, 17);
-    }
+struct object_table_entry {
+    object *      m_obj;
+    object_offset m_offset;
+    bool empty() const { return m_obj == nullptr; }
+    // objects are word aligned
+    uint64 hash() const { return reinterpret_cast<size_t>(m_obj) / sizeof(void*); }
 };
 
-struct max_sharing_eq {
-    object_compactor * m;
-    max_sharing_eq(object_compactor * manager):m(manager) {}
-    bool operator()(max_sharing_key const & k1, max_sharing_key const & k2) const {
-        if (k1.m_size != k2.m_size) return false;
-        return memcmp(reinterpret_cast<char*>(m->m_begin) + k1.m_offset, reinterpret_cast<char*>(m->m_begin) + k2.m_offset, k1.m_size) == 0;
+/* Map from objects to their offsets in the compacted data. */
+struct object_compactor::object_table : public compactor_table<object_table_entry> {
+    /* Return the offset of `o`, or `nullptr` if `o` has not been compacted yet. */
+    object_offset const * find(object * o) const {
+        size_t i = home(object_table_entry{o, nullptr}.hash());
+        while (true) {
+            object_table_entry const & e = m_entries[i];
+            if (e.m_obj == o)
+                return &e.m_offset;
+            if (e.empty())
+                return nullptr;
+            i = next(i);
+        }
+    }
+
+    void insert(object * o, object_offset offset) {
+        reserve_one();
+        object_table_entry new_e{o, offset};
+        size_t i = home(new_e.hash());
+        while (!m_entries[i].empty()) {
+            lean_assert(m_entries[i].m_obj != o);
+            i = next(i);
+        }
+        m_entries[i] = new_e;
+        m_size++;
     }
 };
 
+struct max_sharing_table_entry {
+    uint64 m_hash;
+    size_t m_offset;
+    // `0` iff the entry is empty
+    size_t m_size;
+    bool empty() const { return m_size == 0; }
+    uint64 hash() const { return m_hash; }
+};
 
-struct object_compactor::max_sharing_table {
-    std::unordered_set<max_sharing_key, max_sharing_hash, max_sharing_eq> m_table;
-    max_sharing_table(object_compactor * manager):
-        m_table(LEAN_MAX_SHARING_TABLE_INITIAL_SIZE, max_sharing_hash(manager), max_sharing_eq(manager)) {
+/*
+  Set of the objects in the compacted data, compared by their content. Objects are identified by their offset
+  and size in the compacted data, so the table remains valid when the data is moved. The hash of each object
+  is stored in the table, which avoids most `memcmp` calls and rehashing the objects when the table grows.
+*/
+struct object_compactor::max_sharing_table : public compactor_table<max_sharing_table_entry> {
+    /* If the compacted data `begin` already contains an object equal to the `sz` bytes at `offset`, return its
+       offset. Otherwise, insert the object and return `offset`. */
+    size_t find_or_insert(char const * begin, size_t offset, size_t sz) {
+        lean_assert(sz > 0);
+        reserve_one();
+        uint64 h = hash_str64(sz, begin + offset, 17);
+        size_t i = home(h);
+        while (true) {
+            max_sharing_table_entry const & e = m_entries[i];
+            if (e.empty())
+                break;
+            if (e.m_hash == h && e.m_size == sz && memcmp(begin + e.m_offset, begin + offset, sz) == 0)
+                return e.m_offset;
+            i = next(i);
+        }
+        m_entries[i] = max_sharing_table_entry{h, offset, sz};
+        m_size++;
+        return offset;
     }
 };
 
@@ -62,8 +143,10 @@ struct terminator_object {
     lean_object * m_value;
 };
 
-object_compactor::object_compactor():
-    m_max_sharing_table(new max_sharing_table(this)),
+object_compactor::object_compactor(void * base_addr):
+    m_obj_table(new object_table()),
+    m_max_sharing_table(new max_sharing_table()),
+    m_base_addr(base_addr),
     m_begin(malloc(LEAN_COMPACTOR_INIT_SZ)),
     m_end(m_begin),
     m_capacity(static_cast<char*>(m_begin) + LEAN_COMPACTOR_INIT_SZ) {
@@ -84,14 +167,19 @@ void * object_compactor::alloc(size_t sz) {
     size_t rem = sz % sizeof(void*);
     if (rem != 0)
         sz = sz + sizeof(void*) - rem;
-    while (static_cast<char*>(m_end) + sz > m_capacity) {
+    if (static_cast<char*>(m_end) + sz > m_capacity) {
         size_t new_capacity = capacity()*2;
-        void * new_begin = malloc(new_capacity);
-        memcpy(new_begin, m_begin, size());
-        m_end      = static_cast<char*>(new_begin) + size();
-        m_capacity = static_cast<char*>(new_begin) + new_capacity;
-        free(m_begin);
+        while (size() + sz > new_capacity)
+            new_capacity *= 2;
+        // We only use offsets into the buffer, so it can be moved. For big buffers, `realloc` usually
+        // remaps the pages instead of copying the data.
+        size_t old_size  = size();
+        void * new_begin = realloc(m_begin, new_capacity);
+        if (new_begin == nullptr)
+            throw std::bad_alloc();
         m_begin    = new_begin;
+        m_end      = static_cast<char*>(new_begin) + old_size;
+        m_capacity = static_cast<char*>(new_begin) + new_capacity;
     }
     void * r = m_end;
     memset(r, 0, sz);
@@ -102,17 +190,15 @@ void * object_compactor::alloc(size_t sz) {
 
 void object_compactor::save(object * o, object * new_o) {
     lean_assert(m_begin <= new_o && new_o < m_end);
-    m_obj_table.insert(std::make_pair(o, reinterpret_cast<object_offset>(reinterpret_cast<char*>(new_o) - reinterpret_cast<char*>(m_begin))));
+    m_obj_table->insert(o, reinterpret_cast<object_offset>(reinterpret_cast<size_t>(m_base_addr) + (reinterpret_cast<char*>(new_o) - reinterpret_cast<char*>(m_begin))));
 }
 
 void object_compactor::save_max_sharing(object * o, object * new_o, size_t new_o_sz) {
-    max_sharing_key k(reinterpret_cast<char*>(new_o) - reinterpret_cast<char*>(m_begin), new_o_sz);
-    auto it = m_max_sharing_table->m_table.find(k);
-    if (it != m_max_sharing_table->m_table.end()) {
+    size_t offset = reinterpret_cast<char*>(new_o) - reinterpret_cast<char*>(m_begin);
+    size_t shared_offset = m_max_sharing_table->find_or_insert(static_cast<char*>(m_begin), offset, new_o_sz);
+    if (shared_offset != offset) {
         m_end = new_o;
-        new_o = reinterpret_cast<lean_object*>(reinterpret_cast<char*>(m_begin) + it->m_offset);
-    } else {
-        m_max_sharing_table->m_table.insert(k);
+        new_o = reinterpret_cast<lean_object*>(static_cast<char*>(m_begin) + shared_offset);
     }
     save(o, new_o);
 }
@@ -121,12 +207,11 @@ object_offset object_compactor::to_offset(object * o) {
     if (lean_is_scalar(o)) {
         return o;
     } else {
-        auto it = m_obj_table.find(o);
-        if (it == m_obj_table.end()) {
+        if (object_offset const * r = m_obj_table->find(o)) {
+            return *r;
+        } else {
             m_todo.push_back(o);
             return g_null_offset;
-        } else {
-            return it->second;
         }
     }
 }
@@ -268,17 +353,22 @@ bool object_compactor::insert_task(object * o) {
 }
 
 void object_compactor::insert_mpz(object * o) {
-    std::string s       = mpz_value(o).to_string();
-    /* Remark: in the compacted_region object, we use the space after the mpz_object
-       to store the next mpz_object in the region AFTER we convert the string back
-       into an mpz number. So, we use std::max to make sure we have enough space for both. */
-    size_t extra_space  = std::max(s.size() + 1, sizeof(mpz_object*));
-    size_t sz      = sizeof(mpz_object) + extra_space;
-    object * new_o = (lean_object*)alloc(sz);
+    /* We store the limbs right after the mpz_object, and make `_mp_d` point to them relative to `m_base_addr`.
+       So, the compacted number is usable without any conversion when the region is loaded at its base address.
+       Remark: we always reserve at least one limb since GMP assumes `_mp_d` points to valid memory. */
+    __mpz_struct const * v = to_mpz(o)->m_value.m_val;
+    size_t nlimbs  = std::max(mpz_size(v), static_cast<size_t>(1));
+    size_t data_sz = sizeof(mp_limb_t) * nlimbs;
+    size_t sz      = sizeof(mpz_object) + data_sz;
+    mpz_object * new_o = (mpz_object*)alloc(sz);
     lean_set_non_heap_header((lean_object*)new_o, sz, LeanMPZ, 0);
+    char * data    = reinterpret_cast<char*>(new_o) + sizeof(mpz_object);
+    memcpy(data, v->_mp_d, sizeof(mp_limb_t) * mpz_size(v));
+    __mpz_struct * m = new_o->m_value.m_val;
+    m->_mp_alloc   = nlimbs;
+    m->_mp_size    = v->_mp_size;
+    m->_mp_d       = reinterpret_cast<mp_limb_t*>(reinterpret_cast<size_t>(m_base_addr) + (data - static_cast<char*>(m_begin)));
     save(o, (lean_object*)new_o);
-    void * data    = reinterpret_cast<char*>(new_o) + sizeof(mpz_object);
-    memcpy(data, s.c_str(), s.size() + 1);
 }
 
 #ifdef LEAN_TAG_COUNTERS
@@ -324,7 +414,7 @@ void object_compactor::operator()(object * o) {
         m_todo.push_back(o);
         while (!m_todo.empty()) {
             object * curr = m_todo.back();
-            if (m_obj_table.find(curr) != m_obj_table.end()) {
+            if (m_obj_table->find(curr)) {
                 m_todo.pop_back();
                 continue;
             }
@@ -353,32 +443,30 @@ void object_compactor::operator()(object * o) {
     insert_terminator(o);
 }
 
-compacted_region::compacted_region(size_t sz, void * data):
+compacted_region::compacted_region(size_t sz, void * data, void * base_addr, std::function<void()> free_data):
+    m_base_addr(base_addr),
     m_begin(data),
     m_next(data),
     m_end(static_cast<char*>(data)+sz),
-    m_nested_mpzs(nullptr) {
+    m_free_data(free_data) {
+}
+
+compacted_region::compacted_region(size_t sz, void * data):
+    compacted_region(sz, data, nullptr, [=]() { free(data); }) {
 }
 
 compacted_region::compacted_region(object_compactor const & c):
-    m_begin(malloc(c.size())),
-    m_next(m_begin),
-    m_end(static_cast<char*>(m_begin) + c.size()),
-    m_nested_mpzs(nullptr) {
+    compacted_region(c.size(), malloc(c.size())) {
     memcpy(m_begin, c.data(), c.size());
 }
 
 compacted_region::~compacted_region() {
-    while (m_nested_mpzs) {
-        m_nested_mpzs->m_value.~mpz();
-        m_nested_mpzs = *reinterpret_cast<mpz_object**>(reinterpret_cast<char*>(m_nested_mpzs) + sizeof(mpz_object));
-    }
-    free(m_begin);
+    m_free_data();
 }
 
 inline object * compacted_region::fix_object_ptr(object * o) {
     if (lean_is_scalar(o)) return o;
-    return reinterpret_cast<object*>(static_cast<char*>(m_begin) + reinterpret_cast<size_t>(o));
+    return reinterpret_cast<object*>(static_cast<char*>(m_begin) + (reinterpret_cast<size_t>(o) - reinterpret_cast<size_t>(m_base_addr)));
 }
 
 inline void compacted_region::move(size_t d) {
@@ -428,32 +516,22 @@ inline void compacted_region::fix_task(object * o) {
     move(sizeof(lean_task_object));
 }
 
-void compacted_region::fix_mpz(object * o) {
-    move(sizeof(mpz_object));
-    /* convert string after mpz_object into a mpz value */
-    std::string s;
-    size_t sz = 0;
-    char * it = static_cast<char*>(m_next);
-    while (*it) {
-        s.push_back(*it);
-        it++;
-        sz++;
-    }
-    /* use string to initialize memory */
-    new (&(((mpz_object*)o)->m_value)) mpz(s.c_str()); // NOLINT
-    /* update m_nested_mpzs list */
-    *reinterpret_cast<mpz_object**>(m_next) = m_nested_mpzs;
-    m_nested_mpzs = (mpz_object*)o;
-    /* consume region after mpz_object */
-    sz++; // string delimiter
-    if (sz < sizeof(mpz_object*))
-        sz = sizeof(mpz_object*);
-    move(sz);
+inline void compacted_region::fix_mpz(object * o) {
+    __mpz_struct * m = to_mpz(o)->m_value.m_val;
+    m->_mp_d = reinterpret_cast<mp_limb_t*>(fix_object_ptr(reinterpret_cast<object*>(m->_mp_d)));
+    move(o);
 }
 
 object * compacted_region::read() {
     if (m_next == m_end)
         return nullptr; /* all objects have been read */
+    if (m_begin == m_base_addr) {
+        /* The region is at its base address, so no pointer needs to be fixed, and the (single) root
+           is stored in the terminator at the end of the region. */
+        terminator_object * t = reinterpret_cast<terminator_object*>(static_cast<char*>(m_end) - sizeof(terminator_object));
+        m_next = m_end;
+        return t->m_value;
+    }
     while (true) {
         lean_assert(static_cast<char*>(m_next) + sizeof(object) <= m_end);
         object * curr = reinterpret_cast<object*>(m_next);
@@ -5,6 +5,9 @@ Released under Apache 2.0 license as described in the file LICENSE.
 Author: Leonardo de Moura
 */
 #include <cstddef>
+#include <cstring>
+#include <lean/compiler_hints.h>
+#include <lean/hash.h>
 
 namespace lean {
 
@@ -63,4 +66,82 @@ unsigned hash_str(size_t length, char const * str, unsigned init_value) {
     return c;
 }
 
+/* 64-bit string hash based on wyhash (https://github.com/wangyi-fudan/wyhash, public domain).
+   The result only depends on `str[0, len)` and `init_value`, so it is stable across runs.
+   Loads are performed using `memcpy` since `str` may be unaligned. */
+static const uint64 g_hash_secret[4] = {
+    0xa0761d6478bd642full, 0xe7037ed1a0b428dbull, 0x8ebc6af09c88c6e3ull, 0x589965cc75374cc3ull };
+
+static inline void hash_mum(uint64 & a, uint64 & b) {
+#if defined(__SIZEOF_INT128__)
+    __uint128_t r = a;
+    r *= b;
+    a = static_cast<uint64>(r);
+    b = static_cast<uint64>(r >> 64);
+#else
+    uint64 ha = a >> 32, hb = b >> 32, la = static_cast<uint32_t>(a), lb = static_cast<uint32_t>(b);
+    uint64 rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    uint64 t  = rl + (rm0 << 32);
+    uint64 c  = t < rl;
+    uint64 lo = t + (rm1 << 32);
+    c += lo < t;
+    uint64 hi = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+    a = lo;
+    b = hi;
+#endif
+}
+
+static inline uint64 hash_mix(uint64 a, uint64 b) {
+    hash_mum(a, b);
+    return a ^ b;
+}
+
+static inline uint64 read8(char const * p) { uint64 r; memcpy(&r, p, 8); return r; }
+static inline uint64 read4(char const * p) { uint32_t r; memcpy(&r, p, 4); return r; }
+static inline uint64 read3(char const * p, size_t k) {
+    unsigned char const * q = reinterpret_cast<unsigned char const *>(p);
+    return (static_cast<uint64>(q[0]) << 16) | (static_cast<uint64>(q[k >> 1]) << 8) | q[k - 1];
+}
+
+uint64 hash_str64(size_t len, char const * str, uint64 init_value) {
+    uint64 const * s = g_hash_secret;
+    uint64 seed = init_value ^ hash_mix(init_value ^ s[0], s[1]);
+    char const * p = str;
+    uint64 a, b;
+    if (LEAN_LIKELY(len <= 16)) {
+        if (len >= 4) {
+            a = (read4(p) << 32) | read4(p + ((len >> 3) << 2));
+            b = (read4(p + len - 4) << 32) | read4(p + len - 4 - ((len >> 3) << 2));
+        } else if (len > 0) {
+            a = read3(p, len);
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        size_t i = len;
+        if (LEAN_UNLIKELY(i > 48)) {
+            /* three independent lanes */
+            uint64 see1 = seed, see2 = seed;
+            do {
+                seed = hash_mix(read8(p) ^ s[1], read8(p + 8) ^ seed);
+                see1 = hash_mix(read8(p + 16) ^ s[2], read8(p + 24) ^ see1);
+                see2 = hash_mix(read8(p + 32) ^ s[3], read8(p + 40) ^ see2);
+                p += 48; i -= 48;
+            } while (LEAN_LIKELY(i > 48));
+            seed ^= see1 ^ see2;
+        }
+        while (LEAN_UNLIKELY(i > 16)) {
+            seed = hash_mix(read8(p) ^ s[1], read8(p + 8) ^ seed);
+            i -= 16; p += 16;
+        }
+        a = read8(p + i - 16);
+        b = read8(p + i - 8);
+    }
+    a ^= s[1];
+    b ^= seed;
+    hash_mum(a, b);
+    return hash_mix(a ^ s[0] ^ len, b ^ s[1]);
+}
+
 }
@@ -410,6 +410,51 @@ extern "C" obj_res lean_io_get_num_heartbeats(obj_arg /* w */) {
     return io_result_mk_ok(lean_uint64_to_nat(get_num_heartbeats()));
 }
 
+/* releaseFreeMemory : IO Unit */
+extern "C" obj_res lean_io_release_free_memory(obj_arg /* w */) {
+    lean_del_deferred();
+    release_free_memory();
+    return io_result_mk_ok(box(0));
+}
+
+/* setMaxEmptyMemory (sz : USize) : IO Unit */
+extern "C" obj_res lean_io_set_max_empty_memory(size_t sz, obj_arg /* w */) {
+    set_max_empty_memory(sz);
+    return io_result_mk_ok(box(0));
+}
+
+/* setDeleteBudget (n : USize) : IO Unit */
+extern "C" obj_res lean_io_set_delete_budget(size_t n, obj_arg /* w */) {
+    lean_set_del_budget(n);
+    return io_result_mk_ok(box(0));
+}
+
+static obj_res mk_nat_array(uint64_t const * vs, size_t n) {
+    object * r = alloc_array(n, n);
+    for (size_t i = 0; i < n; i++)
+        array_set(r, i, lean_uint64_to_nat(vs[i]));
+    return r;
+}
+
+/* getAllocStats : IO AllocStats */
+extern "C" obj_res lean_io_get_alloc_stats(obj_arg /* w */) {
+    lean_alloc_stats s;
+    lean_get_alloc_stats(&s);
+    uint64_t const fields[] = {
+        s.m_num_big_alloc, s.m_num_big_dealloc, s.m_big_alloc_bytes, s.m_big_dealloc_bytes, s.m_live_bytes,
+        s.m_num_segments, s.m_num_pages, s.m_num_empty_pages, s.m_num_decommitted_pages, s.m_num_remote_frees,
+        s.m_num_exports, s.m_num_imported, s.m_num_medium_reuse, s.m_num_huge_alloc, s.m_num_in_place_resize,
+        s.m_decommitted_bytes, s.m_unmapped_bytes
+    };
+    unsigned num_fields = sizeof(fields) / sizeof(fields[0]);
+    object * r = alloc_cnstr(0, 2 + num_fields, 0);
+    cnstr_set(r, 0, mk_nat_array(s.m_num_small_alloc, LEAN_NUM_SMALL_OBJECT_SLOTS));
+    cnstr_set(r, 1, mk_nat_array(s.m_num_small_dealloc, LEAN_NUM_SMALL_OBJECT_SLOTS));
+    for (unsigned i = 0; i < num_fields; i++)
+        cnstr_set(r, 2 + i, lean_uint64_to_nat(fields[i]));
+    return io_result_mk_ok(r);
+}
+
 extern "C" obj_res lean_io_getenv(b_obj_arg env_var, obj_arg) {
     char * val = std::getenv(string_cstr(env_var));
     if (val) {
@@ -551,25 +596,38 @@ static inline atomic<object*> * mt_ref_val_addr(object * o) {
 */
 static inline bool ref_maybe_mt(b_obj_arg ref) { return lean_is_mt(ref) || lean_is_persistent(ref); }
 
+/*
+  When the value of a multi-threaded `ST.Ref` is `nullptr`, another thread has taken it, and we block until it is
+  put back. Every operation storing a value into such a reference must invoke `unpark_all(ref)`.
+*/
+static inline object * mt_ref_take(b_obj_arg ref) {
+    atomic<object *> * val_addr = mt_ref_val_addr(ref);
+    object * val = val_addr->exchange(nullptr);
+    if (val == nullptr)
+        park_until(ref, [&]() { return (val = val_addr->exchange(nullptr)) != nullptr; });
+    return val;
+}
+
+static inline object * mt_ref_put(b_obj_arg ref, object * val) {
+    object * old = mt_ref_val_addr(ref)->exchange(val);
+    unpark_all(ref);
+    return old;
+}
+
 extern "C" obj_res lean_st_ref_get(b_obj_arg ref, obj_arg) {
     if (ref_maybe_mt(ref)) {
-        atomic<object *> * val_addr = mt_ref_val_addr(ref);
-        while (true) {
-            /*
-              We cannot simply read `val` from the ref and `inc` it like in the `else` branch since someone else could
-              write to the ref in between and remove the last owning reference to the object. Instead, we must take
-              ownership of the RC token in the ref via `exchange`, duplicate it, then put one RC token back. */
-            object * val = val_addr->exchange(nullptr);
-            if (val != nullptr) {
-                inc(val);
-                object * tmp = val_addr->exchange(val);
-                if (tmp != nullptr) {
-                    /* this may happen if another thread wrote `ref` */
-                    dec(tmp);
-                }
-                return io_result_mk_ok(val);
-            }
+        /*
+          We cannot simply read `val` from the ref and `inc` it like in the `else` branch since someone else could
+          write to the ref in between and remove the last owning reference to the object. Instead, we must take
+          ownership of the RC token in the ref via `exchange`, duplicate it, then put one RC token back. */
+        object * val = mt_ref_take(ref);
+        inc(val);
+        object * tmp = mt_ref_put(ref, val);
+        if (tmp != nullptr) {
+            /* this may happen if another thread wrote `ref` */
+            dec(tmp);
         }
+        return io_result_mk_ok(val);
     } else {
         object * val = lean_to_ref(ref)->m_value;
         lean_assert(val != nullptr);
@@ -580,12 +638,7 @@ extern "C" obj_res lean_st_ref_get(b_obj_arg ref, obj_arg) {
 
 extern "C" obj_res lean_st_ref_take(b_obj_arg ref, obj_arg) {
     if (ref_maybe_mt(ref)) {
-        atomic<object *> * val_addr = mt_ref_val_addr(ref);
-        while (true) {
-            object * val = val_addr->exchange(nullptr);
-            if (val != nullptr)
-                return io_result_mk_ok(val);
-        }
+        return io_result_mk_ok(mt_ref_take(ref));
     } else {
         object * val = lean_to_ref(ref)->m_value;
         lean_assert(val != nullptr);
@@ -602,8 +655,7 @@ extern "C" obj_res lean_st_ref_set(b_obj_arg ref, obj_arg a, obj_arg) {
            Reason: our runtime relies on the fact that a single-threaded object
            cannot be reached from a multi-thread object. */
         mark_mt(a);
-        atomic<object *> * val_addr = mt_ref_val_addr(ref);
-        object * old_a = val_addr->exchange(a);
+        object * old_a = mt_ref_put(ref, a);
         if (old_a != nullptr)
             dec(old_a);
         return io_result_mk_ok(box(0));
@@ -622,6 +674,7 @@ extern "C" obj_res lean_st_ref_swap(b_obj_arg ref, obj_arg a, obj_arg) {
         atomic<object *> * val_addr = mt_ref_val_addr(ref);
         while (true) {
             object * old_a = val_addr->exchange(a);
+            unpark_all(ref);
             if (old_a != nullptr)
                 return io_result_mk_ok(old_a);
         }
@@ -8,7 +8,10 @@ Author: Leonardo de Moura
 #include <algorithm>
 #include <vector>
 #include <deque>
+#include <atomic>
+#include <memory>
 #include <cmath>
+#include <limits>
 #include <lean/object.h>
 #include <lean/mpq.h>
 #include <lean/thread.h>
@@ -22,6 +25,7 @@ Author: Leonardo de Moura
 
 // see `Task.Priority.max`
 #define LEAN_MAX_PRIO 8
+#define LEAN_TASK_DEQUE_INIT_CAPACITY 64
 
 namespace lean {
 extern "C" void lean_internal_panic(char const * msg) {
@@ -100,6 +104,17 @@ static inline void lean_dealloc(lean_object * o, size_t sz) {
 #endif
 }
 
+/* Resize an object allocated with `lean_alloc_object`. */
+static inline lean_object * lean_realloc(lean_object * o, size_t old_sz, size_t new_sz) {
+#ifdef LEAN_SMALL_ALLOCATOR
+    return static_cast<lean_object*>(reallocate(o, old_sz, new_sz));
+#else
+    void * r = realloc(o, new_sz);
+    if (r == nullptr) lean_internal_panic_out_of_memory();
+    return static_cast<lean_object*>(r);
+#endif
+}
+
 extern "C" void lean_free_object(lean_object * o) {
     switch (lean_ptr_tag(o)) {
     case LeanArray:       return lean_dealloc(o, lean_array_byte_size(o));
@@ -154,12 +169,54 @@ LEAN_THREAD_PTR(object, g_to_free);
 
 static void lean_del_core(object * o, object * & todo);
 
+/* Maximum number of objects freed by each `lean_del` call, 0 if there is no limit.
+   The remaining objects are stored at `g_deferred_del`, and they are freed by the next calls to
+   `lean_del` and by the next allocations (see `del_deferred_step`), by `lean_del_deferred`, or when the thread finishes.
+   Remark: objects are still freed by the thread that released them. */
+static atomic<size_t> g_del_budget(0);
+LEAN_THREAD_GLOBAL_PTR(object, g_deferred_del);
+LEAN_THREAD_VALUE(bool, g_deferred_del_finalizer, false);
+
+/* Free at most `budget` deferred objects, all of them if `budget == 0`. */
+static void del_deferred(size_t budget) {
+    if (budget == 0)
+        budget = std::numeric_limits<size_t>::max();
+    while (g_deferred_del != nullptr && budget > 0) {
+        object * o = pop_back(g_deferred_del);
+        lean_del_core(o, g_deferred_del);
+        budget--;
+    }
+}
+
+static void del_deferred_finalizer(void *) {
+    del_deferred(0);
+}
+
+/* Invoked by the allocator when `g_deferred_del` is not empty. If the budget has been reset to 0,
+   the remaining deferred objects are freed at once. */
+void del_deferred_step() {
+    del_deferred(g_del_budget.load(memory_order_relaxed));
+}
+
+extern "C" void lean_set_del_budget(size_t budget) {
+    g_del_budget.store(budget, memory_order_relaxed);
+    if (budget == 0)
+        del_deferred(0);
+}
+
+extern "C" void lean_del_deferred() {
+    del_deferred(0);
+}
+
 extern "C" lean_object * lean_alloc_object(size_t sz) {
 #ifdef LEAN_LAZY_RC
      if (g_to_free) {
          object * o = pop_back(g_to_free);
          lean_del_core(o, g_to_free);
      }
+#else
+    if (g_deferred_del)
+        del_deferred_step();
 #endif
 #ifdef LEAN_SMALL_ALLOCATOR
     return (lean_object*)alloc(sz);
@@ -231,12 +288,23 @@ extern "C" void lean_del(object * o) {
 #ifdef LEAN_LAZY_RC
     push_back(g_to_free, o);
 #else
-    object * todo = nullptr;
-    while (true) {
-        lean_del_core(o, todo);
-        if (todo == nullptr)
-            return;
-        o = pop_back(todo);
+    size_t budget = g_del_budget.load(memory_order_relaxed);
+    if (LEAN_LIKELY(budget == 0)) {
+        object * todo = nullptr;
+        while (true) {
+            lean_del_core(o, todo);
+            if (todo == nullptr)
+                return;
+            o = pop_back(todo);
+        }
+    } else {
+        /* We process `o` and its children before older deferred objects. */
+        push_back(g_deferred_del, o);
+        del_deferred(budget);
+        if (g_deferred_del && !g_deferred_del_finalizer) {
+            g_deferred_del_finalizer = true;
+            register_thread_finalizer(del_deferred_finalizer, nullptr);
+        }
     }
 #endif
 }
@@ -306,14 +374,13 @@ extern "C" b_obj_res lean_thunk_get_core(b_obj_arg t) {
         lean_assert(lean_to_thunk(t)->m_value == nullptr);
         mark_mt(r);
         lean_to_thunk(t)->m_value = r;
+        unpark_all(t);
         return r;
     } else {
         lean_assert(c == nullptr);
-        /* There is another thread executing the closure. We keep waiting for the m_value to be
+        /* There is another thread executing the closure. We wait for the m_value to be
            set by another thread. */
-        while (!lean_to_thunk(t)->m_value) {
-            this_thread::yield();
-        }
+        park_until(t, [&]() { return lean_to_thunk(t)->m_value.load() != nullptr; });
         return lean_to_thunk(t)->m_value;
     }
 }
@@ -508,6 +575,11 @@ extern "C" void lean_mark_persistent(object * o) {
     }
 }
 
+extern "C" obj_res lean_runtime_mark_persistent(obj_arg a, obj_arg /* w */) {
+    lean_mark_persistent(a);
+    return lean_io_result_mk_ok(a);
+}
+
 // =======================================
 // Mark MT
 
@@ -519,18 +591,160 @@ static obj_res mark_mt_fn(obj_arg o) {
     return lean_box(0);
 }
 
+#if defined(LEAN_BIASED_RC)
+// =======================================
+// Biased reference counting, see comment at `lean_brc_inc`
+
+#define LEAN_BRC_MAX_OWNERS (1u << 16)
+
+extern "C" {
+#ifdef _MSC_VER
+__declspec(thread) uint16_t lean_brc_thread_id = 0;
+#else
+__thread uint16_t lean_brc_thread_id = 0;
+#endif
+}
+
+/* Objects whose shared counter became negative, and must be merged by their owner. */
+struct brc_owner {
+    mutex                m_mutex;
+    std::vector<object*> m_queue;
+    atomic<bool>         m_has_queue{false};
+    bool                 m_finished{false};
+};
+
+/* Owner identifiers are never reused. Thus, we never delete `brc_owner` objects. */
+static brc_owner *    g_brc_owners[LEAN_BRC_MAX_OWNERS];
+static atomic<unsigned> g_brc_next_owner(1);
+LEAN_THREAD_PTR(brc_owner, g_brc_owner);
+
+/* Merge the biased counter of `o` into its shared counter, and remove the `LEAN_BRC_QUEUED` flag.
+   The caller must be the owner of `o`, or the owner must have finished. */
+static void brc_merge_queued(object * o) {
+    atomic<size_t> * rc = reinterpret_cast<atomic<size_t>*>(lean_get_rc_mt_addr(o));
+    if ((rc->load(memory_order_relaxed) & LEAN_BRC_MERGED) == 0) {
+        size_t biased = o->m_biased_rc;
+        o->m_biased_rc = 0;
+        rc->fetch_add(biased + LEAN_BRC_MERGED, memory_order_acq_rel);
+    }
+    size_t old = rc->fetch_and(~static_cast<size_t>(LEAN_BRC_QUEUED), memory_order_acq_rel);
+    /* Remark: `o` may have been marked persistent after it was queued. */
+    if ((old & LEAN_BRC_COUNT_MASK) == LEAN_BRC_ZERO && lean_is_mt(o))
+        lean_del(o);
+}
+
+static void brc_process_queue(brc_owner * owner) {
+    std::vector<object*> todo;
+    {
+        unique_lock<mutex> lock(owner->m_mutex);
+        std::swap(todo, owner->m_queue);
+        owner->m_has_queue.store(false, memory_order_relaxed);
+    }
+    for (object * o : todo)
+        brc_merge_queued(o);
+}
+
+/* Process the objects other threads have queued for the current thread. */
+static inline void brc_process_queue() {
+    brc_owner * owner = g_brc_owner;
+    if (owner && owner->m_has_queue.load(memory_order_relaxed))
+        brc_process_queue(owner);
+}
+
+static void brc_finalize_owner(void * p) {
+    brc_owner * owner = static_cast<brc_owner*>(p);
+    std::vector<object*> todo;
+    {
+        unique_lock<mutex> lock(owner->m_mutex);
+        std::swap(todo, owner->m_queue);
+        owner->m_has_queue.store(false, memory_order_relaxed);
+        owner->m_finished = true;
+    }
+    for (object * o : todo)
+        brc_merge_queued(o);
+    /* We keep `g_brc_owner` to make sure the thread does not get a new identifier
+       if it marks objects in other thread finalizers. */
+    lean_brc_thread_id = 0;
+}
+
+/* Return the owner identifier for the current thread, or 0 if all identifiers have been used. */
+static uint16_t brc_get_thread_id() {
+    if (lean_brc_thread_id != 0 || g_brc_owner != nullptr)
+        return lean_brc_thread_id;
+    if (g_brc_next_owner.load(memory_order_relaxed) >= LEAN_BRC_MAX_OWNERS)
+        return 0;
+    unsigned id = g_brc_next_owner.fetch_add(1);
+    if (id >= LEAN_BRC_MAX_OWNERS)
+        return 0;
+    brc_owner * owner = new brc_owner();
+    g_brc_owners[id]   = owner;
+    g_brc_owner        = owner;
+    lean_brc_thread_id = static_cast<uint16_t>(id);
+    register_thread_finalizer(brc_finalize_owner, owner);
+    return lean_brc_thread_id;
+}
+
+extern "C" bool lean_brc_merge(object * o) {
+    atomic<size_t> * rc = reinterpret_cast<atomic<size_t>*>(lean_get_rc_mt_addr(o));
+    size_t old = rc->fetch_or(LEAN_BRC_MERGED, memory_order_acq_rel);
+    return (old & (LEAN_BRC_COUNT_MASK | LEAN_BRC_QUEUED)) == LEAN_BRC_ZERO;
+}
+
+extern "C" void lean_brc_queue(object * o) {
+    atomic<size_t> * rc = reinterpret_cast<atomic<size_t>*>(lean_get_rc_mt_addr(o));
+    if ((rc->fetch_or(LEAN_BRC_QUEUED, memory_order_acq_rel) & LEAN_BRC_QUEUED) != 0)
+        return; /* another thread has already queued `o` */
+    brc_owner * owner = g_brc_owners[o->m_owner];
+    {
+        unique_lock<mutex> lock(owner->m_mutex);
+        if (!owner->m_finished) {
+            owner->m_queue.push_back(o);
+            owner->m_has_queue.store(true, memory_order_relaxed);
+            return;
+        }
+    }
+    brc_merge_queued(o);
+}
+
+static inline void brc_set_mt(object * o, uint16_t owner) {
+    size_t rc = o->m_rc;
+    if (owner != 0 && rc <= LEAN_BRC_MAX_BIASED) {
+        o->m_owner     = owner;
+        o->m_biased_rc = static_cast<uint16_t>(rc);
+        o->m_rc        = LEAN_BRC_ZERO;
+    } else {
+        o->m_owner     = 0;
+        o->m_biased_rc = 0;
+        o->m_rc        = (LEAN_BRC_ZERO + rc) | LEAN_BRC_MERGED;
+    }
+}
+#else
+static inline void brc_process_queue() {}
+#endif
+
+/* Only single threaded objects need to be visited by `lean_mark_mt`. In particular, we do not visit
+   the objects stored in compacted regions (e.g., imported .olean files) or marked with `Runtime.markPersistent`. */
+static inline void push_st(buffer<object*> & todo, object * o) {
+    if (!lean_is_scalar(o) && lean_is_st(o))
+        todo.push_back(o);
+}
+
 extern "C" void lean_mark_mt(object * o) {
 #ifndef LEAN_MULTI_THREAD
     return;
 #endif
     if (lean_is_scalar(o) || !lean_is_st(o)) return;
 
+#if defined(LEAN_BIASED_RC)
+    uint16_t owner = brc_get_thread_id();
+#endif
     buffer<object*> todo;
     todo.push_back(o);
     while (!todo.empty()) {
         object * o = todo.back();
         todo.pop_back();
-        if (!lean_is_scalar(o) && lean_is_st(o)) {
+        /* `o` may have been pushed more than once */
+        if (lean_is_st(o)) {
 #if defined(LEAN_COMPRESSED_OBJECT_HEADER)
             o->m_header &= ~(1ull << LEAN_ST_BIT);
             o->m_header |=  (1ull << LEAN_MT_BIT);
@@ -538,12 +752,15 @@ extern "C" void lean_mark_mt(object * o) {
             LEAN_BYTE(o->m_header, 5) = LEAN_MT_MEM_KIND;
 #else
             o->m_mem_kind = LEAN_MT_MEM_KIND;
+#if defined(LEAN_BIASED_RC)
+            brc_set_mt(o, owner);
+#endif
 #endif
             uint8_t tag = lean_ptr_tag(o);
             if (tag <= LeanMaxCtorTag) {
                 object ** it  = lean_ctor_obj_cptr(o);
                 object ** end = it + lean_ctor_num_objs(o);
-                for (; it != end; ++it) todo.push_back(*it);
+                for (; it != end; ++it) push_st(todo, *it);
             } else {
                 switch (tag) {
                 case LeanScalarArray:
@@ -557,26 +774,26 @@ extern "C" void lean_mark_mt(object * o) {
                     break;
                 }
                 case LeanTask:
-                    todo.push_back(lean_task_get(o));
+                    push_st(todo, lean_task_get(o));
                     break;
                 case LeanClosure: {
                     object ** it  = lean_closure_arg_cptr(o);
                     object ** end = it + lean_closure_num_fixed(o);
-                    for (; it != end; ++it) todo.push_back(*it);
+                    for (; it != end; ++it) push_st(todo, *it);
                     break;
                 }
                 case LeanArray: {
                     object ** it  = lean_array_cptr(o);
                     object ** end = it + lean_array_size(o);
-                    for (; it != end; ++it) todo.push_back(*it);
+                    for (; it != end; ++it) push_st(todo, *it);
                     break;
                 }
                 case LeanThunk:
-                    if (object * c = lean_to_thunk(o)->m_closure) todo.push_back(c);
-                    if (object * v = lean_to_thunk(o)->m_value) todo.push_back(v);
+                    if (object * c = lean_to_thunk(o)->m_closure) push_st(todo, c);
+                    if (object * v = lean_to_thunk(o)->m_value) push_st(todo, v);
                     break;
                 case LeanRef:
-                    if (object * v = lean_to_ref(o)->m_value) todo.push_back(v);
+                    if (object * v = lean_to_ref(o)->m_value) push_st(todo, v);
                     break;
                 default:
                     lean_unreachable();
@@ -597,6 +814,7 @@ static lean_task_imp * alloc_task_imp(obj_arg c, unsigned prio, bool keep_alive)
     imp->m_closure     = c;
     imp->m_head_dep    = nullptr;
     imp->m_next_dep    = nullptr;
+    imp->m_head_waiter = nullptr;
     imp->m_prio        = prio;
     imp->m_canceled    = false;
     imp->m_keep_alive  = keep_alive;
@@ -617,36 +835,233 @@ struct scoped_current_task_object : flet<lean_task_object *> {
     scoped_current_task_object(lean_task_object * t):flet(g_current_task_object, t) {}
 };
 
+/* Work-stealing deque of tasks (Chase-Lev). The owner thread pushes and takes tasks at the bottom without
+   locking, and other threads steal tasks from the top.
+   See "Correct and Efficient Work-Stealing for Weak Memory Models", Lê et al., PPoPP 2013. */
+class task_deque {
+    struct ring {
+        int64_t                                            m_mask;
+        std::unique_ptr<std::atomic<lean_task_object *>[]> m_data;
+        explicit ring(int64_t capacity):m_mask(capacity - 1), m_data(new std::atomic<lean_task_object *>[capacity]) {}
+        int64_t capacity() const { return m_mask + 1; }
+        lean_task_object * get(int64_t i) const { return m_data[i & m_mask].load(std::memory_order_relaxed); }
+        void put(int64_t i, lean_task_object * t) { m_data[i & m_mask].store(t, std::memory_order_relaxed); }
+    };
+    std::atomic<int64_t> m_top{0};
+    std::atomic<int64_t> m_bottom{0};
+    std::atomic<ring *>  m_ring;
+    /* Rings replaced by `push` may still be read by thieves, we only delete them when the deque is deleted. */
+    std::vector<ring *>  m_old_rings;
+public:
+    task_deque():m_ring(new ring(LEAN_TASK_DEQUE_INIT_CAPACITY)) {}
+    ~task_deque() {
+        delete m_ring.load(std::memory_order_relaxed);
+        for (ring * r : m_old_rings) delete r;
+    }
+
+    bool empty() const {
+        return m_top.load(std::memory_order_relaxed) >= m_bottom.load(std::memory_order_relaxed);
+    }
+
+    /* Remark: only the owner thread may invoke this method. */
+    void push(lean_task_object * t) {
+        int64_t b = m_bottom.load(std::memory_order_relaxed);
+        int64_t f = m_top.load(std::memory_order_acquire);
+        ring * r  = m_ring.load(std::memory_order_relaxed);
+        if (b - f > r->capacity() - 1) {
+            ring * new_r = new ring(2 * r->capacity());
+            for (int64_t i = f; i < b; i++)
+                new_r->put(i, r->get(i));
+            m_old_rings.push_back(r);
+            m_ring.store(new_r, std::memory_order_release);
+            r = new_r;
+        }
+        r->put(b, t);
+        std::atomic_thread_fence(std::memory_order_release);
+        m_bottom.store(b + 1, std::memory_order_relaxed);
+    }
+
+    /* Remove the most recently pushed task. Remark: only the owner thread may invoke this method. */
+    lean_task_object * take() {
+        int64_t b = m_bottom.load(std::memory_order_relaxed) - 1;
+        ring * r  = m_ring.load(std::memory_order_relaxed);
+        m_bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t f = m_top.load(std::memory_order_relaxed);
+        if (f > b) {
+            /* deque is empty */
+            m_bottom.store(b + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        lean_task_object * t = r->get(b);
+        if (f == b) {
+            /* last task, we must compete with thieves */
+            if (!m_top.compare_exchange_strong(f, f + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                t = nullptr;
+            m_bottom.store(b + 1, std::memory_order_relaxed);
+        }
+        return t;
+    }
+
+    /* Remove the least recently pushed task. It is safe to invoke this method from any thread.
+       Return `nullptr` only if the deque was empty. */
+    lean_task_object * steal() {
+        while (true) {
+            int64_t f = m_top.load(std::memory_order_acquire);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            int64_t b = m_bottom.load(std::memory_order_acquire);
+            if (f >= b)
+                return nullptr;
+            ring * r = m_ring.load(std::memory_order_acquire);
+            lean_task_object * t = r->get(f);
+            if (m_top.compare_exchange_strong(f, f + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                return t;
+            /* lost the race with another thief or the owner, try again */
+        }
+    }
+};
+
+/* Ready queues of a standard worker, one per priority. */
+struct task_worker {
+    unsigned   m_idx;
+    task_deque m_queues[LEAN_MAX_PRIO+1];
+};
+
+LEAN_THREAD_PTR(task_worker, g_current_worker);
+
+/* A thread blocked in `task_manager::wait_for` or `task_manager::wait_any`. */
+struct task_waiter {
+    condition_variable m_cv;
+    /* The task that woke up the thread. */
+    lean_task_object * m_finished{nullptr};
+};
+}
+
+/* Registration of a `task_waiter` at one of the tasks it is waiting for. A thread waiting for several tasks has one
+   node for each of them, and is woken up by the first one that finishes. The nodes are stored in a doubly linked list
+   at `lean_task_imp::m_head_waiter`, so that they can be removed in constant time. They live in the stack of the
+   waiting thread, and are protected by `task_manager::m_mutex`. */
+struct lean_task_waiter_node {
+    lean::task_waiter *     m_waiter;
+    /* `nullptr` if the node has been removed from the list of its task. */
+    lean_task_object *      m_task;
+    lean_task_waiter_node * m_prev;
+    lean_task_waiter_node * m_next;
+};
+
+namespace lean {
+
 class task_manager {
+    /* `m_mutex` protects the state of the tasks: dependencies, cancellation and deletion.
+       The ready queues are not protected by it. */
     mutex                                         m_mutex;
-    unsigned                                      m_num_std_workers{0};
+    std::atomic<unsigned>                         m_num_std_workers{0};
     unsigned                                      m_max_std_workers{0};
-    unsigned                                      m_num_dedicated_workers{0};
+    std::atomic<unsigned>                         m_num_dedicated_workers{0};
+    /* Ready queues of the standard workers. Tasks enqueued by a standard worker are pushed into its own queues,
+       and idle workers steal from the others. */
+    std::unique_ptr<task_worker[]>                m_workers;
+    /* Ready queues for tasks enqueued by threads that are not standard workers, protected by `m_queue_mutex`. */
+    mutex                                         m_queue_mutex;
     std::deque<lean_task_object *>                m_queues[LEAN_MAX_PRIO+1];
-    unsigned                                      m_queues_size{0};
-    unsigned                                      m_max_prio{0};
+    std::atomic<unsigned>                         m_queues_size{0};
+    /* Number of workers waiting at `m_queue_cv`, and number of pending wake ups. Protected by `m_queue_mutex`,
+       but `m_num_idle_workers` is also read without holding it. */
+    std::atomic<unsigned>                         m_num_idle_workers{0};
+    unsigned                                      m_num_wakeups{0};
     condition_variable                            m_queue_cv;
-    condition_variable                            m_task_finished_cv;
     condition_variable                            m_worker_finished_cv;
-    bool                                          m_shutting_down{false};
-
-    lean_task_object * dequeue() {
-        lean_assert(m_queues_size != 0);
-        std::deque<lean_task_object *> & q = m_queues[m_max_prio];
-        lean_assert(!q.empty());
-        lean_task_object * result      = q.front();
+    std::atomic<bool>                             m_shutting_down{false};
+
+    /* Remark: `m_queue_mutex` must be held. */
+    lean_task_object * dequeue_shared(unsigned prio) {
+        std::deque<lean_task_object *> & q = m_queues[prio];
+        if (q.empty())
+            return nullptr;
+        lean_task_object * result = q.front();
         q.pop_front();
         m_queues_size--;
-        if (q.empty()) {
-            while (m_max_prio > 0) {
-                --m_max_prio;
-                if (!m_queues[m_max_prio].empty())
-                    break;
+        return result;
+    }
+
+    /* Return a ready task with the highest priority available, or `nullptr` if there is none.
+       We first look at the queues of `w` and the shared ones, and then try to steal from other workers.
+       `m_queue_mutex` must be held iff `queue_locked` is true. */
+    lean_task_object * dequeue(task_worker * w, bool queue_locked) {
+        unsigned num_workers = std::min(m_num_std_workers.load(std::memory_order_acquire), m_max_std_workers);
+        for (int prio = LEAN_MAX_PRIO; prio >= 0; prio--) {
+            if (!w->m_queues[prio].empty()) {
+                if (lean_task_object * t = w->m_queues[prio].take())
+                    return t;
+            }
+            if (m_queues_size.load(std::memory_order_relaxed) > 0) {
+                lean_task_object * t;
+                if (queue_locked) {
+                    t = dequeue_shared(prio);
+                } else {
+                    lock_guard<mutex> lock(m_queue_mutex);
+                    t = dequeue_shared(prio);
+                }
+                if (t) return t;
+            }
+            for (unsigned i = 1; i < num_workers; i++) {
+                task_deque & q = m_workers[(w->m_idx + i) % num_workers].m_queues[prio];
+                if (!q.empty()) {
+                    if (lean_task_object * t = q.steal())
+                        return t;
+                }
+            }
+        }
+        return nullptr;
+    }
+
+    /* Block until a task is available. Return `nullptr` if the task manager is shutting down and there are no tasks left. */
+    lean_task_object * wait_for_task(task_worker * w) {
+        unique_lock<mutex> lock(m_queue_mutex);
+        while (true) {
+            m_num_idle_workers++;
+            /* Make sure `enqueue_core` either sees us as idle or we see the new task, see `wake_worker`. */
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (lean_task_object * t = dequeue(w, true)) {
+                m_num_idle_workers--;
+                return t;
+            }
+            if (m_shutting_down) {
+                m_num_idle_workers--;
+                return nullptr;
+            }
+            m_queue_cv.wait(lock, [&]() { return m_num_wakeups > 0 || m_shutting_down; });
+            if (m_num_wakeups > 0) {
+                /* `wake_worker` has already removed us from the idle workers */
+                m_num_wakeups--;
+            } else {
+                m_num_idle_workers--;
+            }
+        }
+    }
+
+    /* Make sure some worker will execute the task that has just been enqueued. */
+    void wake_worker() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (m_num_idle_workers.load(std::memory_order_relaxed) > 0) {
+            lock_guard<mutex> lock(m_queue_mutex);
+            if (m_num_idle_workers > 0) {
+                m_num_idle_workers--;
+                m_num_wakeups++;
+                m_queue_cv.notify_one();
+                return;
+            }
+        }
+        unsigned n = m_num_std_workers.load();
+        while (n < m_max_std_workers) {
+            if (m_num_std_workers.compare_exchange_weak(n, n + 1)) {
+                spawn_worker(n);
+                return;
             }
         }
-        return result;
     }
 
+    /* Remark: `m_mutex` may or may not be held. */
     void enqueue_core(lean_task_object * t) {
         lean_assert(t->m_imp);
         unsigned prio = t->m_imp->m_prio;
@@ -654,14 +1069,14 @@ class task_manager {
             spawn_dedicated_worker(t);
             return;
         }
-        if (prio > m_max_prio)
-            m_max_prio = prio;
-        m_queues[prio].push_back(t);
-        m_queues_size++;
-        if (m_num_std_workers < m_max_std_workers)
-            spawn_worker();
-        else
-            m_queue_cv.notify_one();
+        if (task_worker * w = g_current_worker) {
+            w->m_queues[prio].push(t);
+        } else {
+            lock_guard<mutex> lock(m_queue_mutex);
+            m_queues[prio].push_back(t);
+            m_queues_size++;
+        }
+        wake_worker();
     }
 
     void deactivate_task_core(unique_lock<mutex> & lock, lean_task_object * t) {
@@ -682,24 +1097,22 @@ class task_manager {
         lock.lock();
     }
 
-    void spawn_worker() {
-        m_num_std_workers++;
-        lthread([this]() {
+    void spawn_worker(unsigned idx) {
+        lthread([this, idx]() {
             save_stack_info(false);
-            unique_lock<mutex> lock(m_mutex);
+            task_worker * w  = &m_workers[idx];
+            g_current_worker = w;
             while (true) {
-                if (m_queues_size == 0) {
-                    if (m_shutting_down) {
-                        break;
-                    }
-                    m_queue_cv.wait(lock);
-                    continue;
-                }
-
-                lean_task_object * t = dequeue();
+                brc_process_queue();
+                lean_task_object * t = dequeue(w, false);
+                if (!t) t = wait_for_task(w);
+                if (!t) break;
+                unique_lock<mutex> lock(m_mutex);
                 run_task(lock, t);
                 reset_heartbeat();
             }
+            g_current_worker = nullptr;
+            unique_lock<mutex> lock(m_mutex);
             m_num_std_workers--;
             m_worker_finished_cv.notify_all();
         });
@@ -749,11 +1162,11 @@ class task_manager {
             handle_finished(t);
             mark_mt(v);
             t->m_value = v;
+            notify_waiters(t);
             /* After the task has been finished and we propagated
                dependecies, we can release `m_imp` and keep just the value */
             free_task_imp(t->m_imp);
             t->m_imp   = nullptr;
-            m_task_finished_cv.notify_all();
         } else {
             // `bind` task has not finished yet, re-add as dependency of nested task
             lock.unlock();
@@ -779,6 +1192,47 @@ class task_manager {
         }
     }
 
+    /* Remark: `m_mutex` must be held. */
+    void add_waiter(lean_task_object * t, lean_task_waiter_node * n, task_waiter * w) {
+        lean_assert(t->m_imp && !t->m_value);
+        lean_task_waiter_node * head = t->m_imp->m_head_waiter;
+        n->m_waiter = w;
+        n->m_task   = t;
+        n->m_prev   = nullptr;
+        n->m_next   = head;
+        if (head) head->m_prev = n;
+        t->m_imp->m_head_waiter = n;
+    }
+
+    /* Remark: `m_mutex` must be held. */
+    void remove_waiter(lean_task_waiter_node * n) {
+        if (!n->m_task)
+            return;
+        if (n->m_prev)
+            n->m_prev->m_next = n->m_next;
+        else
+            n->m_task->m_imp->m_head_waiter = n->m_next;
+        if (n->m_next)
+            n->m_next->m_prev = n->m_prev;
+        n->m_task = nullptr;
+    }
+
+    /* Wake up the threads waiting for `t`, which has just finished. Remark: `m_mutex` must be held. */
+    void notify_waiters(lean_task_object * t) {
+        lean_task_waiter_node * n = t->m_imp->m_head_waiter;
+        t->m_imp->m_head_waiter = nullptr;
+        while (n) {
+            lean_task_waiter_node * next = n->m_next;
+            n->m_task = nullptr;
+            task_waiter * w = n->m_waiter;
+            if (!w->m_finished) {
+                w->m_finished = t;
+                w->m_cv.notify_one();
+            }
+            n = next;
+        }
+    }
+
     object * wait_any_check(object * task_list) {
         object * it = task_list;
         while (!is_scalar(it)) {
@@ -792,19 +1246,24 @@ class task_manager {
 
 public:
     task_manager(unsigned max_std_workers):
-        m_max_std_workers(max_std_workers) {
+        m_max_std_workers(max_std_workers),
+        m_workers(new task_worker[max_std_workers]) {
+        for (unsigned i = 0; i < max_std_workers; i++)
+            m_workers[i].m_idx = i;
     }
 
     ~task_manager() {
+        {
+            lock_guard<mutex> lock(m_queue_mutex);
+            m_shutting_down = true;
+            m_queue_cv.notify_all();
+        }
         unique_lock<mutex> lock(m_mutex);
-        m_shutting_down = true;
-        m_queue_cv.notify_all();
         // wait for all workers to finish
         m_worker_finished_cv.wait(lock, [&]() { return m_num_std_workers + m_num_dedicated_workers == 0; });
     }
 
     void enqueue(lean_task_object * t) {
-        unique_lock<mutex> lock(m_mutex);
         enqueue_core(t);
     }
 
@@ -825,23 +1284,42 @@ public:
     }
 
     void wait_for(lean_task_object * t) {
-        if (t->m_value)
-            return;
-        unique_lock<mutex> lock(m_mutex);
-        if (t->m_value)
-            return;
-        m_task_finished_cv.wait(lock, [&]() { return t->m_value != nullptr; });
+        if (!t->m_value) {
+            unique_lock<mutex> lock(m_mutex);
+            if (!t->m_value) {
+                task_waiter w;
+                lean_task_waiter_node n;
+                add_waiter(t, &n, &w);
+                w.m_cv.wait(lock, [&]() { return w.m_finished != nullptr; });
+            }
+        }
+        brc_process_queue();
     }
 
+    /* Instead of rescanning `task_list` whenever some task finishes, we register at each task of the list,
+       and are only woken up when one of them finishes. */
     object * wait_any(object * task_list) {
         if (object * t = wait_any_check(task_list))
             return t;
+        unsigned num_tasks = 0;
+        for (object * it = task_list; !is_scalar(it); it = cnstr_get(it, 1))
+            num_tasks++;
+        buffer<lean_task_waiter_node> nodes;
+        nodes.resize(num_tasks);
+        task_waiter w;
         unique_lock<mutex> lock(m_mutex);
-        while (true) {
-            if (object * t = wait_any_check(task_list))
-                return t;
-            m_task_finished_cv.wait(lock);
+        unsigned num_registered = 0;
+        for (object * it = task_list; !is_scalar(it) && !w.m_finished; it = cnstr_get(it, 1)) {
+            lean_task_object * t = lean_to_task(lean_ctor_get(it, 0));
+            if (t->m_value)
+                w.m_finished = t;
+            else
+                add_waiter(t, &nodes[num_registered++], &w);
         }
+        w.m_cv.wait(lock, [&]() { return w.m_finished != nullptr; });
+        for (unsigned i = 0; i < num_registered; i++)
+            remove_waiter(&nodes[i]);
+        return reinterpret_cast<object *>(w.m_finished);
     }
 
     void deactivate_task(lean_task_object * t) {
@@ -913,6 +1391,13 @@ static inline void lean_set_task_header(lean_object * o) {
     o->m_header   = ((size_t)(LeanTask) << 56) | (1ull << LEAN_MT_BIT) | 1;
 #elif defined(LEAN_COMPRESSED_OBJECT_HEADER_SMALL_RC)
     o->m_header   = ((size_t)(LeanTask) << 56) | ((size_t)LEAN_MT_MEM_KIND << 40) | 1;
+#elif defined(LEAN_BIASED_RC)
+    o->m_rc        = (LEAN_BRC_ZERO + 1) | LEAN_BRC_MERGED;
+    o->m_tag       = LeanTask;
+    o->m_mem_kind  = LEAN_MT_MEM_KIND;
+    o->m_other     = 0;
+    o->m_owner     = 0;
+    o->m_biased_rc = 0;
 #else
     o->m_rc       = 1;
     o->m_tag      = LeanTask;
@@ -922,6 +1407,7 @@ static inline void lean_set_task_header(lean_object * o) {
 }
 
 static lean_task_object * alloc_task(obj_arg c, unsigned prio, bool keep_alive) {
+    brc_process_queue();
     lean_mark_mt(c);
     lean_task_object * o = (lean_task_object*)lean_alloc_small_object(sizeof(lean_task_object));
     lean_set_task_header((lean_object*)o);
@@ -1534,10 +2020,9 @@ static object * string_ensure_capacity(object * o, size_t extra) {
     size_t sz  = string_size(o);
     size_t cap = string_capacity(o);
     if (sz + extra > cap) {
-        object * new_o = alloc_string(sz, cap + sz + extra, string_len(o));
-        lean_assert(string_capacity(new_o) >= sz + extra);
-        memcpy(w_string_cstr(new_o), string_cstr(o), sz);
-        lean_dealloc(o, lean_string_byte_size(o));
+        size_t new_cap = cap + sz + extra;
+        object * new_o = lean_realloc(o, lean_string_byte_size(o), sizeof(lean_string_object) + new_cap);
+        lean_to_string(new_o)->m_capacity = new_cap;
         return new_o;
     } else {
         return o;
@@ -1563,6 +2048,16 @@ extern "C" obj_res lean_string_from_utf8_unchecked(b_obj_arg a) {
     return r;
 }
 
+extern "C" uint8 lean_string_validate_utf8(b_obj_arg a) {
+    return validate_utf8(reinterpret_cast<char *>(lean_sarray_cptr(a)), lean_sarray_size(a));
+}
+
+extern "C" obj_res lean_string_from_utf8(b_obj_arg a) {
+    if (!lean_string_validate_utf8(a))
+        return mk_option_none();
+    return mk_option_some(lean_string_from_utf8_unchecked(a));
+}
+
 extern "C" obj_res lean_string_to_utf8(b_obj_arg s) {
     size_t sz = lean_string_size(s) - 1;
     obj_res r = lean_alloc_sarray(1, sz, sz);
@@ -1862,6 +2357,10 @@ extern "C" usize lean_string_hash(b_obj_arg s) {
     return hash_str(sz, str, 11);
 }
 
+extern "C" uint64 lean_string_hash64(b_obj_arg s, uint64 seed) {
+    return hash_str64(lean_string_size(s) - 1, lean_string_cstr(s), seed);
+}
+
 // =======================================
 // ByteArray & FloatArray
 
@@ -1903,6 +2402,11 @@ extern "C" obj_res lean_sarray_ensure_capacity(obj_arg a, size_t min_cap, bool e
     size_t cap = lean_sarray_capacity(a);
     if (min_cap <= cap) {
         return a;
+    } else if (lean_is_exclusive(a)) {
+        size_t new_cap = exact ? min_cap : min_cap * 2;
+        object * r     = lean_realloc(a, lean_sarray_byte_size(a), sizeof(lean_sarray_object) + lean_sarray_elem_size(a)*new_cap);
+        lean_to_sarray(r)->m_capacity = new_cap;
+        return r;
     } else {
         return lean_copy_sarray(a, exact ? min_cap : min_cap * 2);
     }
@@ -2036,6 +2540,12 @@ extern "C" obj_res lean_copy_expand_array(obj_arg a, bool expand) {
     lean_assert(cap >= sz);
     if (expand) cap = (cap + 1) * 2;
     lean_assert(!expand || cap > sz);
+    if (expand && lean_is_exclusive(a)) {
+        /* We can move the elements, and the allocator may be able to resize `a` without copying. */
+        object * r = lean_realloc(a, lean_array_byte_size(a), sizeof(lean_array_object) + sizeof(void*)*cap);
+        lean_to_array(r)->m_capacity = cap;
+        return r;
+    }
     object * r     = lean_alloc_array(sz, cap);
     object ** it   = lean_array_cptr(a);
     object ** end  = it + sz;
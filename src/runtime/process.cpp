@@ -9,6 +9,8 @@ Author: Jared Roesch
 #include <iostream>
 #include <iomanip>
 #include <utility>
+#include <vector>
+#include <algorithm>
 #include <system_error>
 
 #if defined(LEAN_WINDOWS)
@@ -21,7 +23,10 @@ Author: Jared Roesch
 #else
 #include <unistd.h>
 #include <fcntl.h>
+#include <spawn.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
+extern char ** environ;
 #endif
 
 #include <lean/object.h>
@@ -223,107 +228,208 @@ extern "C" obj_res lean_io_process_child_wait(b_obj_arg, b_obj_arg child, obj_ar
     }
 }
 
-struct pipe { int m_read_fd; int m_write_fd; };
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 29))
+#define LEAN_SPAWN_ADDCHDIR
+#endif
+
+/* The file descriptors of a pipe, `-1` if no pipe was created. */
+struct pipe {
+    int m_read_fd  = -1;
+    int m_write_fd = -1;
+    explicit operator bool() const { return m_read_fd != -1; }
+};
+
+static void close_pipe(pipe const & p) {
+    if (p) {
+        close(p.m_read_fd);
+        close(p.m_write_fd);
+    }
+}
 
-static optional<pipe> setup_stdio(stdio cfg) {
+static pipe setup_stdio(stdio cfg) {
     /* Setup stdio based on process configuration. */
+    pipe p;
     switch (cfg) {
     case stdio::INHERIT:
         /* We should need to do nothing in this case */
-        return optional<pipe>();
+        return p;
     case stdio::PIPED:
         int fds[2];
         if (::pipe(fds) == -1) {
             throw errno;
         } else {
-            return optional<pipe>(pipe { fds[0], fds[1] });
+            /* The child only keeps the copies made by `dup2`, and processes spawned concurrently by other
+               threads must not inherit our ends of the pipe. */
+            fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+            fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+            p.m_read_fd  = fds[0];
+            p.m_write_fd = fds[1];
+            return p;
         }
     case stdio::NUL:
         /* We should map /dev/null. */
-        return optional<pipe>();
+        return p;
     }
     lean_unreachable();
 }
 
-static obj_res spawn(string_ref const & proc_name, array_ref<string_ref> const & args, stdio stdin_mode, stdio stdout_mode,
-  stdio stderr_mode, option_ref<string_ref> const & cwd, array_ref<pair_ref<string_ref, option_ref<string_ref>>> const & env) {
-    /* Setup stdio based on process configuration. */
-    auto stdin_pipe  = setup_stdio(stdin_mode);
-    auto stdout_pipe = setup_stdio(stdout_mode);
-    auto stderr_pipe = setup_stdio(stderr_mode);
-
-    int pid = fork();
-
-    if (pid == 0) {
-        for (auto & entry : env) {
-            if (entry.snd()) {
-                setenv(entry.fst().data(), entry.snd().get()->data(), true);
-            } else {
-                unsetenv(entry.fst().data());
-            }
-        }
+struct spawn_file_actions {
+    posix_spawn_file_actions_t m_actions;
+    spawn_file_actions() {
+        if (int err = posix_spawn_file_actions_init(&m_actions))
+            throw err;
+    }
+    ~spawn_file_actions() { posix_spawn_file_actions_destroy(&m_actions); }
+    spawn_file_actions(spawn_file_actions const &) = delete;
+    spawn_file_actions & operator=(spawn_file_actions const &) = delete;
+};
 
-        if (stdin_pipe) {
-            dup2(stdin_pipe->m_read_fd, STDIN_FILENO);
-            close(stdin_pipe->m_write_fd);
-        } else if (stdin_mode == stdio::NUL) {
-            int fd = open("/dev/null", O_RDONLY);
-            dup2(fd, STDIN_FILENO);
-        }
+static void check_spawn_action(int err) {
+    if (err)
+        throw err;
+}
 
-        if (stdout_pipe) {
-            dup2(stdout_pipe->m_write_fd, STDOUT_FILENO);
-            close(stdout_pipe->m_read_fd);
-        } else if (stdout_mode == stdio::NUL) {
-            int fd = open("/dev/null", O_WRONLY);
-            dup2(fd, STDOUT_FILENO);
-        }
+static void add_stdio_actions(spawn_file_actions & actions, pipe const & p, stdio cfg, int fd) {
+    if (p) {
+        check_spawn_action(posix_spawn_file_actions_adddup2(&actions.m_actions, fd == STDIN_FILENO ? p.m_read_fd : p.m_write_fd, fd));
+    } else if (cfg == stdio::NUL) {
+        check_spawn_action(posix_spawn_file_actions_addopen(&actions.m_actions, fd, "/dev/null", fd == STDIN_FILENO ? O_RDONLY : O_WRONLY, 0));
+    }
+}
 
-        if (stderr_pipe) {
-            dup2(stderr_pipe->m_write_fd, STDERR_FILENO);
-            close(stderr_pipe->m_read_fd);
-        } else if (stderr_mode == stdio::NUL) {
-            int fd = open("/dev/null", O_WRONLY);
-            dup2(fd, STDERR_FILENO);
-        }
+static bool is_env_entry_for(std::string const & entry, std::string const & key) {
+    return entry.size() > key.size() && entry[key.size()] == '=' && entry.compare(0, key.size(), key) == 0;
+}
 
-        if (cwd) {
-            if (chdir(cwd.get()->data()) < 0) {
-                std::cerr << "could not change directory to " << cwd.get()->data() << std::endl;
-                exit(-1);
-            }
-        }
+/* Return the environment of the child process, i.e., our environment updated with `env`. We build it in the parent
+   because `setenv` is not async-signal-safe, and cannot be used between `fork` and `exec` in a multi-threaded process. */
+static std::vector<std::string> mk_child_env(array_ref<pair_ref<string_ref, option_ref<string_ref>>> const & env) {
+    std::vector<std::string> r;
+    for (char ** e = environ; *e != nullptr; e++)
+        r.push_back(*e);
+    for (auto & entry : env) {
+        std::string key = entry.fst().to_std_string();
+        r.erase(std::remove_if(r.begin(), r.end(), [&](std::string const & e) { return is_env_entry_for(e, key); }), r.end());
+        if (entry.snd())
+            r.push_back(key + "=" + entry.snd().get()->to_std_string());
+    }
+    return r;
+}
+
+/* `posix_spawnp` searches for `prog` using our `PATH`. When the child gets a different `PATH`, we search it ourselves
+   as `execvp` in the child would. Return `none` if `prog` is not found. */
+static optional<std::string> find_program(std::string const & prog, std::vector<std::string> const & child_env,
+                                          array_ref<pair_ref<string_ref, option_ref<string_ref>>> const & env) {
+    bool path_changed = false;
+    for (auto & entry : env) {
+        if (entry.fst().to_std_string() == "PATH")
+            path_changed = true;
+    }
+    if (!path_changed || prog.find('/') != std::string::npos)
+        return optional<std::string>(prog);
+    std::string path = "/bin:/usr/bin";
+    for (std::string const & e : child_env) {
+        if (is_env_entry_for(e, "PATH"))
+            path = e.substr(5);
+    }
+    size_t begin = 0;
+    while (true) {
+        size_t end = path.find(':', begin);
+        std::string dir = path.substr(begin, end == std::string::npos ? std::string::npos : end - begin);
+        std::string candidate = (dir.empty() ? std::string(".") : dir) + "/" + prog;
+        if (access(candidate.c_str(), X_OK) == 0)
+            return optional<std::string>(candidate);
+        if (end == std::string::npos)
+            return optional<std::string>();
+        begin = end + 1;
+    }
+}
 
-        buffer<char *> pargs;
-        pargs.push_back(strdup(proc_name.data()));
-        for (auto & arg : args)
-            pargs.push_back(strdup(arg.data()));
-        pargs.push_back(NULL);
+static obj_res spawn(string_ref const & proc_name, array_ref<string_ref> const & args, stdio stdin_mode, stdio stdout_mode,
+  stdio stderr_mode, option_ref<string_ref> const & cwd, array_ref<pair_ref<string_ref, option_ref<string_ref>>> const & env) {
+    /* We use `posix_spawn` instead of `fork`: `fork` copies the page tables of the parent, which is expensive when
+       it has a big heap, and only async-signal-safe functions can be used in the child of a multi-threaded process.
+       Everything the child needs is prepared here, and the stdio redirections are performed by file actions. */
+    std::vector<std::string> child_env = mk_child_env(env);
+    optional<std::string> prog = find_program(proc_name.to_std_string(), child_env, env);
+    if (!prog)
+        throw ENOENT;
+    if (cwd) {
+        /* Check the working directory here, so that the error mentions it. Otherwise, it would be reported as a
+           missing program, or as an exit status of the shell below. */
+        struct stat st;
+        if (stat(cwd.get()->data(), &st) != 0)
+            return lean_io_result_mk_error(decode_io_error(errno, cwd.get()->raw()));
+        if (!S_ISDIR(st.st_mode))
+            return lean_io_result_mk_error(decode_io_error(ENOTDIR, cwd.get()->raw()));
+    }
+    std::vector<std::string> child_args;
+#if !defined(LEAN_SPAWN_ADDCHDIR)
+    if (cwd) {
+        /* `posix_spawn` cannot change the working directory, so we let the shell do it. */
+        child_args.push_back("/bin/sh");
+        child_args.push_back("-c");
+        child_args.push_back("cd \"$0\" && exec \"$@\"");
+        child_args.push_back(cwd.get()->to_std_string());
+    }
+#endif
+    child_args.push_back(*prog);
+    for (auto & arg : args)
+        child_args.push_back(arg.to_std_string());
+    buffer<char *> pargs;
+    for (std::string & arg : child_args)
+        pargs.push_back(&arg[0]);
+    pargs.push_back(nullptr);
+    buffer<char *> penv;
+    for (std::string & e : child_env)
+        penv.push_back(&e[0]);
+    penv.push_back(nullptr);
 
-        if (execvp(pargs[0], pargs.data()) < 0) {
-            std::cerr << "could not execute external process '" << pargs[0] << "'" << std::endl;
-            exit(-1);
-        }
-    } else if (pid == -1) {
-        throw errno;
+    /* Setup stdio based on process configuration. */
+    pipe stdin_pipe, stdout_pipe, stderr_pipe;
+    pid_t pid = -1;
+    try {
+        stdin_pipe  = setup_stdio(stdin_mode);
+        stdout_pipe = setup_stdio(stdout_mode);
+        stderr_pipe = setup_stdio(stderr_mode);
+        spawn_file_actions actions;
+        add_stdio_actions(actions, stdin_pipe, stdin_mode, STDIN_FILENO);
+        add_stdio_actions(actions, stdout_pipe, stdout_mode, STDOUT_FILENO);
+        add_stdio_actions(actions, stderr_pipe, stderr_mode, STDERR_FILENO);
+#if defined(LEAN_SPAWN_ADDCHDIR)
+        if (cwd)
+            check_spawn_action(posix_spawn_file_actions_addchdir_np(&actions.m_actions, cwd.get()->data()));
+#endif
+        int err;
+        if (prog->find('/') != std::string::npos)
+            err = posix_spawn(&pid, pargs[0], &actions.m_actions, nullptr, pargs.data(), penv.data());
+        else
+            err = posix_spawnp(&pid, pargs[0], &actions.m_actions, nullptr, pargs.data(), penv.data());
+        if (err)
+            throw err;
+    } catch (...) {
+        close_pipe(stdin_pipe);
+        close_pipe(stdout_pipe);
+        close_pipe(stderr_pipe);
+        throw;
     }
 
     object * parent_stdin  = box(0);
     object * parent_stdout = box(0);
     object * parent_stderr = box(0);
     if (stdin_pipe) {
-        close(stdin_pipe->m_read_fd);
-        parent_stdin = io_wrap_handle(fdopen(stdin_pipe->m_write_fd, "w"));
+        close(stdin_pipe.m_read_fd);
+        parent_stdin = io_wrap_handle(fdopen(stdin_pipe.m_write_fd, "w"));
     }
 
     if (stdout_pipe) {
-        close(stdout_pipe->m_write_fd);
-        parent_stdout = io_wrap_handle(fdopen(stdout_pipe->m_read_fd, "r"));
+        close(stdout_pipe.m_write_fd);
+        parent_stdout = io_wrap_handle(fdopen(stdout_pipe.m_read_fd, "r"));
     }
 
     if (stderr_pipe) {
-        close(stderr_pipe->m_write_fd);
-        parent_stderr = io_wrap_handle(fdopen(stderr_pipe->m_read_fd, "r"));
+        close(stderr_pipe.m_write_fd);
+        parent_stderr = io_wrap_handle(fdopen(stderr_pipe.m_read_fd, "r"));
     }
 
     object_ref r = mk_cnstr(0, parent_stdin, parent_stdout, parent_stderr, sizeof(pid_t));
@@ -358,7 +464,8 @@ extern "C" obj_res lean_io_process_spawn(obj_arg args_, obj_arg) {
                 cnstr_get_ref_t<option_ref<string_ref>>(args, 3),
                 cnstr_get_ref_t<array_ref<pair_ref<string_ref, option_ref<string_ref>>>>(args, 4));
     } catch (int err) {
-        return lean_io_result_mk_error(decode_io_error(err, nullptr));
+        // report the command, e.g., when it does not exist
+        return lean_io_result_mk_error(decode_io_error(err, cnstr_get(args.raw(), 1)));
     } catch (std::system_error const & err) {
         // TODO: decode
         return lean_io_result_mk_error(lean_mk_io_error_other_error(err.code().value(), mk_string(err.code().message())));
@@ -24,6 +24,8 @@ Author: Leonardo de Moura
 #endif
 
 namespace lean {
+parking_queue g_parking_queues[LEAN_NUM_PARKING_QUEUES];
+
 static std::vector<std::function<void()>> * g_thread_local_reset_fns;
 
 static void initialize_thread_local_reset_fns() {
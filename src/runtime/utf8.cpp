@@ -5,10 +5,14 @@ Released under Apache 2.0 license as described in the file LICENSE.
 Author: Leonardo de Moura
 */
 #include <cstdlib>
+#include <cstring>
 #include <string>
 #include <lean/debug.h>
 #include <lean/optional.h>
 #include <lean/utf8.h>
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
 
 namespace lean {
 bool is_utf8_next(unsigned char c) { return (c & 0xC0) == 0x80; }
@@ -32,42 +36,174 @@ unsigned get_utf8_size(unsigned char c) {
         return 1; /* invalid */
 }
 
-size_t utf8_strlen(char const * str) {
+/* Vectorized kernels.
+
+   - `ascii_prefix(s, n)`: number of leading bytes of `s` that are ASCII.
+   - `count_lead(s, n)`: number of bytes of `s` that are not continuation bytes (10xxxxxx).
+     For valid UTF-8 this is the number of unicode scalar values.
+
+   SSE2 is part of the x86-64 baseline. The AVX2 versions are compiled with a `target` attribute and
+   selected at runtime. Other platforms use the scalar loops. */
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define LEAN_UTF8_SSE2
+#define LEAN_UTF8_AVX2
+#elif defined(_M_X64)
+#define LEAN_UTF8_SSE2
+#endif
+
+static inline bool is_utf8_cont(uchar c) { return (c & 0xC0) == 0x80; }
+
+static inline unsigned popcount32(unsigned v) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_popcount(v);
+#else
+    v = v - ((v >> 1) & 0x55555555u);
+    v = (v & 0x33333333u) + ((v >> 2) & 0x33333333u);
+    return (((v + (v >> 4)) & 0x0F0F0F0Fu) * 0x01010101u) >> 24;
+#endif
+}
+
+static inline unsigned ctz32(unsigned v) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctz(v);
+#else
+    unsigned r = 0;
+    while ((v & 1) == 0) { v >>= 1; r++; }
+    return r;
+#endif
+}
+
+static size_t ascii_prefix_scalar(uchar const * s, size_t n) {
+    size_t i = 0;
+    while (i < n && s[i] < 0x80) i++;
+    return i;
+}
+
+static size_t count_lead_scalar(uchar const * s, size_t n) {
     size_t r = 0;
-    while (*str != 0) {
-        unsigned sz = get_utf8_size(*str);
-        r++;
-        str += sz;
-    }
+    for (size_t i = 0; i < n; i++)
+        r += !is_utf8_cont(s[i]);
     return r;
 }
 
-size_t utf8_strlen(char const * str, size_t sz) {
+#if defined(LEAN_UTF8_SSE2)
+static size_t ascii_prefix_sse2(uchar const * s, size_t n) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        unsigned m = _mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<__m128i const *>(s + i)));
+        if (m != 0)
+            return i + ctz32(m);
+    }
+    return i + ascii_prefix_scalar(s + i, n - i);
+}
+
+/* Continuation bytes are the signed bytes in [-128, -65]. */
+static size_t count_lead_sse2(uchar const * s, size_t n) {
     size_t r = 0;
     size_t i = 0;
-    while (i < sz) {
-        unsigned d = get_utf8_size(str[i]);
-        r++;
-        i += d;
+    __m128i const bound = _mm_set1_epi8(-64);
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<__m128i const *>(s + i));
+        r += 16 - popcount32(_mm_movemask_epi8(_mm_cmplt_epi8(v, bound)));
     }
+    return r + count_lead_scalar(s + i, n - i);
+}
+#endif
+
+#if defined(LEAN_UTF8_AVX2)
+__attribute__((target("avx2")))
+static size_t ascii_prefix_avx2(uchar const * s, size_t n) {
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        unsigned m = _mm256_movemask_epi8(_mm256_loadu_si256(reinterpret_cast<__m256i const *>(s + i)));
+        if (m != 0)
+            return i + ctz32(m);
+    }
+    return i + ascii_prefix_sse2(s + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static size_t count_lead_avx2(uchar const * s, size_t n) {
+    size_t r = 0;
+    size_t i = 0;
+    __m256i const bound = _mm256_set1_epi8(-64);
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(s + i));
+        r += 32 - popcount32(_mm256_movemask_epi8(_mm256_cmpgt_epi8(bound, v)));
+    }
+    return r + count_lead_sse2(s + i, n - i);
+}
+
+static bool has_avx2() {
+    static bool r = []() { __builtin_cpu_init(); return __builtin_cpu_supports("avx2") != 0; }();
     return r;
 }
+#endif
+
+static inline size_t ascii_prefix(uchar const * s, size_t n) {
+#if defined(LEAN_UTF8_AVX2)
+    if (n >= 32 && has_avx2())
+        return ascii_prefix_avx2(s, n);
+#endif
+#if defined(LEAN_UTF8_SSE2)
+    return ascii_prefix_sse2(s, n);
+#else
+    return ascii_prefix_scalar(s, n);
+#endif
+}
+
+static inline size_t count_lead(uchar const * s, size_t n) {
+#if defined(LEAN_UTF8_AVX2)
+    if (n >= 32 && has_avx2())
+        return count_lead_avx2(s, n);
+#endif
+#if defined(LEAN_UTF8_SSE2)
+    return count_lead_sse2(s, n);
+#else
+    return count_lead_scalar(s, n);
+#endif
+}
+
+size_t utf8_strlen(char const * str) {
+    return utf8_strlen(str, strlen(str));
+}
+
+size_t utf8_strlen(char const * str, size_t sz) {
+    return count_lead(reinterpret_cast<uchar const *>(str), sz);
+}
 
 size_t utf8_strlen(std::string const & str) {
     return utf8_strlen(str.data(), str.size());
 }
 
-optional<size_t> utf8_char_pos(char const * str, size_t char_idx) {
-    size_t r = 0;
-    while (*str != 0) {
-        if (char_idx == 0)
-            return some<size_t>(r);
-        char_idx--;
-        unsigned sz = get_utf8_size(*str);
-        r += sz;
-        str += sz;
+size_t utf8_seek(char const * str, size_t sz, size_t char_idx) {
+    uchar const * s = reinterpret_cast<uchar const *>(str);
+    size_t i = 0;
+    /* skip whole blocks that contain at most `char_idx` scalar values */
+    constexpr size_t block = 64;
+    while (i + block <= sz) {
+        size_t c = count_lead(s + i, block);
+        if (c > char_idx)
+            break;
+        char_idx -= c;
+        i += block;
+    }
+    for (; i < sz; i++) {
+        if (!is_utf8_cont(s[i])) {
+            if (char_idx == 0)
+                return i;
+            char_idx--;
+        }
     }
-    return optional<size_t>();
+    return sz;
+}
+
+optional<size_t> utf8_char_pos(char const * str, size_t char_idx) {
+    size_t sz = strlen(str);
+    size_t r  = utf8_seek(str, sz, char_idx);
+    if (r == sz)
+        return optional<size_t>();
+    return some<size_t>(r);
 }
 
 char const * get_utf8_last_char(char const * str) {
@@ -201,6 +337,41 @@ unsigned next_utf8(char const * str, size_t size, size_t & i) {
 }
 
 
+bool validate_utf8(char const * str, size_t size) {
+    uchar const * s = reinterpret_cast<uchar const *>(str);
+    size_t i = 0;
+    while (true) {
+        i += ascii_prefix(s + i, size - i);
+        if (i == size)
+            return true;
+        unsigned c = s[i];
+        if ((c & 0xe0) == 0xc0) {
+            /* one continuation (128 to 2047) */
+            if (i + 1 >= size || !is_utf8_cont(s[i+1]) || c < 0xc2)
+                return false;
+            i += 2;
+        } else if ((c & 0xf0) == 0xe0) {
+            /* two continuations (2048 to 55295 and 57344 to 65535) */
+            if (i + 2 >= size || !is_utf8_cont(s[i+1]) || !is_utf8_cont(s[i+2]))
+                return false;
+            unsigned r = ((c & 0x0f) << 12) | ((s[i+1] & 0x3f) << 6) | (s[i+2] & 0x3f);
+            if (r < 2048 || (r >= 55296 && r <= 57343))
+                return false;
+            i += 3;
+        } else if ((c & 0xf8) == 0xf0) {
+            /* three continuations (65536 to 1114111) */
+            if (i + 3 >= size || !is_utf8_cont(s[i+1]) || !is_utf8_cont(s[i+2]) || !is_utf8_cont(s[i+3]))
+                return false;
+            unsigned r = ((c & 0x07) << 18) | ((s[i+1] & 0x3f) << 12) | ((s[i+2] & 0x3f) << 6) | (s[i+3] & 0x3f);
+            if (r < 65536 || r > 1114111)
+                return false;
+            i += 4;
+        } else {
+            return false;
+        }
+    }
+}
+
 unsigned next_utf8(std::string const & str, size_t & i) {
     return next_utf8(str.data(), str.size(), i);
 }
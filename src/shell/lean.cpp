@@ -27,6 +27,7 @@ Author: Leonardo de Moura
 #include "util/option_declarations.h"
 #include "kernel/environment.h"
 #include "kernel/kernel_exception.h"
+#include "kernel/type_checker.h"
 #include "library/formatter.h"
 #include "library/module.h"
 #include "library/time_task.h"
@@ -368,6 +369,7 @@ void print_imports(std::string const & input, std::string const & fname) {
 
 extern "C" object* lean_environment_free_regions(object * env, object * w);
 void environment_free_regions(environment && env) {
+    clear_kernel_cache();
     consume_io_result(lean_environment_free_regions(env.steal(), io_mk_world()));
 }
 }
@@ -551,6 +553,10 @@ int main(int argc, char ** argv) {
         report_profiling_time("initialization", init_time);
     }
 
+    set_async_theorem_checking(get_async_theorems(opts));
+    set_kernel_cache_capacity(get_kernel_cache_capacity(opts));
+    set_olean_compression(get_olean_compress(opts));
+
     environment env(trust_lvl);
     scoped_task_manager scope_task_man(num_threads);
     optional<name> main_module_name;
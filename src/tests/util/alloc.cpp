@@ -0,0 +1,252 @@
+/*
+Copyright (c) 2021 Microsoft Corporation. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+*/
+#include <iostream>
+#include <vector>
+#include <cstring>
+#include "util/test.h"
+#include "util/timeit.h"
+#include <lean/stackinfo.h>
+#include <lean/thread.h>
+#include <lean/compiler_hints.h>
+#include <lean/alloc.h>
+#include <lean/lean.h>
+#include "util/init_module.h"
+using namespace lean;
+
+#if defined(LEAN_MULTI_THREAD)
+/* Objects are allocated by the main thread and deallocated by `num_threads` other threads.
+   All of them must come back to the main heap through its remote free list. */
+static void tst1(unsigned num_threads, unsigned num_objs) {
+    std::vector<std::vector<void *>> objs(num_threads);
+    for (unsigned i = 0; i < num_threads; i++) {
+        for (unsigned j = 0; j < num_objs; j++) {
+            size_t sz = 8 * (1 + (i + j) % 32);
+            void * o  = alloc(sz);
+            memset(o, static_cast<int>(j), sz);
+            objs[i].push_back(o);
+        }
+    }
+    uint64_t in0, out0;
+    get_remote_free_stats(in0, out0);
+    {
+        timeit timer(std::cout, "remote frees");
+        std::vector<std::unique_ptr<lthread>> threads;
+        for (unsigned i = 0; i < num_threads; i++) {
+            threads.emplace_back(new lthread([&, i]() {
+                        for (unsigned j = 0; j < num_objs; j++)
+                            dealloc(objs[i][j], 8 * (1 + (i + j) % 32));
+                    }));
+        }
+        for (auto & t : threads)
+            t->join();
+    }
+    uint64_t in1, out1;
+    get_remote_free_stats(in1, out1);
+    lean_assert(in1 - in0 == static_cast<uint64_t>(num_threads) * num_objs);
+    lean_assert(out1 == out0);
+    /* The freed objects can be reused */
+    std::vector<void *> again;
+    for (unsigned j = 0; j < num_threads * num_objs; j++)
+        again.push_back(alloc(8 * (1 + j % 32)));
+    for (unsigned j = 0; j < again.size(); j++)
+        dealloc(again[j], 8 * (1 + j % 32));
+}
+
+/* Producer/consumer pipeline: each thread allocates objects and deallocates the objects allocated by its neighbor. */
+static void tst2(unsigned num_threads, unsigned num_rounds, unsigned num_objs) {
+    std::vector<std::vector<void *>> objs(num_threads);
+    for (unsigned r = 0; r < num_rounds; r++) {
+        std::vector<std::unique_ptr<lthread>> threads;
+        for (unsigned i = 0; i < num_threads; i++) {
+            threads.emplace_back(new lthread([&, i]() {
+                        std::vector<void *> & prev = objs[(i + num_threads - 1) % num_threads];
+                        for (void * o : prev) dealloc(o, 64);
+                        prev.clear();
+                    }));
+        }
+        for (auto & t : threads)
+            t->join();
+        threads.clear();
+        for (unsigned i = 0; i < num_threads; i++) {
+            threads.emplace_back(new lthread([&, i]() {
+                        for (unsigned j = 0; j < num_objs; j++)
+                            objs[i].push_back(alloc(64));
+                    }));
+        }
+        for (auto & t : threads)
+            t->join();
+    }
+    for (auto & os : objs)
+        for (void * o : os) dealloc(o, 64);
+}
+#endif
+
+/* Empty pages beyond the configured limit are returned to the OS, and empty segments are unmapped. */
+static void tst3(unsigned num_objs) {
+    uint64_t decommitted0, unmapped0;
+    get_released_memory_stats(decommitted0, unmapped0);
+    set_max_empty_memory(1024*1024);
+    std::vector<void *> objs;
+    for (unsigned i = 0; i < num_objs; i++) {
+        void * o = alloc(64);
+        memset(o, 1, 64);
+        objs.push_back(o);
+    }
+    for (void * o : objs)
+        dealloc(o, 64);
+    uint64_t decommitted1, unmapped1;
+    get_released_memory_stats(decommitted1, unmapped1);
+    /* At most 1 Mb of the empty pages is kept committed. */
+    size_t total = static_cast<size_t>(num_objs) * 64;
+    lean_assert(decommitted1 + unmapped1 - decommitted0 - unmapped0 > total / 2);
+    /* Empty pages are reused for objects of a different size. */
+    objs.clear();
+    for (unsigned i = 0; i < num_objs / 2; i++) {
+        void * o = alloc(128);
+        memset(o, 2, 128);
+        objs.push_back(o);
+    }
+    for (void * o : objs)
+        dealloc(o, 128);
+    release_free_memory();
+    uint64_t decommitted2, unmapped2;
+    get_released_memory_stats(decommitted2, unmapped2);
+    lean_assert(unmapped2 > unmapped0);
+    std::cout << "decommitted: " << (decommitted2 - decommitted0) / 1024 << " Kb, unmapped: "
+              << (unmapped2 - unmapped0) / 1024 << " Kb\n";
+    set_max_empty_memory(4*1024*1024);
+}
+
+/* Allocation statistics are folded from the counters of all threads. */
+static void tst4(unsigned num_threads, unsigned num_objs) {
+    lean_alloc_stats s0;
+    lean_get_alloc_stats(&s0);
+    std::vector<std::vector<void *>> objs(num_threads);
+    auto alloc_objs = [&](unsigned i) {
+        for (unsigned j = 0; j < num_objs; j++)
+            objs[i].push_back(alloc(48));
+        objs[i].push_back(alloc(10000));
+    };
+#if defined(LEAN_MULTI_THREAD)
+    std::vector<std::unique_ptr<lthread>> threads;
+    for (unsigned i = 0; i < num_threads; i++)
+        threads.emplace_back(new lthread([&, i]() { alloc_objs(i); }));
+    for (auto & t : threads)
+        t->join();
+#else
+    for (unsigned i = 0; i < num_threads; i++)
+        alloc_objs(i);
+#endif
+    lean_alloc_stats s1;
+    lean_get_alloc_stats(&s1);
+    unsigned slot_idx = lean_get_slot_idx(48);
+    lean_assert(s1.m_num_small_alloc[slot_idx] - s0.m_num_small_alloc[slot_idx] == num_threads * num_objs);
+    lean_assert(s1.m_num_big_alloc - s0.m_num_big_alloc == num_threads);
+    lean_assert(s1.m_big_alloc_bytes - s0.m_big_alloc_bytes == num_threads * 10000);
+    lean_assert(s1.m_live_bytes - s0.m_live_bytes == num_threads * (num_objs * 48 + 10000));
+    /* The main thread deallocates all of them */
+    for (unsigned i = 0; i < num_threads; i++) {
+        for (unsigned j = 0; j < num_objs; j++)
+            dealloc(objs[i][j], 48);
+        dealloc(objs[i][num_objs], 10000);
+    }
+    lean_alloc_stats s2;
+    lean_get_alloc_stats(&s2);
+    lean_assert(s2.m_num_small_dealloc[slot_idx] - s0.m_num_small_dealloc[slot_idx] == num_threads * num_objs);
+    lean_assert(s2.m_num_big_dealloc - s0.m_num_big_dealloc == num_threads);
+    lean_assert(s2.m_live_bytes == s0.m_live_bytes);
+#if defined(LEAN_MULTI_THREAD)
+    /* Some of them may still be in the list of objects to be exported by the main thread. */
+    lean_assert(s2.m_num_remote_frees > s0.m_num_remote_frees);
+#endif
+}
+
+static void check_bytes(char const * o, size_t sz) {
+    for (size_t i = 0; i < sz; i++)
+        lean_assert(o[i] == static_cast<char>(i % 127));
+}
+
+/* Medium and huge objects, and resizing objects in every tier. */
+static void tst5() {
+    lean_alloc_stats s0;
+    lean_get_alloc_stats(&s0);
+    size_t sz = 16;
+    char * o  = static_cast<char*>(alloc(sz));
+    for (size_t i = 0; i < sz; i++) o[i] = static_cast<char>(i % 127);
+    while (sz < 64*1024*1024) {
+        size_t new_sz = sz + sz / 2;
+        o = static_cast<char*>(reallocate(o, sz, new_sz));
+        check_bytes(o, sz);
+        for (size_t i = sz; i < new_sz; i++) o[i] = static_cast<char>(i % 127);
+        sz = new_sz;
+    }
+    while (sz > 8) {
+        size_t new_sz = sz / 3;
+        o = static_cast<char*>(reallocate(o, sz, new_sz));
+        check_bytes(o, new_sz);
+        sz = new_sz;
+    }
+    dealloc(o, sz);
+    /* Medium objects are reused */
+    for (unsigned i = 0; i < 1000; i++) {
+        void * o1 = alloc(5000);
+        void * o2 = alloc(100000);
+        memset(o1, 0, 5000);
+        memset(o2, 0, 100000);
+        dealloc(o2, 100000);
+        dealloc(o1, 5000);
+    }
+    lean_alloc_stats s1;
+    lean_get_alloc_stats(&s1);
+    lean_assert(s1.m_live_bytes == s0.m_live_bytes);
+    lean_assert(s1.m_num_medium_reuse - s0.m_num_medium_reuse >= 1998);
+    lean_assert(s1.m_num_huge_alloc > s0.m_num_huge_alloc);
+    lean_assert(s1.m_num_in_place_resize > s0.m_num_in_place_resize);
+}
+
+/* Growing a buffer by doubling its size, with and without `reallocate`. */
+static void tst6(size_t max_sz, unsigned n) {
+    {
+        timeit timer(std::cout, "grow using alloc/copy/dealloc");
+        for (unsigned k = 0; k < n; k++) {
+            size_t sz = 8;
+            void * o  = alloc(sz);
+            while (sz < max_sz) {
+                void * new_o = alloc(2*sz);
+                memcpy(new_o, o, sz);
+                dealloc(o, sz);
+                o = new_o; sz *= 2;
+            }
+            dealloc(o, sz);
+        }
+    }
+    {
+        timeit timer(std::cout, "grow using reallocate");
+        for (unsigned k = 0; k < n; k++) {
+            size_t sz = 8;
+            void * o  = alloc(sz);
+            while (sz < max_sz) {
+                o = reallocate(o, sz, 2*sz);
+                sz *= 2;
+            }
+            dealloc(o, sz);
+        }
+    }
+}
+
+int main() {
+    save_stack_info();
+    initialize_util_module();
+#if defined(LEAN_MULTI_THREAD)
+    tst1(8, 100000);
+    tst2(4, 20, 10000);
+#endif
+    tst3(1000000);
+    tst4(4, 10000);
+    tst5();
+    tst6(256*1024*1024, 4);
+    finalize_util_module();
+    return has_violations() ? 1 : 0;
+}
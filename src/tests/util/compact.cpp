@@ -5,6 +5,10 @@ Released under Apache 2.0 license as described in the file LICENSE.
 Author: Leonardo de Moura
 */
 #include <iostream>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <unordered_map>
 #include "util/test.h"
 #include <lean/serializer.h>
 #include <lean/sstream.h>
@@ -37,10 +41,167 @@ void tst1() {
     std::cout << mpz_value(r.read()) << "\n";
 }
 
+static object_ref mk_pair(name const & n, mpz const & v) {
+    return mk_cnstr(0, n, object_ref(mk_nat_obj(v)));
+}
+
+void tst2() {
+    name n{"hello", "bla", "world"};
+    mpz v("1000000000000000000000000000000");
+    object_ref p(mk_pair(n, v));
+    object_compactor c1;
+    c1(p.raw());
+    size_t sz = c1.size();
+    /* compact again using the final location of the data as the base address, no fix-up is needed */
+    void * buffer = malloc(sz);
+    object_compactor c2(buffer);
+    c2(p.raw());
+    lean_assert(c2.size() == sz);
+    memcpy(buffer, c2.data(), sz);
+    compacted_region r1(sz, buffer, buffer, [=]() { free(buffer); });
+    object * p1 = r1.read();
+    lean_assert(name(cnstr_get(p1, 0), true) == n);
+    lean_assert(mpz_value(cnstr_get(p1, 1)) == v);
+    lean_assert(r1.read() == nullptr);
+    /* relocate data compacted for a different base address */
+    void * base_addr = reinterpret_cast<void*>(static_cast<size_t>(1) << 30);
+    object_compactor c3(base_addr);
+    c3(p.raw());
+    void * data = malloc(c3.size());
+    memcpy(data, c3.data(), c3.size());
+    compacted_region r2(c3.size(), data, base_addr, [=]() { free(data); });
+    object * p2 = r2.read();
+    lean_assert(name(cnstr_get(p2, 0), true) == n);
+    lean_assert(mpz_value(cnstr_get(p2, 1)) == v);
+}
+
+/* Expression-like node: two object fields and a 64-bit hash, e.g., `Expr.app f a data`. */
+static object * mk_node(unsigned tag, object * a, object * b, uint64 data) {
+    object * r = alloc_cnstr(tag, 2, sizeof(uint64));
+    cnstr_set(r, 0, a);
+    cnstr_set(r, 1, b);
+    cnstr_set_uint64(r, 2 * sizeof(void*), data);
+    return r;
+}
+
+/* Name-like node: prefix and string, e.g., `Name.str p s hash`. */
+static object * mk_name_node(object * prefix, char const * s) {
+    return mk_node(1, prefix, mk_string(s), std::hash<std::string>()(s));
+}
+
+/* Return a graph resembling the module data of a big environment: an array of `num_decls` declarations with
+   hierarchical names and expressions where some subterms are shared and many are structurally equal but not
+   shared, which is what the max sharing table is for. */
+static object_ref mk_env_like(unsigned num_decls) {
+    std::srand(13);
+    std::vector<object *> names;
+    std::vector<object *> pool;
+    object * prefixes[2] = { mk_name_node(mk_name_node(box(0), "Mathlib"), "Algebra"),
+                             mk_name_node(mk_name_node(box(0), "Mathlib"), "Topology") };
+    object * decls = alloc_array(0, num_decls);
+    for (unsigned i = 0; i < num_decls; i++) {
+        object * n = mk_name_node(prefixes[i % 2], ("decl_" + std::to_string(i)).c_str());
+        inc(prefixes[i % 2]);
+        names.push_back(n);
+        object * exprs[2];
+        for (object * & e : exprs) {
+            std::vector<object *> todo;
+            for (unsigned j = 0; j < 16; j++) {
+                object * leaf;
+                switch (std::rand() % 4) {
+                case 0: // constant, the name is shared but the node is not
+                    leaf = mk_node(4, names[std::rand() % names.size()], box(0), j);
+                    inc(cnstr_get(leaf, 0));
+                    break;
+                case 1: // bound variable, equal to many others
+                    leaf = mk_node(0, box(std::rand() % 8), box(0), 7);
+                    break;
+                default: // shared subterm
+                    if (pool.empty()) {
+                        leaf = mk_node(0, box(0), box(0), 7);
+                    } else {
+                        leaf = pool[std::rand() % pool.size()];
+                        inc(leaf);
+                    }
+                    break;
+                }
+                todo.push_back(leaf);
+            }
+            while (todo.size() > 1) {
+                object * b = todo.back(); todo.pop_back();
+                object * a = todo.back(); todo.pop_back();
+                todo.insert(todo.begin(), mk_node(5, a, b, std::rand()));
+            }
+            e = todo[0];
+            if (pool.size() < 1000) {
+                inc(e);
+                pool.push_back(e);
+            }
+        }
+        object * d = alloc_cnstr(0, 3, 0);
+        cnstr_set(d, 0, n);
+        cnstr_set(d, 1, exprs[0]);
+        cnstr_set(d, 2, exprs[1]);
+        decls = array_push(decls, d);
+    }
+    for (object * e : pool)
+        dec(e);
+    dec(prefixes[0]);
+    dec(prefixes[1]);
+    return object_ref(decls);
+}
+
+static bool is_equal(object * a, object * b, std::unordered_map<object *, object *> & visited) {
+    if (is_scalar(a) || is_scalar(b))
+        return a == b;
+    auto it = visited.find(a);
+    if (it != visited.end())
+        return it->second == b;
+    visited.insert(std::make_pair(a, b));
+    if (lean_ptr_tag(a) != lean_ptr_tag(b))
+        return false;
+    if (lean_is_array(a)) {
+        if (array_size(a) != array_size(b))
+            return false;
+        for (size_t i = 0; i < array_size(a); i++)
+            if (!is_equal(array_get(a, i), array_get(b, i), visited))
+                return false;
+        return true;
+    } else if (lean_is_string(a)) {
+        return std::string(string_cstr(a)) == string_cstr(b);
+    } else {
+        lean_assert(lean_is_ctor(a));
+        if (lean_object_byte_size(a) != lean_object_byte_size(b))
+            return false;
+        unsigned num_objs = lean_ctor_num_objs(a);
+        size_t scalar_sz  = lean_object_byte_size(a) - sizeof(lean_ctor_object) - num_objs * sizeof(void*);
+        if (memcmp(lean_ctor_obj_cptr(a) + num_objs, lean_ctor_obj_cptr(b) + num_objs, scalar_sz) != 0)
+            return false;
+        for (unsigned i = 0; i < num_objs; i++)
+            if (!is_equal(cnstr_get(a, i), cnstr_get(b, i), visited))
+                return false;
+        return true;
+    }
+}
+
+void tst3() {
+    object_ref env = mk_env_like(100);
+    object_compactor c;
+    c(env.raw());
+    size_t sz   = c.size();
+    void * data = malloc(sz);
+    memcpy(data, c.data(), sz);
+    compacted_region r(sz, data);
+    std::unordered_map<object *, object *> visited;
+    lean_always_assert(is_equal(env.raw(), r.read(), visited));
+}
+
 int main() {
     save_stack_info();
     initialize_util_module();
     tst1();
+    tst2();
+    tst3();
     finalize_util_module();
     return has_violations() ? 1 : 0;
 }
@@ -0,0 +1,119 @@
+/*
+Copyright (c) 2021 Microsoft Corporation. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+*/
+#include <iostream>
+#include <string>
+#include <cstdlib>
+#include <unordered_map>
+#include <unordered_set>
+#include "util/test.h"
+#include "util/timeit.h"
+#include "util/flat_hash_map.h"
+using namespace lean;
+
+/* Hash function with many collisions. */
+struct bad_hash {
+    unsigned operator()(unsigned k) const { return k % 7; }
+};
+
+template<typename M1, typename M2>
+static void check_equal(M1 const & m1, M2 const & m2) {
+    lean_assert(m1.size() == m2.size());
+    size_t n = 0;
+    for (auto it = m1.begin(); it != m1.end(); ++it) {
+        auto it2 = m2.find(it->first);
+        lean_assert(it2 != m2.end());
+        lean_assert(it2->second == it->second);
+        n++;
+    }
+    lean_assert(n == m2.size());
+}
+
+template<typename H>
+static void tst1(unsigned num_ops, unsigned max_key) {
+    flat_hash_map<unsigned, unsigned, H> m1;
+    std::unordered_map<unsigned, unsigned> m2;
+    std::srand(max_key);
+    for (unsigned i = 0; i < num_ops; i++) {
+        unsigned k = std::rand() % max_key;
+        switch (std::rand() % 4) {
+        case 0: case 1:
+            lean_assert(m1.insert(std::make_pair(k, i)).second == m2.insert(std::make_pair(k, i)).second);
+            break;
+        case 2:
+            lean_assert(m1.erase(k) == m2.erase(k));
+            break;
+        case 3:
+            m1[k] = i;
+            m2[k] = i;
+            break;
+        }
+        lean_assert(m1.count(k) == m2.count(k));
+    }
+    check_equal(m1, m2);
+    check_equal(m2, m1);
+    flat_hash_map<unsigned, unsigned, H> m3(m1);
+    check_equal(m3, m2);
+    m3.clear();
+    lean_assert(m3.empty());
+    lean_assert(m3.find(0) == m3.end());
+    m3 = m1;
+    check_equal(m3, m2);
+}
+
+static void tst2() {
+    flat_hash_set<std::string> s1;
+    std::unordered_set<std::string> s2;
+    for (unsigned i = 0; i < 1000; i++) {
+        std::string k = std::to_string(i % 300);
+        if (i % 3 == 0) {
+            lean_assert(s1.erase(k) == s2.erase(k));
+        } else {
+            lean_assert(s1.insert(k).second == s2.insert(k).second);
+        }
+    }
+    lean_assert(s1.size() == s2.size());
+    for (std::string const & k : s1)
+        lean_assert(s2.find(k) != s2.end());
+}
+
+template<typename M>
+static unsigned bench(M & m, unsigned n) {
+    unsigned r = 0;
+    for (unsigned i = 0; i < n; i++)
+        m.insert(std::make_pair(i * 7919u, i));
+    for (unsigned j = 0; j < 10; j++) {
+        for (unsigned i = 0; i < 2 * n; i++) {
+            auto it = m.find(i * 7919u);
+            if (it != m.end())
+                r += it->second;
+        }
+    }
+    return r;
+}
+
+static void tst3() {
+    unsigned n = 1000000;
+    unsigned r1, r2;
+    {
+        flat_hash_map<unsigned, unsigned> m;
+        timeit timer(std::cout, "flat_hash_map");
+        r1 = bench(m, n);
+    }
+    {
+        std::unordered_map<unsigned, unsigned> m;
+        timeit timer(std::cout, "std::unordered_map");
+        r2 = bench(m, n);
+    }
+    lean_assert(r1 == r2);
+}
+
+int main() {
+    tst1<std::hash<unsigned>>(100000, 1000);
+    tst1<std::hash<unsigned>>(100000, 100000);
+    tst1<bad_hash>(20000, 500);
+    tst2();
+    tst3();
+    return has_violations() ? 1 : 0;
+}
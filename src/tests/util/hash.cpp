@@ -4,7 +4,10 @@ Released under Apache 2.0 license as described in the file LICENSE.
 
 Author: Leonardo de Moura
 */
-#include <iostream>
+#include <string>
+#include <vector>
+#include <unordered_set>
+#include <cstring>
 #include "util/test.h"
 #include <lean/hash.h>
 using namespace lean;
@@ -17,7 +20,64 @@ static void tst1() {
     lean_assert(h1 != h3);
 }
 
+/* Hierarchical names resembling the declarations of a large library,
+   e.g. `Lean.Meta.Simp.Config.mk_17`. */
+static std::vector<std::string> mk_name_corpus(unsigned n) {
+    static char const * prefixes[] = { "Lean", "Lean.Meta", "Lean.Elab.Term", "Lean.Elab.Tactic", "Lean.Parser.Command",
+                                       "Std.HashMap", "Init.Data.List.Basic", "Lean.IR.EmitC", "Nat", "List" };
+    static char const * parts[] = { "mk", "rec", "casesOn", "noConfusion", "eq_1", "inj", "below", "brecOn", "instInhabited",
+                                    "match_1", "proof_1", "_private", "sizeOf_spec", "toCtorIdx", "elim", "spec" };
+    std::vector<std::string> r;
+    std::unordered_set<std::string> seen;
+    unsigned i = 0;
+    while (r.size() < n) {
+        std::string s = prefixes[i % 10];
+        s += ".";
+        s += parts[(i / 10) % 16];
+        if (i >= 160) {
+            s += "_";
+            s += std::to_string(i / 160);
+        }
+        if ((i / 7) % 3 == 0)
+            s += ".aux";
+        if (seen.insert(s).second)
+            r.push_back(s);
+        i++;
+    }
+    return r;
+}
+
+static void tst2() {
+    /* `hash_str` is used for `Name` hashes stored in .olean files, its results must not change. */
+    lean_assert(hash_str(18, "Lean.Meta.whnfCore", 11) == 1056383029u);
+    std::string s = "Lean.Meta.whnfCore.go.match_1";
+    lean_assert(hash_str64(s.size(), s.c_str(), 11) == hash_str64(s.size(), s.c_str(), 11));
+    lean_assert(hash_str64(s.size(), s.c_str(), 11) != hash_str64(s.size(), s.c_str(), 12));
+    lean_assert(hash_str64(0, "", 11) != hash_str64(0, "", 12));
+    /* Result must not depend on the alignment of the input. */
+    char buffer[128];
+    for (size_t len = 0; len < 100; len++) {
+        std::string t(len, 'x');
+        for (size_t i = 0; i < len; i++) t[i] = static_cast<char>('a' + (i * 7) % 26);
+        uint64 h = hash_str64(len, t.c_str(), 31);
+        for (size_t off = 1; off < 8; off++) {
+            memcpy(buffer + off, t.c_str(), len);
+            lean_assert(hash_str64(len, buffer + off, 31) == h);
+        }
+    }
+}
+
+static void tst3() {
+    std::vector<std::string> names = mk_name_corpus(10000);
+    std::unordered_set<uint64> h64;
+    for (std::string const & n : names)
+        h64.insert(hash_str64(n.size(), n.c_str(), 11));
+    lean_always_assert(h64.size() == names.size());
+}
+
 int main() {
     tst1();
+    tst2();
+    tst3();
     return has_violations() ? 1 : 0;
 }
@@ -0,0 +1,86 @@
+/*
+Copyright (c) 2021 Microsoft Corporation. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+*/
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <lean/compiler_hints.h>
+#include "util/test.h"
+#include "util/timeit.h"
+#include "util/lz.h"
+using namespace lean;
+
+static size_t check_roundtrip(std::string const & s) {
+    std::vector<char> c(lz_compress_bound(s.size()));
+    size_t sz = lz_compress(s.data(), s.size(), c.data());
+    lean_assert(sz <= c.size());
+    std::vector<char> d(s.size() + 1);
+    lean_assert(lz_decompress(c.data(), sz, d.data(), s.size()));
+    lean_assert(std::string(d.data(), s.size()) == s);
+    // wrong output size must be rejected
+    lean_assert(!lz_decompress(c.data(), sz, d.data(), s.size() + 1));
+    if (s.size() > 0)
+        lean_assert(!lz_decompress(c.data(), sz, d.data(), s.size() - 1));
+    return sz;
+}
+
+static void tst1() {
+    check_roundtrip("");
+    check_roundtrip("a");
+    check_roundtrip("abcdefghijklmnopqrstuvwxyz");
+    check_roundtrip(std::string(100000, 'x'));
+    std::string s;
+    for (unsigned i = 0; i < 10000; i++)
+        s += "Lean.Expr.app " + std::to_string(i % 97) + " ";
+    lean_assert(check_roundtrip(s) < s.size() / 4);
+    std::srand(42);
+    std::string r;
+    for (unsigned i = 0; i < 100000; i++)
+        r += static_cast<char>(std::rand());
+    lean_assert(check_roundtrip(r) <= lz_compress_bound(r.size()));
+    for (unsigned n = 0; n < 300; n++)
+        check_roundtrip(s.substr(0, n) + r.substr(0, n) + s.substr(n, n));
+}
+
+static void tst2() {
+    // corrupted input must not crash the decompressor
+    std::string s;
+    for (unsigned i = 0; i < 1000; i++)
+        s += "abc" + std::to_string(i);
+    std::vector<char> c(lz_compress_bound(s.size()));
+    size_t sz = lz_compress(s.data(), s.size(), c.data());
+    std::vector<char> d(s.size());
+    std::srand(7);
+    for (unsigned i = 0; i < 10000; i++) {
+        std::vector<char> c2(c.begin(), c.begin() + sz);
+        c2[std::rand() % sz] ^= static_cast<char>(1 + std::rand() % 255);
+        lz_decompress(c2.data(), std::rand() % (sz + 1), d.data(), d.size());
+    }
+}
+
+static void tst3() {
+    std::string s;
+    for (unsigned i = 0; i < 2000000; i++)
+        s += static_cast<char>(i % 7 == 0 ? i % 251 : i % 13);
+    std::vector<char> c(lz_compress_bound(s.size()));
+    std::vector<char> d(s.size());
+    size_t sz;
+    {
+        timeit timer(std::cout, "lz_compress");
+        sz = lz_compress(s.data(), s.size(), c.data());
+    }
+    {
+        timeit timer(std::cout, "lz_decompress");
+        lean_assert(lz_decompress(c.data(), sz, d.data(), d.size()));
+    }
+    std::cout << s.size() << " -> " << sz << " bytes\n";
+}
+
+int main() {
+    tst1();
+    tst2();
+    tst3();
+    return has_violations() ? 1 : 0;
+}
@@ -5,6 +5,7 @@ Released under Apache 2.0 license as described in the file LICENSE.
 Author: Leonardo de Moura
 */
 #include <utility>
+#include <algorithm>
 #include <random>
 #include <iostream>
 #include <vector>
@@ -724,6 +725,252 @@ void tst21() {
     }
 }
 
+obj_res task8_leaf_fn(obj_arg val, obj_arg) {
+    return box(unbox(val) * 2);
+}
+
+/* Spawn tasks from a worker thread, they are stored in the worker's own queues and stolen by the other workers. */
+obj_res task8_fn(obj_arg val, obj_arg) {
+    object * r = alloc_array(0, 8);
+    for (unsigned i = 0; i < 8; i++) {
+        object * c = alloc_closure(task8_leaf_fn, 1);
+        closure_set(c, 0, box(unbox(val) + i));
+        r = lean_array_push(r, task_spawn(c, i % 3));
+    }
+    return r;
+}
+
+void tst22() {
+    scoped_task_manager m(8);
+    std::cout << ">> tst22 started...\n";
+    std::vector<object_ref> tasks;
+    for (unsigned i = 0; i < 1000; i++) {
+        object * c = alloc_closure(task8_fn, 1);
+        closure_set(c, 0, box(i));
+        tasks.push_back(object_ref(task_spawn(c)));
+    }
+    size_t sum = 0, expected = 0;
+    for (unsigned i = 0; i < 1000; i++) {
+        object * ts = task_get(tasks[i].raw());
+        for (unsigned j = 0; j < 8; j++) {
+            sum      += unbox(task_get(array_get(ts, j)));
+            expected += 2*(i + j);
+        }
+    }
+    lean_assert(sum == expected);
+}
+
+static atomic<unsigned> g_num_ext_freed(0);
+static lean_external_class * g_ext_class = nullptr;
+
+static void ext_finalize(void *) { g_num_ext_freed++; }
+static void ext_foreach(void *, b_obj_arg) {}
+
+/* Increment and decrement the RC of all elements of `a` `n` times. */
+static void rc_loop(b_obj_arg a, unsigned n) {
+    size_t sz = array_size(a);
+    for (unsigned i = 0; i < n; i++) {
+        for (size_t j = 0; j < sz; j++) {
+            object * e = array_get(a, j);
+            lean_inc_ref(e);
+            lean_dec_ref(e);
+        }
+    }
+}
+
+static obj_res task23_fn(obj_arg a, obj_arg) {
+    rc_loop(a, 1000);
+    /* Release references counted by the thread that marked the elements as multi-threaded. */
+    for (size_t j = 0; j < array_size(a); j++)
+        lean_dec_ref(array_get(a, j));
+    dec(a);
+    return box(0);
+}
+
+void tst23() {
+    if (!g_ext_class) g_ext_class = lean_register_external_class(ext_finalize, ext_foreach);
+    g_num_ext_freed = 0;
+    unsigned n = 1000, num_tasks = 4;
+    object * a = alloc_array(0, n);
+    for (unsigned i = 0; i < n; i++)
+        a = array_push(a, lean_alloc_external(g_ext_class, nullptr));
+    mark_mt(a);
+    {
+        timeit timer(std::cout, "multi-threaded RC, single thread");
+        rc_loop(a, 1000 * num_tasks);
+    }
+    {
+        scoped_task_manager m(num_tasks);
+        timeit timer(std::cout, "multi-threaded RC, concurrent tasks");
+        std::vector<object_ref> tasks;
+        for (unsigned i = 0; i < num_tasks; i++) {
+            for (unsigned j = 0; j < n; j++)
+                lean_inc_ref(array_get(a, j));
+            inc(a);
+            object * c = alloc_closure(task23_fn, 1);
+            closure_set(c, 0, a);
+            tasks.push_back(object_ref(task_spawn(c)));
+        }
+        rc_loop(a, 1000);
+        for (object_ref const & t : tasks)
+            task_get(t.raw());
+        lean_assert(g_num_ext_freed == 0);
+        dec(a);
+        lean_assert(g_num_ext_freed == n);
+    }
+    /* The thread that marks the object as multi-threaded finishes before the last reference is released. */
+    object * e = nullptr;
+    lthread t([&]() { e = lean_alloc_external(g_ext_class, nullptr); mark_mt(e); });
+    t.join();
+    inc(e);
+    dec(e);
+    lean_assert(g_num_ext_freed == n);
+    dec(e);
+    lean_assert(g_num_ext_freed == n + 1);
+}
+
+static obj_res mk_list(unsigned n, obj_arg tail) {
+    object * r = tail;
+    for (unsigned i = 0; i < n; i++) {
+        object * c = alloc_cnstr(1, 2, 0);
+        cnstr_set(c, 0, box(i));
+        cnstr_set(c, 1, r);
+        r = c;
+    }
+    return r;
+}
+
+void tst24() {
+    if (!g_ext_class) g_ext_class = lean_register_external_class(ext_finalize, ext_foreach);
+    g_num_ext_freed = 0;
+    unsigned n = 1000000;
+    {
+        object * l = mk_list(n, lean_alloc_external(g_ext_class, nullptr));
+        timeit timer(std::cout, "free list");
+        dec(l);
+    }
+    lean_assert(g_num_ext_freed == 1);
+    lean_set_del_budget(1000);
+    object * l = mk_list(n, lean_alloc_external(g_ext_class, nullptr));
+    {
+        timeit timer(std::cout, "free list with budget");
+        dec(l);
+    }
+    lean_assert(g_num_ext_freed == 1);
+    /* Other deletions and allocations free the remaining objects incrementally. */
+    for (unsigned i = 0; i < n / 4000; i++)
+        dec(mk_list(1, box(0)));
+    lean_assert(g_num_ext_freed == 1);
+    lean_del_deferred();
+    lean_assert(g_num_ext_freed == 2);
+    /* Resetting the budget frees the pending objects. */
+    dec(mk_list(n, lean_alloc_external(g_ext_class, nullptr)));
+    lean_assert(g_num_ext_freed == 2);
+    lean_set_del_budget(0);
+    lean_assert(g_num_ext_freed == 3);
+    /* Small object allocations also free deferred objects. */
+    lean_set_del_budget(1000);
+    dec(mk_list(n, lean_alloc_external(g_ext_class, nullptr)));
+    std::vector<object *> cs;
+    for (unsigned i = 0; i < n / 500; i++) {
+        object * c = lean_alloc_ctor(0, 1, 0);
+        lean_ctor_set(c, 0, box(i));
+        cs.push_back(c);
+    }
+    lean_assert(g_num_ext_freed == 4);
+    lean_set_del_budget(0);
+    for (object * c : cs) dec(c);
+}
+
+obj_res task25_fn(obj_arg id, obj_arg) {
+    this_thread::sleep_for(std::chrono::microseconds(unbox(id) % 7 * 100));
+    return id;
+}
+
+/* `io_wait_any_core` on many tasks, as in a server waiting for the next request. */
+void tst25() {
+    scoped_task_manager m(8);
+    unsigned n = 2000;
+    std::vector<object_ref> pending;
+    for (unsigned i = 0; i < n; i++) {
+        object * c = alloc_closure(task25_fn, 1);
+        closure_set(c, 0, box(i));
+        pending.push_back(object_ref(task_spawn(c)));
+    }
+    timeit timer(std::cout, "wait_any");
+    std::vector<bool> seen(n, false);
+    while (!pending.empty()) {
+        object * l = box(0);
+        for (object_ref const & t : pending) {
+            object * new_l = alloc_cnstr(1, 2, 0);
+            cnstr_set(new_l, 0, t.to_obj_arg());
+            cnstr_set(new_l, 1, l);
+            l = new_l;
+        }
+        object * r = io_wait_any_core(l);
+        lean_assert(io_has_finished_core(r));
+        unsigned id = unbox(task_get(r));
+        lean_assert(!seen[id]);
+        seen[id] = true;
+        pending.erase(std::find_if(pending.begin(), pending.end(), [&](object_ref const & t) { return t.raw() == r; }));
+        dec(l);
+    }
+}
+
+extern "C" obj_res lean_st_ref_take(b_obj_arg ref, obj_arg);
+
+static object * io_result_steal_value(object * r) {
+    lean_assert(io_result_is_ok(r));
+    object * v = io_result_get_value(r);
+    inc(v);
+    dec(r);
+    return v;
+}
+
+obj_res slow_thunk_fn(obj_arg) {
+    this_thread::sleep_for(std::chrono::milliseconds(50));
+    return box(42);
+}
+
+/* Contended accesses to `ST.Ref`s and thunks. */
+void tst26() {
+    unsigned num_threads = 8;
+    unsigned n           = 2000;
+    object * ref = io_result_steal_value(lean_st_mk_ref(box(0), io_mk_world()));
+    mark_mt(ref);
+    {
+        std::vector<std::unique_ptr<lthread>> threads;
+        for (unsigned i = 0; i < num_threads; i++) {
+            threads.emplace_back(new lthread([&]() {
+                for (unsigned j = 0; j < n; j++) {
+                    // `take` and `set` use the reference as a lock
+                    object * v = io_result_steal_value(lean_st_ref_take(ref, io_mk_world()));
+                    dec(lean_st_ref_set(ref, box(unbox(v) + 1), io_mk_world()));
+                }
+            }));
+        }
+        for (auto & t : threads)
+            t->join();
+    }
+    object * sum = io_result_steal_value(lean_st_ref_get(ref, io_mk_world()));
+    lean_always_assert(unbox(sum) == num_threads * n);
+    dec(ref);
+
+    object * t = mk_thunk(alloc_closure(slow_thunk_fn, 0));
+    mark_mt(t);
+    {
+        std::vector<std::unique_ptr<lthread>> threads;
+        for (unsigned i = 0; i < num_threads; i++)
+            threads.emplace_back(new lthread([&]() {
+                b_obj_res v = thunk_get(t);
+                lean_always_assert(unbox(v) == 42);
+            }));
+        for (auto & th : threads)
+            th->join();
+    }
+    dec(t);
+}
+
 int main() {
     save_stack_info();
     initialize_util_module();
@@ -747,6 +994,11 @@ int main() {
     tst19();
     tst20();
     tst21();
+    tst22();
+    tst23();
+    tst24();
+    tst25();
+    tst26();
     finalize_util_module();
     return has_violations() ? 1 : 0;
 }
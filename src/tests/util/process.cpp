@@ -0,0 +1,122 @@
+/*
+Copyright (c) 2021 Microsoft Corporation. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+*/
+#include <string>
+#include <vector>
+#include <utility>
+#include <cstring>
+#include <lean/compiler_hints.h>
+#include <lean/lean.h>
+#include <lean/init_module.h>
+#include "util/test.h"
+using namespace lean;
+
+extern "C" lean_obj_res lean_io_process_spawn(lean_obj_arg args, lean_obj_arg w);
+extern "C" lean_obj_res lean_io_process_child_wait(b_lean_obj_arg, b_lean_obj_arg child, lean_obj_arg w);
+
+enum stdio_mode { PIPED = 0, INHERIT = 1, NUL = 2 };
+
+typedef std::vector<std::pair<char const *, char const *>> env_t;
+
+static lean_object * mk_option_string(char const * s) {
+    if (s == nullptr)
+        return lean_box(0);
+    lean_object * r = lean_alloc_ctor(1, 1, 0);
+    lean_ctor_set(r, 0, lean_mk_string(s));
+    return r;
+}
+
+/* Create an `IO.Process.SpawnArgs` object. */
+static lean_object * mk_spawn_args(char const * cmd, std::vector<char const *> const & args, stdio_mode mode,
+                                   char const * cwd = nullptr, env_t const & env = env_t()) {
+    lean_object * cfg = lean_alloc_ctor(0, 0, 3);
+    for (unsigned i = 0; i < 3; i++)
+        lean_ctor_set_uint8(cfg, i, mode);
+    lean_object * as = lean_mk_empty_array();
+    for (char const * arg : args)
+        as = lean_array_push(as, lean_mk_string(arg));
+    lean_object * es = lean_mk_empty_array();
+    for (auto const & e : env) {
+        lean_object * p = lean_alloc_ctor(0, 2, 0);
+        lean_ctor_set(p, 0, lean_mk_string(e.first));
+        lean_ctor_set(p, 1, mk_option_string(e.second));
+        es = lean_array_push(es, p);
+    }
+    lean_object * r = lean_alloc_ctor(0, 5, 0);
+    lean_ctor_set(r, 0, cfg);
+    lean_ctor_set(r, 1, lean_mk_string(cmd));
+    lean_ctor_set(r, 2, as);
+    lean_ctor_set(r, 3, mk_option_string(cwd));
+    lean_ctor_set(r, 4, es);
+    return r;
+}
+
+static unsigned wait_child(lean_object * child) {
+    lean_object * r = lean_io_process_child_wait(lean_box(0), child, lean_io_mk_world());
+    lean_always_assert(!lean_io_result_is_error(r));
+    unsigned code = lean_unbox_uint32(lean_io_result_get_value(r));
+    lean_dec(r);
+    return code;
+}
+
+/* Spawn a process, wait for it, and return its exit code, or `-1` if it could not be spawned. */
+static int run(char const * cmd, std::vector<char const *> const & args, char const * cwd = nullptr, env_t const & env = env_t()) {
+    lean_object * r = lean_io_process_spawn(mk_spawn_args(cmd, args, NUL, cwd, env), lean_io_mk_world());
+    if (lean_io_result_is_error(r)) {
+        lean_dec(r);
+        return -1;
+    }
+    int code = wait_child(lean_io_result_get_value(r));
+    lean_dec(r);
+    return code;
+}
+
+static void tst1() {
+    int r = run("true", {});
+    lean_always_assert(r == 0);
+    r = run("sh", {"-c", "exit 3"});
+    lean_always_assert(r == 3);
+    r = run("lean-test-no-such-program", {});
+    lean_always_assert(r == -1);
+    r = run("sh", {"-c", "test \"$LEAN_TEST_VAR\" = abc && test -z \"$HOME\""}, nullptr,
+            {{"LEAN_TEST_VAR", "abc"}, {"HOME", nullptr}});
+    lean_always_assert(r == 0);
+    r = run("sh", {"-c", "test \"$(pwd)\" = /"}, "/");
+    lean_always_assert(r == 0);
+    // a bad working directory is reported as an error, not as an exit status
+    r = run("sh", {"-c", "exit 0"}, "/lean-test-no-such-directory");
+    lean_always_assert(r == -1);
+    r = run("sh", {"-c", "exit 0"}, "/bin/sh");
+    lean_always_assert(r == -1);
+    // the program is searched in the `PATH` of the child
+    r = run("true", {}, nullptr, {{"PATH", "/lean-test-no-such-directory"}});
+    lean_always_assert(r == -1);
+    r = run("true", {}, nullptr, {{"PATH", "/lean-test-no-such-directory:/bin:/usr/bin"}});
+    lean_always_assert(r == 0);
+}
+
+static void tst2() {
+    lean_object * r = lean_io_process_spawn(mk_spawn_args("sh", {"-c", "read x; echo \"$x$x\""}, PIPED), lean_io_mk_world());
+    lean_always_assert(!lean_io_result_is_error(r));
+    lean_object * child = lean_io_result_get_value(r);
+    FILE * in  = static_cast<FILE *>(lean_get_external_data(lean_ctor_get(child, 0)));
+    FILE * out = static_cast<FILE *>(lean_get_external_data(lean_ctor_get(child, 1)));
+    fputs("hello\n", in);
+    fflush(in);
+    char buf[64];
+    char * line = fgets(buf, sizeof(buf), out);
+    lean_always_assert(line != nullptr && strcmp(buf, "hellohello\n") == 0);
+    unsigned code = wait_child(child);
+    lean_always_assert(code == 0);
+    lean_dec(r);
+}
+
+int main() {
+    save_stack_info();
+    initialize_runtime_module();
+    tst1();
+    tst2();
+    finalize_runtime_module();
+    return has_violations() ? 1 : 0;
+}
@@ -0,0 +1,116 @@
+/*
+Copyright (c) 2021 Microsoft Corporation. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+*/
+#include <iostream>
+#include <string>
+#include <cstdlib>
+#include "util/test.h"
+#include "util/timeit.h"
+#include <lean/utf8.h>
+using namespace lean;
+
+/* Reference implementations */
+static size_t strlen_ref(std::string const & s) {
+    size_t r = 0;
+    for (unsigned char c : s) r += (c & 0xC0) != 0x80;
+    return r;
+}
+
+static bool validate_ref(std::string const & s) {
+    size_t i = 0;
+    while (i < s.size()) {
+        unsigned c = static_cast<unsigned char>(s[i]);
+        size_t j = i;
+        unsigned r = next_utf8(s, j);
+        /* `next_utf8` consumes a single byte and returns it on invalid input */
+        if (c >= 0x80 && j == i + 1)
+            return false;
+        std::string tmp;
+        push_unicode_scalar(tmp, r);
+        if (tmp != s.substr(i, j - i))
+            return false;
+        i = j;
+    }
+    return true;
+}
+
+static size_t seek_ref(std::string const & s, size_t idx) {
+    for (size_t i = 0; i < s.size(); i++) {
+        if ((static_cast<unsigned char>(s[i]) & 0xC0) != 0x80) {
+            if (idx == 0) return i;
+            idx--;
+        }
+    }
+    return s.size();
+}
+
+static std::string mk_text(unsigned n, unsigned non_ascii_freq) {
+    static unsigned const codes[] = { 0xE9, 0x3B1, 0x2200, 0x2192, 0x1D538, 0x4E2D };
+    std::string s;
+    for (unsigned i = 0; i < n; i++) {
+        if (std::rand() % non_ascii_freq == 0)
+            push_unicode_scalar(s, codes[std::rand() % 6]);
+        else
+            s.push_back(static_cast<char>('a' + std::rand() % 26));
+    }
+    return s;
+}
+
+static void tst1() {
+    std::srand(17);
+    for (unsigned k = 0; k < 2000; k++) {
+        std::string s = mk_text(std::rand() % 300, 1 + std::rand() % 40);
+        lean_assert(utf8_strlen(s) == strlen_ref(s));
+        lean_assert(validate_utf8(s.data(), s.size()));
+        for (size_t idx = 0; idx <= s.size(); idx += 1 + idx / 4)
+            lean_assert(utf8_seek(s.data(), s.size(), idx) == seek_ref(s, idx));
+        /* corrupt a byte */
+        if (!s.empty()) {
+            s[std::rand() % s.size()] = static_cast<char>(std::rand() % 256);
+            lean_assert(validate_utf8(s.data(), s.size()) == validate_ref(s));
+            lean_assert(utf8_strlen(s) == strlen_ref(s));
+        }
+    }
+}
+
+static void tst2() {
+    auto valid = [](std::string const & s) { return validate_utf8(s.data(), s.size()); };
+    lean_assert(valid(""));
+    lean_assert(valid("abc\xce\xb1\xe2\x88\x80\xf0\x9d\x94\xb8"));
+    lean_assert(!valid("\xc0\x80"));           // overlong
+    lean_assert(!valid("\xe0\x80\x80"));       // overlong
+    lean_assert(!valid("\xed\xa0\x80"));       // surrogate
+    lean_assert(!valid("\xf4\x90\x80\x80"));   // > 0x10FFFF
+    lean_assert(!valid("\xf8\x88\x80\x80\x80"));
+    lean_assert(!valid("\x80"));
+    lean_assert(!valid(std::string(40, 'a') + "\xce"));
+    lean_assert(valid(std::string("a\0b", 3)));
+    lean_assert(*utf8_char_pos("a\xce\xb1" "b", 2) == 3);
+    lean_assert(!utf8_char_pos("a\xce\xb1" "b", 3));
+}
+
+static void tst3() {
+    std::string s = mk_text(16 * 1024 * 1024, 20);
+    size_t r = 0;
+    {
+        timeit timer(std::cout, "utf8_strlen");
+        for (unsigned i = 0; i < 10; i++) r += utf8_strlen(s);
+    }
+    {
+        timeit timer(std::cout, "validate_utf8");
+        for (unsigned i = 0; i < 10; i++) r += validate_utf8(s.data(), s.size());
+    }
+    {
+        timeit timer(std::cout, "utf8_seek");
+        for (unsigned i = 0; i < 10; i++) r += utf8_seek(s.data(), s.size(), s.size() / 2);
+    }
+    std::cout << r % 2 << "\n";
+}
+
+int main() {
+    tst1();
+    tst2();
+    tst3();
+    return has_violations() ? 1 : 0;
+}
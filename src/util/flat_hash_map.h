@@ -0,0 +1,358 @@
+/*
+Copyright (c) 2021 Microsoft Corporation. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+*/
+#pragma once
+#include <utility>
+#include <functional>
+#include <type_traits>
+#include <cstdint>
+#include <new>
+#include <lean/compiler_hints.h>
+#include <lean/debug.h>
+
+namespace lean {
+/** \brief Hash map using open addressing with linear probing.
+
+    Hash codes, keys and values are stored in separate arrays. Lookups compare the cached hash codes
+    before comparing keys, and no memory is allocated per element. Erased entries are removed using
+    backward shifting, i.e., there are no tombstones.
+
+    \remark As opposed to `std::unordered_map`, inserting or erasing elements invalidates iterators,
+    pointers and references into the map. */
+template<typename K, typename T, typename H = std::hash<K>, typename E = std::equal_to<K>>
+class flat_hash_map {
+public:
+    typedef K                  key_type;
+    typedef T                  mapped_type;
+    typedef std::pair<K, T>    value_type;
+    typedef size_t             size_type;
+private:
+    /* `m_hashes[i] == 0` iff the bucket `i` is empty. */
+    unsigned * m_hashes;
+    K *        m_keys;
+    T *        m_values;
+    size_t     m_capacity; // 0 or a power of two
+    size_t     m_size;
+    unsigned   m_shift;    // 64 - log2(m_capacity)
+    H          m_hash;
+    E          m_eq;
+
+    unsigned get_hash(K const & k) const {
+        unsigned h = static_cast<unsigned>(m_hash(k));
+        return h == 0 ? 1 : h;
+    }
+
+    /* Fibonacci hashing, we should not assume the low bits of the hash codes are well distributed. */
+    size_t home(unsigned h) const {
+        return static_cast<size_t>((static_cast<uint64_t>(h) * 0x9E3779B97F4A7C15ull) >> m_shift);
+    }
+
+    size_t next(size_t i) const { return (i + 1) & (m_capacity - 1); }
+
+    size_t find_index(K const & k) const {
+        if (m_size == 0)
+            return m_capacity;
+        unsigned h = get_hash(k);
+        size_t i   = home(h);
+        while (true) {
+            unsigned h_i = m_hashes[i];
+            if (h_i == 0)
+                return m_capacity;
+            if (h_i == h && m_eq(m_keys[i], k))
+                return i;
+            i = next(i);
+        }
+    }
+
+    void alloc(size_t capacity) {
+        lean_assert((capacity & (capacity - 1)) == 0);
+        m_capacity = capacity;
+        m_shift    = 64;
+        while (capacity > 1) { capacity >>= 1; m_shift--; }
+        m_hashes   = new unsigned[m_capacity]();
+        m_keys     = static_cast<K*>(::operator new(sizeof(K) * m_capacity));
+        m_values   = static_cast<T*>(::operator new(sizeof(T) * m_capacity));
+    }
+
+    void destroy_elements() {
+        for (size_t i = 0; i < m_capacity; i++) {
+            if (m_hashes[i] != 0) {
+                m_keys[i].~K();
+                m_values[i].~T();
+                m_hashes[i] = 0;
+            }
+        }
+        m_size = 0;
+    }
+
+    void dealloc() {
+        if (m_capacity > 0) {
+            destroy_elements();
+            delete[] m_hashes;
+            ::operator delete(m_keys);
+            ::operator delete(m_values);
+        }
+        m_hashes   = nullptr;
+        m_keys     = nullptr;
+        m_values   = nullptr;
+        m_capacity = 0;
+    }
+
+    /* Store a new entry, `k` must not be in the table, and there must be an empty bucket. */
+    template<typename K2, typename T2>
+    size_t insert_new(unsigned h, K2 && k, T2 && v) {
+        size_t i = home(h);
+        while (m_hashes[i] != 0)
+            i = next(i);
+        m_hashes[i] = h;
+        new (m_keys + i) K(std::forward<K2>(k));
+        new (m_values + i) T(std::forward<T2>(v));
+        m_size++;
+        return i;
+    }
+
+    void rehash(size_t new_capacity) {
+        unsigned * old_hashes   = m_hashes;
+        K *        old_keys     = m_keys;
+        T *        old_values   = m_values;
+        size_t     old_capacity = m_capacity;
+        alloc(new_capacity);
+        m_size = 0;
+        for (size_t i = 0; i < old_capacity; i++) {
+            if (old_hashes[i] != 0) {
+                insert_new(old_hashes[i], std::move(old_keys[i]), std::move(old_values[i]));
+                old_keys[i].~K();
+                old_values[i].~T();
+            }
+        }
+        delete[] old_hashes;
+        ::operator delete(old_keys);
+        ::operator delete(old_values);
+    }
+
+    /* Make sure there is space for one more element. Maximum load factor is 3/4. */
+    void reserve_one() {
+        if (m_capacity == 0)
+            alloc(8);
+        else if (4 * (m_size + 1) > 3 * m_capacity)
+            rehash(2 * m_capacity);
+    }
+
+    /* Remove the entry at bucket `i` and shift back the following entries of the cluster. */
+    void erase_at(size_t i) {
+        m_keys[i].~K();
+        m_values[i].~T();
+        m_hashes[i] = 0;
+        m_size--;
+        size_t j = i;
+        while (true) {
+            j = next(j);
+            unsigned h_j = m_hashes[j];
+            if (h_j == 0)
+                return;
+            size_t k = home(h_j);
+            /* The entry at `j` can be moved to `i` iff its home `k` is not in the cyclic range (i, j] */
+            bool in_range = i <= j ? (i < k && k <= j) : (i < k || k <= j);
+            if (!in_range) {
+                m_hashes[i] = h_j;
+                new (m_keys + i) K(std::move(m_keys[j]));
+                new (m_values + i) T(std::move(m_values[j]));
+                m_keys[j].~K();
+                m_values[j].~T();
+                m_hashes[j] = 0;
+                i = j;
+            }
+        }
+    }
+
+public:
+    template<bool Const>
+    class iterator_core {
+        friend class flat_hash_map;
+        typedef typename std::conditional<Const, flat_hash_map const, flat_hash_map>::type table;
+        typedef typename std::conditional<Const, T const, T>::type value;
+        table * m_table;
+        size_t  m_idx;
+        void skip_empty() {
+            while (m_idx < m_table->m_capacity && m_table->m_hashes[m_idx] == 0)
+                m_idx++;
+        }
+        iterator_core(table * t, size_t idx):m_table(t), m_idx(idx) {}
+    public:
+        struct reference {
+            K const & first;
+            value &   second;
+        };
+        struct pointer {
+            reference m_ref;
+            reference * operator->() { return &m_ref; }
+        };
+        iterator_core():m_table(nullptr), m_idx(0) {}
+        template<bool C2, typename = typename std::enable_if<Const && !C2>::type>
+        iterator_core(iterator_core<C2> const & it):m_table(it.m_table), m_idx(it.m_idx) {}
+        reference operator*() const { return reference{m_table->m_keys[m_idx], m_table->m_values[m_idx]}; }
+        pointer operator->() const { return pointer{**this}; }
+        iterator_core & operator++() { m_idx++; skip_empty(); return *this; }
+        iterator_core operator++(int) { iterator_core r = *this; ++(*this); return r; }
+        friend bool operator==(iterator_core const & it1, iterator_core const & it2) { return it1.m_idx == it2.m_idx; }
+        friend bool operator!=(iterator_core const & it1, iterator_core const & it2) { return it1.m_idx != it2.m_idx; }
+        template<bool C> friend class iterator_core;
+    };
+    typedef iterator_core<false> iterator;
+    typedef iterator_core<true>  const_iterator;
+
+    flat_hash_map(size_t capacity = 0, H const & h = H(), E const & eq = E()):
+        m_hashes(nullptr), m_keys(nullptr), m_values(nullptr), m_capacity(0), m_size(0), m_shift(64), m_hash(h), m_eq(eq) {
+        if (capacity > 0)
+            reserve(capacity);
+    }
+    flat_hash_map(flat_hash_map const & m):flat_hash_map(0, m.m_hash, m.m_eq) {
+        if (m.m_size > 0) {
+            alloc(m.m_capacity);
+            for (size_t i = 0; i < m.m_capacity; i++) {
+                if (m.m_hashes[i] != 0)
+                    insert_new(m.m_hashes[i], m.m_keys[i], m.m_values[i]);
+            }
+        }
+    }
+    flat_hash_map(flat_hash_map && m):flat_hash_map(0, m.m_hash, m.m_eq) { swap(m); }
+    ~flat_hash_map() { dealloc(); }
+
+    flat_hash_map & operator=(flat_hash_map const & m) {
+        if (this != &m) {
+            flat_hash_map tmp(m);
+            swap(tmp);
+        }
+        return *this;
+    }
+    flat_hash_map & operator=(flat_hash_map && m) { swap(m); return *this; }
+
+    void swap(flat_hash_map & m) {
+        std::swap(m_hashes, m.m_hashes);
+        std::swap(m_keys, m.m_keys);
+        std::swap(m_values, m.m_values);
+        std::swap(m_capacity, m.m_capacity);
+        std::swap(m_size, m.m_size);
+        std::swap(m_shift, m.m_shift);
+        std::swap(m_hash, m.m_hash);
+        std::swap(m_eq, m.m_eq);
+    }
+
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+    size_t capacity() const { return m_capacity; }
+
+    /** \brief Make sure `n` elements can be stored without rehashing. */
+    void reserve(size_t n) {
+        size_t c = m_capacity == 0 ? 8 : m_capacity;
+        while (4 * n > 3 * c)
+            c *= 2;
+        if (m_capacity == 0)
+            alloc(c);
+        else if (c > m_capacity)
+            rehash(c);
+    }
+
+    /** \brief Remove all elements, the memory is not released. */
+    void clear() {
+        if (m_size > 0)
+            destroy_elements();
+    }
+
+    iterator begin() { iterator it(this, 0); it.skip_empty(); return it; }
+    iterator end() { return iterator(this, m_capacity); }
+    const_iterator begin() const { const_iterator it(this, 0); it.skip_empty(); return it; }
+    const_iterator end() const { return const_iterator(this, m_capacity); }
+
+    iterator find(K const & k) { return iterator(this, find_index(k)); }
+    const_iterator find(K const & k) const { return const_iterator(this, find_index(k)); }
+    size_t count(K const & k) const { return find_index(k) != m_capacity ? 1 : 0; }
+
+    template<typename K2, typename T2>
+    std::pair<iterator, bool> emplace(K2 && k, T2 && v) {
+        size_t i = find_index(k);
+        if (i != m_capacity)
+            return std::make_pair(iterator(this, i), false);
+        reserve_one();
+        i = insert_new(get_hash(k), std::forward<K2>(k), std::forward<T2>(v));
+        return std::make_pair(iterator(this, i), true);
+    }
+
+    template<typename K2, typename T2>
+    std::pair<iterator, bool> insert(std::pair<K2, T2> const & p) { return emplace(p.first, p.second); }
+    template<typename K2, typename T2>
+    std::pair<iterator, bool> insert(std::pair<K2, T2> && p) { return emplace(std::move(p.first), std::move(p.second)); }
+
+    T & operator[](K const & k) {
+        size_t i = find_index(k);
+        if (i == m_capacity) {
+            reserve_one();
+            i = insert_new(get_hash(k), k, T());
+        }
+        return m_values[i];
+    }
+
+    size_t erase(K const & k) {
+        size_t i = find_index(k);
+        if (i == m_capacity)
+            return 0;
+        erase_at(i);
+        return 1;
+    }
+
+    /** \brief Erase the element at `it`, and return an iterator to the next element.
+        \remark Elements may be moved to the position of the erased one, so this method
+        must not be used to erase elements while iterating over the map. */
+    iterator erase(const_iterator it) {
+        erase_at(it.m_idx);
+        iterator r(this, it.m_idx);
+        r.skip_empty();
+        return r;
+    }
+};
+
+/** \brief Hash set using open addressing, see `flat_hash_map`. */
+template<typename K, typename H = std::hash<K>, typename E = std::equal_to<K>>
+class flat_hash_set {
+    struct unit {};
+    typedef flat_hash_map<K, unit, H, E> map;
+    map m_map;
+public:
+    typedef K key_type;
+    typedef K value_type;
+
+    class const_iterator {
+        friend class flat_hash_set;
+        typename map::const_iterator m_it;
+        const_iterator(typename map::const_iterator const & it):m_it(it) {}
+    public:
+        K const & operator*() const { return (*m_it).first; }
+        K const * operator->() const { return &((*m_it).first); }
+        const_iterator & operator++() { ++m_it; return *this; }
+        const_iterator operator++(int) { const_iterator r = *this; ++m_it; return r; }
+        friend bool operator==(const_iterator const & it1, const_iterator const & it2) { return it1.m_it == it2.m_it; }
+        friend bool operator!=(const_iterator const & it1, const_iterator const & it2) { return it1.m_it != it2.m_it; }
+    };
+    typedef const_iterator iterator;
+
+    flat_hash_set(size_t capacity = 0, H const & h = H(), E const & eq = E()):m_map(capacity, h, eq) {}
+
+    size_t size() const { return m_map.size(); }
+    bool empty() const { return m_map.empty(); }
+    void reserve(size_t n) { m_map.reserve(n); }
+    void clear() { m_map.clear(); }
+    void swap(flat_hash_set & s) { m_map.swap(s.m_map); }
+
+    const_iterator begin() const { return const_iterator(m_map.begin()); }
+    const_iterator end() const { return const_iterator(m_map.end()); }
+    const_iterator find(K const & k) const { return const_iterator(m_map.find(k)); }
+    size_t count(K const & k) const { return m_map.count(k); }
+
+    std::pair<const_iterator, bool> insert(K const & k) {
+        auto r = m_map.emplace(k, unit());
+        return std::make_pair(const_iterator(r.first), r.second);
+    }
+    size_t erase(K const & k) { return m_map.erase(k); }
+};
+}
@@ -0,0 +1,148 @@
+/*
+Copyright (c) 2021 Microsoft Corporation. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+*/
+#include <cstring>
+#include <vector>
+#include <cstdint>
+#include "util/lz.h"
+
+namespace lean {
+static unsigned const g_lz_hash_bits   = 14;
+static size_t const   g_lz_min_match   = 4;
+static size_t const   g_lz_max_offset  = 65535;
+/* No match may start in the last `g_lz_last_literals + g_lz_min_match` bytes, so that the input always ends with
+   a literal run and the compressor does not read past the end of the input. */
+static size_t const   g_lz_last_literals = 8;
+
+static inline uint32_t lz_read32(char const * p) { uint32_t v; memcpy(&v, p, sizeof(v)); return v; }
+static inline uint64_t lz_read64(char const * p) { uint64_t v; memcpy(&v, p, sizeof(v)); return v; }
+static inline unsigned lz_hash(uint32_t v) { return (v * 2654435761u) >> (32 - g_lz_hash_bits); }
+
+static char * lz_write_length(char * out, size_t len) {
+    while (len >= 255) {
+        *out++ = static_cast<char>(255);
+        len -= 255;
+    }
+    *out++ = static_cast<char>(len);
+    return out;
+}
+
+/* Write `lit_len` literals starting at `lit` followed by a match of length `match_len` at distance `offset`.
+   `match_len == 0` encodes the final, literal-only entry. */
+static char * lz_write_sequence(char * out, char const * lit, size_t lit_len, size_t offset, size_t match_len) {
+    char * token = out++;
+    unsigned lit_nibble = lit_len >= 15 ? 15 : lit_len;
+    if (lit_len >= 15)
+        out = lz_write_length(out, lit_len - 15);
+    if (lit_len > 0)
+        memcpy(out, lit, lit_len);
+    out += lit_len;
+    unsigned match_nibble = 0;
+    if (match_len > 0) {
+        out[0] = static_cast<char>(offset & 0xff);
+        out[1] = static_cast<char>(offset >> 8);
+        out += 2;
+        size_t extra = match_len - g_lz_min_match;
+        match_nibble = extra >= 15 ? 15 : extra;
+        if (extra >= 15)
+            out = lz_write_length(out, extra - 15);
+    }
+    *token = static_cast<char>((lit_nibble << 4) | match_nibble);
+    return out;
+}
+
+size_t lz_compress_bound(size_t n) {
+    return n + n / 255 + 16;
+}
+
+size_t lz_compress(char const * src, size_t n, char * dst) {
+    char * out    = dst;
+    size_t anchor = 0;
+    if (n > g_lz_min_match + g_lz_last_literals) {
+        std::vector<uint32_t> table(1u << g_lz_hash_bits, 0);
+        size_t match_limit = n - g_lz_last_literals;
+        size_t i           = 1;
+        size_t misses      = 0;
+        while (i + g_lz_min_match <= match_limit) {
+            uint32_t v  = lz_read32(src + i);
+            unsigned h  = lz_hash(v);
+            size_t cand = table[h];
+            table[h]    = i;
+            if (cand >= i || i - cand > g_lz_max_offset || lz_read32(src + cand) != v) {
+                // skip faster through incompressible data
+                i += 1 + (misses++ >> 6);
+                continue;
+            }
+            size_t len = g_lz_min_match;
+            while (i + len + sizeof(uint64_t) <= match_limit && lz_read64(src + cand + len) == lz_read64(src + i + len))
+                len += sizeof(uint64_t);
+            while (i + len < match_limit && src[cand + len] == src[i + len])
+                len++;
+            while (i > anchor && cand > 0 && src[i - 1] == src[cand - 1]) {
+                i--; cand--; len++;
+            }
+            out    = lz_write_sequence(out, src + anchor, i - anchor, i - cand, len);
+            i     += len;
+            anchor = i;
+            misses = 0;
+            table[lz_hash(lz_read32(src + i - 2))] = i - 2;
+        }
+    }
+    return lz_write_sequence(out, src + anchor, n - anchor, 0, 0) - dst;
+}
+
+static inline bool lz_read_length(unsigned char const * & in, unsigned char const * end, size_t & len) {
+    unsigned b;
+    do {
+        if (in == end)
+            return false;
+        b    = *in++;
+        len += b;
+    } while (b == 255);
+    return true;
+}
+
+bool lz_decompress(char const * src, size_t n, char * dst, size_t dst_size) {
+    unsigned char const * in  = reinterpret_cast<unsigned char const *>(src);
+    unsigned char const * end = in + n;
+    char * out                = dst;
+    char * out_end            = dst + dst_size;
+    while (in != end) {
+        unsigned token = *in++;
+        size_t lit_len = token >> 4;
+        if (lit_len == 15 && !lz_read_length(in, end, lit_len))
+            return false;
+        if (static_cast<size_t>(end - in) < lit_len || static_cast<size_t>(out_end - out) < lit_len)
+            return false;
+        if (lit_len > 0)
+            memcpy(out, in, lit_len);
+        in  += lit_len;
+        out += lit_len;
+        if (in == end) {
+            // the last entry only contains literals
+            return out == out_end;
+        }
+        if (end - in < 2)
+            return false;
+        size_t offset = in[0] | (static_cast<size_t>(in[1]) << 8);
+        in += 2;
+        size_t match_len = token & 15;
+        if (match_len == 15 && !lz_read_length(in, end, match_len))
+            return false;
+        match_len += g_lz_min_match;
+        if (offset == 0 || offset > static_cast<size_t>(out - dst) || static_cast<size_t>(out_end - out) < match_len)
+            return false;
+        char const * match = out - offset;
+        if (offset >= match_len) {
+            memcpy(out, match, match_len);
+        } else {
+            // overlapping match, e.g. a run of a repeated byte
+            for (size_t i = 0; i < match_len; i++)
+                out[i] = match[i];
+        }
+        out += match_len;
+    }
+    return false;
+}
+}
@@ -0,0 +1,24 @@
+/*
+Copyright (c) 2021 Microsoft Corporation. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+*/
+#pragma once
+#include <cstddef>
+
+namespace lean {
+/* Fast LZ77 block compression in the style of LZ4. The compressed block is a sequence of
+   `token literals [offset match_extra]` entries where the high nibble of the token is the number of
+   literals and the low nibble the match length minus 4 (nibble value 15 means "more length bytes follow").
+   The last entry only contains literals. Blocks are independent, so they can be decompressed in parallel. */
+
+/** \brief Maximum size of the compressed form of `n` bytes. */
+size_t lz_compress_bound(size_t n);
+
+/** \brief Compress `src[0, n)` into `dst`, which must have room for `lz_compress_bound(n)` bytes.
+    Return the compressed size. */
+size_t lz_compress(char const * src, size_t n, char * dst);
+
+/** \brief Decompress `src[0, n)` into `dst[0, dst_size)`. Return `false` if the input is malformed
+    or does not decompress to exactly `dst_size` bytes. */
+bool lz_decompress(char const * src, size_t n, char * dst, size_t dst_size);
+}
@@ -0,0 +1,30 @@
+import Lean
+open Lean
+
+/- Benchmark for writing and reading .olean files. The module contains `n` axioms whose types share
+   names and subterms, as the declarations of a large library do. -/
+
+def mkType (i : Nat) : Expr :=
+  let c := mkConst (Name.mkNum `Lean.Meta.aux (i / 10))
+  mkForall `x BinderInfo.default (mkConst `Nat) (mkApp2 c (mkBVar 0) (mkNatLit i))
+
+def mkModule (n : Nat) : ModuleData := Id.run do
+  let mut cs := #[]
+  for i in [0:n] do
+    cs := cs.push <| ConstantInfo.axiomInfo {
+      name := Name.mkNum `Lean.Meta.decl i, levelParams := [], type := mkType i, isUnsafe := false }
+  return { imports := #[{ module := `Init }], constants := cs, entries := #[] }
+
+def main (xs : List String) : IO Unit := do
+  let n     := xs.head!.toNat!
+  let iters := xs.tail!.head!.toNat!
+  let fname := "compact.lean.olean"
+  let m     := mkModule n
+  let mut ok := 0
+  for _ in [0:iters] do
+    saveModuleData fname m
+    let (m', _) ← readModuleData fname
+    if m'.constants.size == n && (m'.constants.get! (n-1)).name == (m.constants.get! (n-1)).name then
+      ok := ok + 1
+  IO.FS.removeFile fname
+  IO.println s!"read: {ok}"
@@ -0,0 +1,42 @@
+import Lean
+open Lean
+
+/- Microbenchmark for `Expr.instantiate1`, `Expr.instantiateRev` and `Expr.abstract` on large telescopes.
+   We build `fun (x_0 : A) (x_1 : f x_0) ... (x_{n-1} : f x_{n-2}) => g x_0 ... x_{n-1}`,
+   and open it one binder at a time as `lambdaTelescope` does. -/
+
+def mkBody : Nat → Expr → Expr
+  | 0,   r => r
+  | i+1, r => mkBody i (mkApp r (mkBVar i))
+
+def mkTelescope : Nat → Expr → Expr
+  | 0,   b => b
+  | i+1, b =>
+    let type := if i == 0 then mkConst `A else mkApp (mkConst `f) (mkBVar 0)
+    mkTelescope i (mkLambda (Name.mkNum `x i) BinderInfo.default type b)
+
+/- Open the telescope using `instantiate1`, and close it again using `abstract`. -/
+partial def openClose (e : Expr) (fvars : Array Expr) : Expr :=
+  if e.isLambda then
+    let x := mkFVar (Name.mkNum `_fvar fvars.size)
+    openClose (e.bindingBody!.instantiate1 x) (fvars.push x)
+  else
+    e.abstract fvars
+
+/- Open the telescope using `instantiateRev` on the binder domains and body. -/
+partial def openRev (e : Expr) (fvars : Array Expr) (r : Expr) : Expr :=
+  if e.isLambda then
+    let d := e.bindingDomain!.instantiateRev fvars
+    openRev e.bindingBody! (fvars.push (mkFVar (Name.mkNum `_fvar fvars.size))) (mkApp r d)
+  else
+    mkApp r (e.instantiateRev fvars)
+
+def main (xs : List String) : IO Unit := do
+  let n     := xs.head!.toNat!
+  let iters := xs.tail!.head!.toNat!
+  let e     := mkTelescope n (mkBody n (mkConst `g))
+  let mut loose := 0
+  for _ in [0:iters] do
+    if (openClose e #[]).hasLooseBVars then loose := loose + 1
+    if (openRev e #[] (mkConst `g)).hasLooseBVars then loose := loose + 1
+  IO.println s!"loose: {loose}"
@@ -0,0 +1,13 @@
+/- Benchmark for `IO.Process.spawn` when the parent process has a big heap.
+   Spawning must not copy or walk the page tables of the parent. -/
+
+def main (xs : List String) : IO Unit := do
+  let n     := xs.head!.toNat!
+  let iters := xs.tail!.head!.toNat!
+  let heap  := mkArray n (1 : Nat)
+  let mut ok := 0
+  for _ in [0:iters] do
+    let child ← IO.Process.spawn {
+      cmd := "true", stdin := IO.Process.Stdio.null, stdout := IO.Process.Stdio.null, stderr := IO.Process.Stdio.null }
+    if (← child.wait) == 0 then ok := ok + 1
+  IO.println s!"ok: {ok}, heap: {heap.size}"
@@ -0,0 +1,37 @@
+/- Microbenchmark for `String.hash` and `String.hash64` on declaration-like names and on a long string.
+   We also report the number of collisions of each hash function on the names. -/
+
+def prefixes : Array String :=
+  #["Lean", "Lean.Meta", "Lean.Elab.Term", "Lean.Elab.Tactic", "Lean.Parser.Command",
+    "Std.HashMap", "Init.Data.List.Basic", "Lean.IR.EmitC", "Nat", "List"]
+
+def parts : Array String :=
+  #["mk", "rec", "casesOn", "noConfusion", "eq_1", "inj", "below", "brecOn", "instInhabited",
+    "match_1", "proof_1", "_private", "sizeOf_spec", "toCtorIdx", "elim", "spec"]
+
+def mkNames (n : Nat) : Array String := Id.run do
+  let mut r := #[]
+  for i in [0:n] do
+    r := r.push s!"{prefixes[i % 10]}.{parts[(i / 10) % 16]}_{i / 160}"
+  return r
+
+def collisions (hs : Array Nat) : Nat := Id.run do
+  let hs := hs.qsort (· < ·)
+  let mut c := 0
+  for i in [1:hs.size] do
+    if hs[i-1] == hs[i] then c := c + 1
+  return c
+
+def main (xs : List String) : IO Unit := do
+  let n     := xs.head!.toNat!
+  let iters := xs.tail!.head!.toNat!
+  let names := mkNames n
+  let big   := "".pushn 'a' (1024 * 1024)
+  let mut hs   : Array Nat := #[]
+  let mut hs64 : Array Nat := #[]
+  let mut bigs : Array Nat := #[]
+  for i in [0:iters] do
+    hs   := names.map fun s => s.hash.toNat
+    hs64 := names.map fun s => (s.hash64 i.toUInt64).toNat
+    bigs := bigs.push (big.hash64 i.toUInt64).toNat
+  IO.println s!"hash collisions: {collisions hs}, hash64 collisions: {collisions hs64}, long: {collisions bigs}"
@@ -0,0 +1,26 @@
+import Lean
+open Lean
+
+/- Spawn tasks that capture an imported environment.
+   Unless the environment is persistent, the first `Task.spawn` has to mark all non-compacted objects
+   reachable from it (e.g., the `constants` map and the environment extension states) as multi-threaded.
+   Usage: `lean --run task_env.lean <num tasks> (leak|noleak)` -/
+
+def spawnAll (env : Environment) (n : Nat) : IO Nat := do
+  let mut tasks := #[]
+  for i in [0:n] do
+    -- a new environment object for each task, as in elaboration
+    let env := env.setMainModule (Name.mkNum `bench i)
+    tasks := tasks.push <| Task.spawn fun _ => if env.contains `Nat.add then 1 else 0
+  return tasks.foldl (fun r t => r + t.get) 0
+
+def main (xs : List String) : IO Unit := do
+  let n       := xs.head!.toNat!
+  let leakEnv := xs.tail!.head! == "leak"
+  let env ← importModules [{module := `Lean}] {} (leakEnv := leakEnv)
+  let t0 ← IO.monoMsNow
+  let r1 ← spawnAll env 1
+  let t1 ← IO.monoMsNow
+  let r2 ← spawnAll env n
+  let t2 ← IO.monoMsNow
+  IO.println s!"leakEnv: {leakEnv}, first task: {t1 - t0}ms, {n} tasks: {t2 - t1}ms ({r1 + r2})"
@@ -0,0 +1,26 @@
+/- Several threads update the same `IO.Ref` and force the same thunk.
+   `IO.Ref.modify` is implemented by taking the value out of the reference and setting it back. -/
+def incr (r : IO.Ref Nat) (n : Nat) : IO Unit := do
+  for _ in [0:n] do
+    r.modify (· + 1)
+
+def contendedRef (numThreads n : Nat) : IO Unit := do
+  let r ← IO.mkRef (0 : Nat)
+  let mut ts : Array (Task (Except IO.Error Unit)) := #[]
+  for _ in [0:numThreads] do
+    ts := ts.push (← IO.asTask (incr r n) Task.Priority.dedicated)
+  for t in ts do
+    IO.ofExcept (← IO.wait t)
+  IO.println s!"ref: {← r.get}"
+
+def sharedThunk (numThreads n : Nat) : IO Unit := do
+  let th : Thunk Nat := ⟨fun _ => dbgSleep 50 fun _ => 2 * n⟩
+  let ts := (List.range numThreads).map fun _ => Task.spawn (fun _ => th.get) Task.Priority.dedicated
+  let mut vs : Array Nat := #[]
+  for t in ts do
+    vs := vs.push (← IO.wait t)
+  IO.println s!"thunk: {vs}"
+
+def main : IO Unit := do
+  contendedRef 8 2000
+  sharedThunk 8 21
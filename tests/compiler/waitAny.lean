@@ -0,0 +1,33 @@
+/- `IO.waitAny` registers a waiter on every task of the list. The tasks finish while the waiters are
+   being registered, and a task may occur several times in the list. -/
+def waitMany (n : Nat) : IO Unit := do
+  let mut ts : List (Task Nat) := []
+  for i in [0:n] do
+    ts := Task.spawn (fun _ => dbgSleep (i % 7).toUInt32 fun _ => i) :: ts
+  let r ← IO.waitAny ts
+  unless r < n do
+    throw $ IO.userError "unexpected result"
+  let mut sum := 0
+  for t in ts do
+    sum := sum + (← IO.wait t)
+  IO.println s!"sum: {sum}"
+
+def waitRepeated (v : Nat) : IO Unit := do
+  let t    := Task.spawn fun _ => dbgSleep 20 fun _ => v
+  let slow := Task.spawn fun _ => dbgSleep 500 fun _ => 0
+  IO.println s!"repeated: {← IO.waitAny [t, t, t]}"
+  IO.println s!"finished: {← IO.waitAny [slow, t, slow, t]}"
+
+/- Several threads block on the same task. -/
+def getShared (n : Nat) : IO Unit := do
+  let t  := Task.spawn fun _ => dbgSleep 50 fun _ => n
+  let ws := (List.range 8).map fun i => Task.spawn (fun _ => t.get + i) Task.Priority.dedicated
+  let mut sum := 0
+  for w in ws do
+    sum := sum + (← IO.wait w)
+  IO.println s!"shared: {sum}"
+
+def main : IO Unit := do
+  waitMany 1000
+  waitRepeated 42
+  getShared 100
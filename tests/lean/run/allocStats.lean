@@ -0,0 +1,27 @@
+/- Arrays of more than 4 Mb are mapped directly, and on Linux growing them does not copy the elements. -/
+def tst1 (n : Nat) : IO Unit := do
+  let s₁ ← IO.getAllocStats
+  let a := (mkArray n (0 : Nat)).push 1
+  unless a.size == n + 1 do
+    throw $ IO.userError "unexpected size"
+  let s₂ ← IO.getAllocStats
+  unless s₂.hugeAllocs > s₁.hugeAllocs && s₂.bigAllocs > s₁.bigAllocs do
+    throw $ IO.userError "array was not allocated as a huge object"
+  unless System.Platform.isWindows || System.Platform.isOSX || s₂.inPlaceResizes > s₁.inPlaceResizes do
+    throw $ IO.userError "array was copied"
+
+#eval tst1 600000
+
+/- Growing a `ByteArray` goes through all the medium size classes. -/
+def tst2 (n : Nat) : IO Unit := do
+  let s₁ ← IO.getAllocStats
+  let mut b := ByteArray.empty
+  for i in [0:n] do
+    b := b.push i.toUInt8
+  unless b.size == n && b.get! (n - 1) == (n - 1).toUInt8 do
+    throw $ IO.userError "unexpected contents"
+  let s₂ ← IO.getAllocStats
+  unless s₂.bigAllocs > s₁.bigAllocs + 4 && s₂.bigFrees > s₁.bigFrees + 4 do
+    throw $ IO.userError "unexpected number of big objects"
+
+#eval tst2 (256 * 1024)
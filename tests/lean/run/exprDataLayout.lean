@@ -0,0 +1,22 @@
+import Lean
+open Lean
+
+/-
+  The C++ kernel reads `Expr.Data` and `Level.Data` directly from the constructor objects
+  (see `src/kernel/expr.h` and `src/kernel/level.h`). This test pins down the bit layout they rely on.
+-/
+
+def bit (i : UInt64) : UInt64 := (1 : UInt64).shiftLeft i
+
+def check (b : Bool) (msg : String) : IO Unit :=
+  unless b do throw <| IO.userError msg
+
+#eval do
+  let d : UInt64 := Expr.mkDataForBinder 0xabcd 5 true false true false BinderInfo.instImplicit
+  check (d == 0xabcd + bit 32 + bit 34 + (3 : UInt64).shiftLeft 37 + (5 : UInt64).shiftLeft 40) "Expr.Data layout"
+  let d : UInt64 := Expr.mkDataForBinder 0 0 false false false false BinderInfo.auxDecl
+  check (d == (4 : UInt64).shiftLeft 37) "Expr.Data binder info"
+  let d : UInt64 := Expr.mkDataForLet 7 2 false true false true true
+  check (d == 7 + bit 33 + bit 35 + bit 36 + (2 : UInt64).shiftLeft 40) "Expr.Data layout for let-expressions"
+  let d : UInt64 := Level.mkData 9 4 true true
+  check (d == 9 + bit 32 + bit 33 + (4 : UInt64).shiftLeft 40) "Level.Data layout"
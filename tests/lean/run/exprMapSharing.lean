@@ -0,0 +1,47 @@
+import Lean
+
+open Lean
+
+/-- `f e e` nested `n` times, so the term has `n+1` distinct nodes but `2^n` leaves. -/
+def mkShared (f : Expr) : Nat → Expr → Expr
+  | 0,   e => e
+  | n+1, e => let e := mkShared f n e; mkApp2 f e e
+
+def nat := mkConst `Nat
+
+def tst1 (n : Nat) : IO Unit := do
+  let f := mkConst `Nat.add
+  let e := mkShared f n (mkBVar 0)
+  let e₁ := e.instantiate1 (mkNatLit 1)
+  unless !e₁.hasLooseBVars && e₁.hash == (mkShared f n (mkNatLit 1)).hash do
+    throw $ IO.userError "instantiate1 failed"
+  let x := mkFVar `x
+  let e₂ := (mkShared f n x).abstract #[x]
+  unless e₂.hasLooseBVars && e₂.hash == e.hash do
+    throw $ IO.userError "abstract failed"
+
+#eval tst1 64
+
+/- The kernel caches (inferred types, `whnf` results and the equivalence manager)
+   must visit each shared node once, otherwise these declarations do not terminate. -/
+def tst2 (n : Nat) : CoreM Unit := do
+  let f := mkConst `Nat.add
+  let v₁ := mkShared f n (mkNatLit 1)
+  -- same term, built again so that no node is shared with `v₁`
+  let v₂ := mkShared f n (mkNatLit (n - n + 1))
+  addDecl <| Declaration.defnDecl {
+    name        := `_shared,
+    levelParams := [],
+    type        := nat,
+    value       := v₁,
+    hints       := ReducibilityHints.regular 0,
+    safety      := DefinitionSafety.safe
+  }
+  addDecl <| Declaration.thmDecl {
+    name        := `_shared_eq,
+    levelParams := [],
+    type        := mkApp3 (mkConst `Eq [levelOne]) nat v₁ v₂,
+    value       := mkApp2 (mkConst `Eq.refl [levelOne]) nat v₁
+  }
+
+#eval tst2 64
@@ -0,0 +1,36 @@
+import Lean.Expr
+
+open Lean
+
+def checkEq (msg : String) (e₁ e₂ : Expr) : IO Unit :=
+  unless e₁ == e₂ do throw $ IO.userError s!"{msg}: {e₁} != {e₂}"
+
+def tst1 : IO Unit := do
+  let f := mkConst `f
+  let a := mkConst `a
+  let b := mkConst `b
+  let c := mkConst `c
+  let type := mkSort levelZero
+  -- fun x y z => f x y z
+  let e := mkLambda `x BinderInfo.default type <| mkLambda `y BinderInfo.default type <|
+    mkLambda `z BinderInfo.default type <| mkAppN f #[mkBVar 2, mkBVar 1, mkBVar 0]
+  let xs := #[a, b, c]
+  checkEq "all" (e.instantiateBinders 0 3 xs) (mkAppN f #[a, b, c])
+  checkEq "one by one" (e.instantiateBinders 0 3 xs)
+    (((e.bindingBody!.instantiate1 a).bindingBody!.instantiate1 b).bindingBody!.instantiate1 c)
+  checkEq "range" (e.instantiateBinders 1 3 xs) (mkLambda `z BinderInfo.default type (mkAppN f #[b, c, mkBVar 0]))
+  checkEq "none" (e.instantiateBinders 2 2 xs) e
+  -- forall x y, f x y
+  let p := mkForall `x BinderInfo.default type <| mkForall `y BinderInfo.default type <| mkAppN f #[mkBVar 1, mkBVar 0]
+  checkEq "forall" (p.instantiateBinders 0 2 xs) (mkAppN f #[a, b])
+  -- only the existing binders are instantiated
+  checkEq "fewer binders" (p.instantiateBinders 0 3 xs) (mkAppN f #[a, b])
+  -- `let` binders are not skipped: only `x` is instantiated, with `xs[0]`
+  let l := mkForall `x BinderInfo.default type <| mkLet `y type a <| mkForall `z BinderInfo.default type <|
+    mkAppN f #[mkBVar 2, mkBVar 1, mkBVar 0]
+  checkEq "let" (l.instantiateBinders 0 2 xs) (mkLet `y type a <| mkForall `z BinderInfo.default type <| mkAppN f #[a, mkBVar 1, mkBVar 0])
+  -- the binders after a leading `let` are left alone
+  let l' := mkLet `y type a <| mkForall `z BinderInfo.default type <| mkAppN f #[mkBVar 1, mkBVar 0]
+  checkEq "leading let" (l'.instantiateBinders 0 2 xs) l'
+
+#eval tst1
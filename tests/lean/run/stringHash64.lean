@@ -0,0 +1,25 @@
+def tst1 : IO Unit := do
+  let s := "Lean.Meta.whnfCore"
+  unless s.hash64 11 == 1407044376343040319 do
+    throw $ IO.userError "unexpected hash"
+  unless s.hash64 11 != s.hash64 12 && "".hash64 11 != "".hash64 12 do
+    throw $ IO.userError "seed is ignored"
+  unless ("Lean.Meta" ++ ".whnfCore").hash64 11 == s.hash64 11 do
+    throw $ IO.userError "hash depends on how the string was built"
+  unless (s.push 'x').hash64 11 != s.hash64 11 do
+    throw $ IO.userError "collision"
+
+#eval tst1
+
+/- Strings longer than the 48 bytes consumed by each round, and every length around them. -/
+def tst2 : IO Unit := do
+  let mut s := ""
+  let mut prev : UInt64 := "".hash64 7
+  for i in [0:200] do
+    s := s.push (Char.ofNat (97 + i % 26))
+    let h := s.hash64 7
+    unless h != prev && h == (s.drop 0).hash64 7 do
+      throw $ IO.userError s!"unexpected hash for length {s.length}"
+    prev := h
+
+#eval tst2